@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/**
+ * @file
+ * Internal functions for batched driver sampling
+ * @ingroup internalapi
+ *
+ * A batch samples every device of a driver supporting @c measure_all from a
+ * single sampling entry: a dedicated thread, or a single entry in the shared
+ * scheduler. Each sample measures the devices once, in a single transaction
+ * with the hardware, and stores the values for every device being measured
+ * through @ref emlDeviceMonitorStore.
+ */
+
+#ifndef EML_BATCH_H
+#define EML_BATCH_H
+
+#include <stddef.h>
+
+#include "error.h"
+
+struct emlDevice;
+struct emlDriver;
+struct emlBatch;
+
+/**
+ * Creates a batch for a driver supporting @c measure_all.
+ *
+ * @param[out] batch Address where the new batch will be copied
+ * @param[in] driver Initialized driver
+ *
+ * @retval EML_SUCCESS The batch was created
+ * @retval EML_NO_MEMORY Insufficient memory for the batch
+ */
+enum emlError emlBatchCreate(struct emlBatch** batch, const struct emlDriver* driver);
+
+/**
+ * Adds a reference to a batch.
+ *
+ * @param[in] batch Batch
+ */
+void emlBatchRetain(struct emlBatch* batch);
+
+/**
+ * Drops a reference to a batch, freeing it if it becomes unused.
+ *
+ * No devices should be measured through the batch when the last reference is
+ * dropped.
+ *
+ * @param[in] batch Batch
+ *
+ * @retval EML_SUCCESS The reference was dropped
+ */
+enum emlError emlBatchRelease(struct emlBatch* batch);
+
+/**
+ * Returns the name of the driver sampled by a batch.
+ *
+ * @param[in] batch Batch
+ *
+ * @return Driver name
+ */
+const char* emlBatchName(const struct emlBatch* batch);
+
+/**
+ * Starts storing samples for a device, and starts sampling the batch if no
+ * other device was being measured.
+ *
+ * The first sample for the device is stored on the next batch sample.
+ *
+ * @param[in] batch Batch of the device driver
+ * @param[in] device Device being measured
+ *
+ * @retval EML_SUCCESS The device joined the batch
+ * @retval EML_NO_MEMORY Insufficient memory to schedule the batch
+ * @retval EML_UNKNOWN The sampling thread could not be created
+ */
+enum emlError emlBatchJoin(struct emlBatch* batch, const struct emlDevice* device);
+
+/**
+ * Stops storing samples for a device, and stops sampling the batch if no
+ * other device is being measured.
+ *
+ * If the batch is being sampled at the time of the call, waits until the
+ * sample is complete, so no more samples are stored for the device once this
+ * returns.
+ *
+ * @param[in] batch Batch of the device driver
+ * @param[in] device Device no longer measured
+ *
+ * @retval EML_SUCCESS The device left the batch
+ * @retval EML_UNKNOWN The sampling thread could not be joined
+ */
+enum emlError emlBatchLeave(struct emlBatch* batch, const struct emlDevice* device);
+
+/**
+ * Measures the devices of the batch once and stores a sample for each device
+ * being measured.
+ *
+ * Called periodically by the batch sampling thread, or by the shared
+ * scheduler.
+ *
+ * @param[in] batch Batch
+ *
+ * @retval EML_SUCCESS The sample was taken
+ */
+enum emlError emlBatchSample(struct emlBatch* batch);
+
+/**
+ * Measures a single device of the batch and stores the sample, in order with
+ * batch samples.
+ *
+ * @param[in] batch Batch of the device driver
+ * @param[in] device Device being measured
+ * @param[out] stored Whether the sample was stored (see @ref
+ * emlDeviceMonitorStore)
+ *
+ * @retval EML_SUCCESS The sample was taken
+ */
+enum emlError emlBatchSampleDevice(
+    struct emlBatch* batch,
+    const struct emlDevice* device,
+    int* stored);
+
+/**
+ * Computes the deadline for the sample following the one due at @a deadline,
+ * counting missed deadlines for every device being measured.
+ *
+ * @param[in] batch Batch
+ * @param[in] deadline Deadline of the last sample
+ *
+ * @return Deadline for the next sample
+ */
+unsigned long long emlBatchNextDeadline(struct emlBatch* batch, unsigned long long deadline);
+
+#endif /*EML_BATCH_H*/
@@ -16,6 +16,8 @@
 #ifndef EML_DATA_H
 #define EML_DATA_H
 
+#include <pthread.h>
+#include <stdint.h>
 #include <sys/queue.h>
 
 #include <eml/data.h>
@@ -61,6 +63,9 @@ struct emlDataProperties {
   size_t inst_power_field;
 };
 
+/** Maximum number of fields in a datapoint (timestamp, energy and power) */
+#define EML_DATAPOINT_MAX_FIELDS 3
+
 /** Singly-linked list of datapoint blocks. */
 struct emlDataList;
 
@@ -68,21 +73,92 @@ struct emlDataList;
 struct emlDataBlock {
   /** Link to the next block */
   SLIST_ENTRY(emlDataBlock) entries;
-  /** Buffer holding all field values for the datapoints in this block */
+  /** Buffer holding all field values for the datapoints in this block, a
+   * column of @a size values for each field (NULL once compressed) */
   unsigned long long* fields;
+  /** Number of datapoints the block can hold */
+  size_t size;
+  /** Compressed field values, one column after another (NULL unless
+   * compressed, see pack.h) */
+  unsigned char* packed;
+  /** Byte offset of each column within the compressed values */
+  size_t packedoff[EML_DATAPOINT_MAX_FIELDS];
+  /** Index of the first datapoint in this block within the run */
+  size_t first;
+  /** Energy consumed from the first datapoint of the run up to the first
+   * datapoint of this block (prefix sum, so blocks can be skipped or evicted) */
+  unsigned long long energy_base;
+  /** Energy consumed from the first datapoint of this block up to each
+   * datapoint (running prefix sum within the block, never compressed, so
+   * that totals never read the block back) */
+  unsigned long long* energy;
+  /** Number of datasets starting on this block */
+  size_t refs;
 };
 
 #ifndef EML_DATABLOCK_SIZE
-/** Number of datapoints in a block (compile-time option) */
+/** Maximum number of datapoints in a block (compile-time option) */
 #define EML_DATABLOCK_SIZE 10000
 #endif
 
-/** Number of datapoints in a block */
+#ifndef EML_DATABLOCK_MIN_SIZE
+/** Number of datapoints in the first block of a run (compile-time option).
+ * Each block after it doubles in size, up to @ref EML_DATABLOCK_SIZE. */
+#define EML_DATABLOCK_MIN_SIZE 64
+#endif
+
+/** Maximum number of datapoints in a block */
 static const size_t DATABLOCK_SIZE = EML_DATABLOCK_SIZE;
 
+/** Number of datapoints in the first block of a run */
+static const size_t DATABLOCK_MIN_SIZE = EML_DATABLOCK_MIN_SIZE < EML_DATABLOCK_SIZE ?
+  EML_DATABLOCK_MIN_SIZE : EML_DATABLOCK_SIZE;
+
+/** Maximum number of block sizes (enough for any size_t block size) */
+#define EML_DATABLOCK_CLASSES 64
+
 /** Fixed field ID for timestamp values */
 static const size_t timestamp_field = 0;
 
+#ifndef EML_DATABLOCK_POOL_SIZE
+/** Number of free blocks kept ready for each device (compile-time option) */
+#define EML_DATABLOCK_POOL_SIZE 2
+#endif
+
+#ifndef EML_DATABLOCK_POOL_MAX
+/** Maximum number of free blocks kept for each device (compile-time option) */
+#define EML_DATABLOCK_POOL_MAX 16
+#endif
+
+/** Pool of preallocated data blocks for a single device.
+ *
+ * Free blocks are kept in a lock-free stack for each block size. Blocks are
+ * taken only by the thread sampling the device, but can be given back from
+ * any thread.
+ *
+ * Reference-counted, as measurement runs may outlive the device monitor.
+ */
+struct emlDataBlockPool {
+  /** Top of the free block stack for each block size, smallest first */
+  struct emlDataBlock* head[EML_DATABLOCK_CLASSES];
+  /** Number of free blocks for each block size */
+  size_t nfree[EML_DATABLOCK_CLASSES];
+  /** Number of fields in each block */
+  size_t nfields;
+  /** Reference count (updated atomically, as runs using the pool may be
+   * released from any thread) */
+  size_t refcount;
+};
+
+/** Entry of the block index of a measurement run */
+struct emlDataIndexEntry {
+  /** Indexed block */
+  struct emlDataBlock* block;
+  /** Timestamp of the first datapoint in the block (each block ends where
+   * the next one starts) */
+  unsigned long long firstts;
+};
+
 /** Linked list of data blocks representing a continuous measurement run.
  *
  * This data can back multiple datasets if nested measurements are used.
@@ -91,12 +167,48 @@ static const size_t timestamp_field = 0;
 struct emlDataRun {
   /** Block list head */
   SLIST_HEAD(emlDataBlockList, emlDataBlock) blocks;
-  /** Reference count */
+  /** Reference count (updated atomically, as datasets may be freed from any
+   * thread) */
   size_t refcount;
-  /** Device these measurements were taken from */
+  /** Device these measurements were taken from (NULL if loaded from a file) */
   const struct emlDevice* device;
+  /** Device name and properties for runs loaded from a file */
+  char* devname;
+  struct emlDataProperties loaded_props;
   /** Properties for these measurements */
   const struct emlDataProperties* props;
+  /** Pool blocks are returned to when the run is released */
+  struct emlDataBlockPool* pool;
+
+  /** Protects block eviction and dataset references to blocks */
+  pthread_mutex_t lock;
+  /** Number of blocks in the list */
+  size_t nblocks;
+  /** Maximum number of blocks retained (0 for no limit) */
+  size_t maxblocks;
+  /** Maximum age of retained blocks, in timestamp units (0 for no limit) */
+  unsigned long long maxtime;
+  /** Number of datapoints written to the run stream, if any (SIZE_MAX if the
+   * run is not being streamed). Blocks are not evicted until written. */
+  size_t streamed;
+  /** Whether full blocks are compressed */
+  int compress;
+  /** Number of datapoints in blocks already considered for compression */
+  size_t npacked;
+  /** Block being compressed without the run lock, which must not be evicted
+   * (NULL if none) */
+  struct emlDataBlock* packing;
+
+  /** Index of the blocks in the list, in list order, for binary search by
+   * timestamp. Updated by the sampler, so the last blocks may be missing. */
+  struct emlDataIndexEntry* index;
+  /** Number of entries in the index */
+  size_t nindexed;
+  /** Number of entries allocated for the index */
+  size_t indexcap;
+
+  /** Whether only totals are kept for this run (the block list is empty) */
+  int totals_only;
 };
 
 /** Measurement dataset */
@@ -119,6 +231,49 @@ struct emlData {
   unsigned long long consumed_energy;
 };
 
+/** Decoding state for a compressed column */
+struct emlPackedColumn {
+  /** Next encoded byte */
+  const unsigned char* p;
+  /** Last value decoded */
+  unsigned long long value;
+  /** Difference between the last two values decoded (timestamps only) */
+  unsigned long long delta;
+};
+
+/** Reads the datapoints of a block in order, whether compressed or not */
+struct emlDataBlockReader {
+  /** Raw field values (NULL if the block is compressed) */
+  const unsigned long long* fields;
+  /** Number of datapoints in the block */
+  size_t size;
+  /** Decoding state for each column of a compressed block */
+  struct emlPackedColumn columns[EML_DATAPOINT_MAX_FIELDS];
+  /** Number of fields in each datapoint */
+  size_t nfields;
+  /** Index of the next datapoint within the block */
+  size_t i;
+};
+
+/** Cursor over the power values of a dataset.
+ *
+ * Power values are the power readings of each datapoint or, for devices with
+ * energy counters, the average power since the previous datapoint.
+ */
+struct emlDataPowerCursor {
+  /** Dataset being walked */
+  const struct emlData* data;
+  /** Current block (NULL once all values have been returned) */
+  const struct emlDataBlock* block;
+  /** Reader for the current block */
+  struct emlDataBlockReader reader;
+  /** Whether the previous datapoint is known (it is not across evicted
+   * blocks) */
+  int hasprev;
+  /** Timestamp of the previous datapoint */
+  unsigned long long prevts;
+};
+
 /** SI unit factors */
 enum emlSIFactor {
   EML_SI_NANO  = -1000000000,
@@ -136,10 +291,52 @@ enum emlTimeUnits {
     EML_TIME_NANOSECONDS = 1000000000L,
 };
 
+/**
+ * Converts a value to base SI units.
+ *
+ * @param[in] value Value in device units
+ * @param[in] factor Unit factor (see @ref emlDataProperties)
+ *
+ * @return Value in base SI units
+ */
+double emlDataApplyFactor(unsigned long long value, int factor);
+
+/**
+ * Computes the energy consumed between two consecutive datapoints.
+ *
+ * @param[in] props Measurement properties
+ * @param[in] prev Field values for the earlier datapoint
+ * @param[in] cur Field values for the later datapoint
+ *
+ * @return Energy consumed, in energy units
+ */
+unsigned long long emlDataPointEnergy(
+    const struct emlDataProperties* props,
+    const unsigned long long* prev,
+    const unsigned long long* cur);
+
+/**
+ * Computes the energy consumed from the first datapoint of a run up to a
+ * datapoint in a block.
+ *
+ * Takes constant time, from the prefix sums kept for the block.
+ *
+ * @param[in] block Block holding the datapoint
+ * @param[in] i Index of the datapoint within the block
+ *
+ * @return Energy consumed, in energy units
+ */
+unsigned long long emlDataEnergyAt(
+    const struct emlDataBlock* block,
+    size_t i);
+
 /**
  * Computes totals for a dataset from the datapoints.
  *
- * Fills in the @a elapsed_time and @a consumed_energy fields.
+ * Fills in the @a elapsed_time and @a consumed_energy fields from the prefix
+ * sums at the first and last datapoints, so only the first and last blocks
+ * are read. Datasets from totals-only runs are left untouched, as their
+ * totals are set on creation.
  *
  * @param[in,out] data Dataset to have totals updated
  *
@@ -147,13 +344,196 @@ enum emlTimeUnits {
  */
 enum emlError emlDataUpdateTotals(struct emlData* data);
 
+/**
+ * Prepares a cursor over the power values of a dataset.
+ *
+ * @param[out] cursor Cursor to be initialized
+ * @param[in] data Dataset, which must not be totals-only
+ */
+void emlDataPowerCursorInit(struct emlDataPowerCursor* cursor, const struct emlData* data);
+
+/**
+ * Returns the next power value of a dataset.
+ *
+ * @param[in,out] cursor Cursor
+ * @param[out] time Timestamp of the value, in seconds
+ * @param[out] power Power value, in Watts
+ *
+ * @return 1 if a value was returned, 0 once all values have been returned
+ */
+int emlDataPowerNext(struct emlDataPowerCursor* cursor, double* time, double* power);
+
+/**
+ * Returns the block following another one within a dataset.
+ *
+ * Blocks past the end of the dataset are never returned, as the sampler may
+ * still be filling them. Blocks may be missing in between if evicted, so
+ * datapoints should be located through the @a first index of each block.
+ *
+ * @param[in] data Dataset
+ * @param[in] bp Block belonging to @a data
+ *
+ * @return Next block, or NULL if @a bp holds the last datapoint of @a data
+ */
+const struct emlDataBlock* emlDataNextBlock(
+    const struct emlData* data,
+    const struct emlDataBlock* bp);
+
+/**
+ * Returns the name of the device a measurement run was taken from.
+ *
+ * @param[in] run Measurement run
+ *
+ * @return Device name
+ */
+const char* emlDataRunDeviceName(const struct emlDataRun* run);
+
 /**
  * Frees data for a measurement run.
  *
+ * Data blocks are returned to the run pool.
+ *
  * @param[in] run List of datapoint blocks to be freed
  *
  * @retval EML_SUCCESS The list was successfully freed
  */
 enum emlError emlDataRunRelease(struct emlDataRun* run);
 
+/**
+ * Evicts the oldest blocks exceeding the retention limits of a run.
+ *
+ * Totals for datasets spanning evicted blocks are still correct, as they
+ * are computed from the energy prefix sums of the remaining blocks. Blocks
+ * at or after the first block of any live dataset are never evicted, nor are
+ * blocks holding any of the @a keep datapoints (or ending right before them),
+ * nor blocks still to be written to the run stream, nor the block being
+ * compressed and the ones after it.
+ *
+ * Must be called with the run lock held, from the thread sampling the run.
+ *
+ * @param[in] run Measurement run
+ * @param[in] keep Indexes of datapoints whose blocks must be kept
+ * @param[in] nkeep Number of indexes in @a keep
+ * @param[in] now Timestamp of the last datapoint in the run
+ */
+void emlDataRunEvict(
+    struct emlDataRun* run,
+    const size_t* keep,
+    size_t nkeep,
+    unsigned long long now);
+
+/**
+ * Compresses the full blocks of a run not compressed yet.
+ *
+ * Follows the same rules as eviction, so blocks referenced by live datasets,
+ * which may be read without locks, never change. Blocks are compressed once
+ * written to the run stream, if any.
+ *
+ * Each block is compressed without the run lock, so that neither the sampler
+ * nor the main thread wait for it, and its raw values are only replaced under
+ * the lock. Must be called without the run lock held, from a single thread
+ * other than the sampler (see housekeeper.h).
+ *
+ * @param[in] run Measurement run
+ * @param[in] npoints Number of datapoints published by the sampler (only
+ * blocks followed by some of them are looked at, as the sampler may be
+ * appending blocks after the last one)
+ */
+void emlDataRunPack(struct emlDataRun* run, size_t npoints);
+
+/**
+ * Appends the blocks added to a run since the last call to its index.
+ *
+ * Blocks are left out of the index if memory for it could not be allocated,
+ * so lookups must still walk the list from the last indexed block.
+ *
+ * Must be called with the run lock held, from the thread sampling the run
+ * (or once the run is no longer sampled).
+ *
+ * @param[in] run Measurement run
+ */
+void emlDataRunIndex(struct emlDataRun* run);
+
+/**
+ * Returns the number of fields in each datapoint for a set of properties.
+ *
+ * @param[in] props Measurement properties
+ *
+ * @return Number of fields, including the timestamp
+ */
+size_t emlDataFieldCount(const struct emlDataProperties* props);
+
+/**
+ * Returns the number of datapoints for the block following another one in a
+ * run, so that block sizes grow geometrically from @ref DATABLOCK_MIN_SIZE.
+ *
+ * @param[in] size Number of datapoints in the previous block
+ *
+ * @return Number of datapoints in the next block
+ */
+size_t emlDataBlockNextSize(size_t size);
+
+/**
+ * Creates an empty block pool.
+ *
+ * @param[out] pool Address where the new pool will be copied
+ * @param[in] nfields Number of fields in each block
+ *
+ * @retval EML_SUCCESS The pool was created
+ * @retval EML_NO_MEMORY Insufficient memory for the pool
+ */
+enum emlError emlDataBlockPoolCreate(struct emlDataBlockPool** pool, size_t nfields);
+
+/**
+ * Drops a reference to a block pool, freeing it if it becomes unused.
+ *
+ * @param[in] pool Block pool
+ *
+ * @retval EML_SUCCESS The reference was dropped
+ */
+enum emlError emlDataBlockPoolRelease(struct emlDataBlockPool* pool);
+
+/**
+ * Allocates free blocks of a given size until the pool holds at least @a
+ * nblocks of them.
+ *
+ * Can be called from any thread, while blocks are being taken.
+ *
+ * @param[in] pool Block pool
+ * @param[in] size Number of datapoints in each block (@ref DATABLOCK_MIN_SIZE
+ * or a size returned by @ref emlDataBlockNextSize)
+ * @param[in] nblocks Number of free blocks desired
+ *
+ * @retval EML_SUCCESS The pool holds @a nblocks free blocks or more
+ * @retval EML_NO_MEMORY Insufficient memory for the new blocks
+ */
+enum emlError emlDataBlockPoolFill(
+    struct emlDataBlockPool* pool,
+    size_t size,
+    size_t nblocks);
+
+/**
+ * Takes a free block of a given size from the pool.
+ *
+ * Must only be called from one thread at a time.
+ *
+ * @param[in] pool Block pool
+ * @param[in] size Number of datapoints in the block, as for @ref
+ * emlDataBlockPoolFill
+ *
+ * @return A free block, or NULL if the pool holds none of that size
+ */
+struct emlDataBlock* emlDataBlockPoolTake(struct emlDataBlockPool* pool, size_t size);
+
+/**
+ * Gives a block back to the pool.
+ *
+ * Blocks above @ref EML_DATABLOCK_POOL_MAX for their size are freed instead.
+ * Can be called from any thread.
+ *
+ * @param[in] pool Block pool
+ * @param[in] block Block no longer in use
+ */
+void emlDataBlockPoolGive(struct emlDataBlockPool* pool, struct emlDataBlock* block);
+
 #endif /*EML_DATA_H*/
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/**
+ * @file
+ * @ingroup internalapi
+ * Layout of binary dataset files (see [Binary serialization](doc/binary.md))
+ */
+
+#ifndef EML_DATAFILE_H
+#define EML_DATAFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "data.h"
+#include "device.h"
+
+/** Magic string at the start of every file (including the trailing NUL) */
+#define EML_DATAFILE_MAGIC "EMLDATA"
+
+/** Format version written by this library */
+#define EML_DATAFILE_VERSION 1
+
+/** Byte offsets of the fixed header fields, all little-endian */
+enum emlDataFileOffset {
+  EML_DATAFILE_OFF_MAGIC = 0,
+  EML_DATAFILE_OFF_VERSION = 8,
+  EML_DATAFILE_OFF_HEADER_SIZE = 12,
+  EML_DATAFILE_OFF_TIME_FACTOR = 16,
+  EML_DATAFILE_OFF_ENERGY_FACTOR = 20,
+  EML_DATAFILE_OFF_POWER_FACTOR = 24,
+  EML_DATAFILE_OFF_NFIELDS = 28,
+  EML_DATAFILE_OFF_ENERGY_FIELD = 32,
+  EML_DATAFILE_OFF_POWER_FIELD = 36,
+  EML_DATAFILE_OFF_FLAGS = 40,
+  EML_DATAFILE_OFF_NAMELEN = 44,
+  EML_DATAFILE_OFF_NPOINTS = 48,
+  EML_DATAFILE_OFF_ELAPSED = 56,
+  EML_DATAFILE_OFF_CONSUMED = 64,
+  EML_DATAFILE_OFF_NCHUNKS = 72,
+  /** Device name, NUL-terminated and padded to a multiple of 8 bytes */
+  EML_DATAFILE_OFF_NAME = 80,
+};
+
+/** Maximum size of a file header, including the device name */
+#define EML_DATAFILE_HEADER_MAX (EML_DATAFILE_OFF_NAME + EML_DEVNAME_MAXLEN + 8)
+
+/** Size of the header preceding the columns of each chunk */
+#define EML_DATAFILE_CHUNK_HEADER_SIZE 8
+
+/** Header flags */
+enum emlDataFileFlags {
+  /** Datapoints were kept (unset for datasets from totals-only runs) */
+  EML_DATAFILE_SAMPLES = 1,
+  /** Written while measuring, and not finished: counts and totals in the
+   * header are not set, and chunks go on up to the end of the file */
+  EML_DATAFILE_STREAM = 2,
+};
+
+/** Contents of a file header */
+struct emlDataFileHeader {
+  /** Header size, in bytes */
+  size_t size;
+  /** Measurement properties */
+  struct emlDataProperties props;
+  /** Number of fields in each datapoint */
+  size_t nfields;
+  /** Header flags (see @ref emlDataFileFlags) */
+  uint32_t flags;
+  /** Device name (points into the parsed header) */
+  const char* device;
+  /** Total number of datapoints (not set for unfinished streams) */
+  unsigned long long npoints;
+  /** Dataset totals, in device units (not set for unfinished streams) */
+  unsigned long long elapsed;
+  unsigned long long consumed;
+  /** Number of chunks (not set for unfinished streams) */
+  unsigned long long nchunks;
+};
+
+/**
+ * Parses and checks a file header.
+ *
+ * @param[in] header Start of the file
+ * @param[in] size Number of bytes available at @a header
+ * @param[out] info Header contents
+ *
+ * @retval EML_SUCCESS The header was parsed
+ * @retval EML_PARSING_ERROR The header is malformed or truncated
+ * @retval EML_UNSUPPORTED The format version is not supported
+ */
+enum emlError emlDataFileParseHeader(
+    const unsigned char* header,
+    size_t size,
+    struct emlDataFileHeader* info);
+
+/**
+ * Reads a binary dataset from a file into a new dataset.
+ *
+ * @param[in] file File positioned at the start of the header
+ * @param[out] data Address where the new dataset will be copied
+ *
+ * @retval EML_SUCCESS The dataset was read
+ * @retval EML_PARSING_ERROR The file is malformed or truncated
+ * @retval EML_UNSUPPORTED The format version is not supported
+ * @retval EML_NO_MEMORY Insufficient memory for the dataset
+ */
+enum emlError emlDataFileLoad(FILE* file, struct emlData** data);
+
+/**
+ * Formats a file header.
+ *
+ * @param[out] header Buffer of at least @ref EML_DATAFILE_HEADER_MAX bytes
+ * @param[in] props Measurement properties
+ * @param[in] devname Device name
+ * @param[in] flags Header flags (see @ref emlDataFileFlags)
+ * @param[in] npoints Total number of datapoints
+ * @param[in] elapsed Total elapsed time, in device units
+ * @param[in] consumed Total consumed energy, in device units
+ * @param[in] nchunks Number of chunks
+ *
+ * @return Header size, in bytes
+ */
+size_t emlDataFileFormatHeader(
+    unsigned char* header,
+    const struct emlDataProperties* props,
+    const char* devname,
+    unsigned int flags,
+    unsigned long long npoints,
+    unsigned long long elapsed,
+    unsigned long long consumed,
+    unsigned long long nchunks);
+
+/**
+ * Formats a chunk header.
+ *
+ * @param[out] header Buffer of @ref EML_DATAFILE_CHUNK_HEADER_SIZE bytes
+ * @param[in] npoints Number of datapoints in the chunk
+ */
+void emlDataFileFormatChunkHeader(unsigned char* header, unsigned long long npoints);
+
+#endif /*EML_DATAFILE_H*/
@@ -24,6 +24,20 @@
 struct emlData;
 struct emlDataProperties;
 
+/**
+ * Configuration options common to all drivers, handled by the device monitor.
+ *
+ * Must be included in the configuration options of every driver.
+ */
+#define EML_MONITOR_CFGOPTS \
+  CFG_STR("sampling_policy", "delay", CFGF_NONE), \
+  CFG_STR("data_mode", 0, CFGF_NONE), \
+  CFG_INT("retention_blocks", 0, CFGF_NONE), \
+  CFG_INT("retention_time", 0, CFGF_NONE), \
+  CFG_STR("stream_dir", 0, CFGF_NONE), \
+  CFG_BOOL("compress_blocks", cfg_false, CFGF_NONE), \
+  CFG_BOOL("section_samples", cfg_false, CFGF_NONE)
+
 /** Contains state, properties and methods for a device type */
 struct emlDriver {
   /** Driver name */
@@ -56,6 +70,21 @@ struct emlDriver {
   /** Number of available devices */
   size_t ndevices;
 
+  /**
+   * Whether devices read cumulative energy counters (set by @ref init).
+   *
+   * Totals-only runs of these devices are measured through counter
+   * snapshots: samples are only taken when measurements are started or
+   * stopped, and by the watchdog every @ref counter_period (see watchdog.h),
+   * instead of periodically.
+   */
+  int counter_snapshots;
+
+  /** Longest interval between counter readings that cannot miss a
+   * wraparound, in nanoseconds (set by @ref init along with @ref
+   * counter_snapshots) */
+  unsigned long long counter_period;
+
   /**
    * Initializes the driver.
    *
@@ -76,11 +105,27 @@ struct emlDriver {
    * Takes a measurement from a single device
    *
    * @param[in] devno ID of the device to measure
-   * @param[out] values Where to write measurement values
+   * @param[out] values Where to write measurement values, indexed by field
+   * number (see @ref emlDataProperties)
    *
    * @retval EML_SUCCESS The measurement was taken
    */
   enum emlError (*measure) (size_t devno, unsigned long long* values);
+
+  /**
+   * Takes a measurement from every device at once (optional, may be NULL)
+   *
+   * Used instead of @ref measure when available, so that drivers can read all
+   * their devices in a single transaction, with a shared timestamp.
+   *
+   * @param[out] values Where to write measurement values for each device,
+   * @ref EML_DATAPOINT_MAX_FIELDS per device (values for device @a devno start
+   * at <tt>values[devno * EML_DATAPOINT_MAX_FIELDS]</tt>)
+   * @param[in] ndevices Number of devices to measure
+   *
+   * @retval EML_SUCCESS The measurements were taken
+   */
+  enum emlError (*measure_all) (unsigned long long* values, size_t ndevices);
 };
 
 #endif /*EML_DRIVER_H*/
@@ -21,8 +21,10 @@ extern "C" {
 #endif
 
 #include <eml/data.h>
+#include <eml/datafile.h>
 #include <eml/device.h>
 #include <eml/error.h>
+#include <eml/table.h>
 
 /**
  * @defgroup externalapi_main Base
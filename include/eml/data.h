@@ -20,6 +20,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdio.h>
 
 #include <eml/error.h>
@@ -34,6 +35,48 @@ extern "C" {
 /** Data obtained from an energy monitoring section for a single device */
 typedef struct emlData emlData_t;
 
+/** Power statistics over the datapoints of a data object, in Watts (see @ref
+ * emlDataGetStats) */
+typedef struct emlDataStats {
+  /** Number of power values */
+  size_t count;
+  /** Minimum power */
+  double min;
+  /** Maximum power */
+  double max;
+  /** Mean power, over power values rather than time */
+  double mean;
+  /** Standard deviation of power values */
+  double stddev;
+  /** Median power (estimate) */
+  double p50;
+  /** 95th percentile of power (estimate) */
+  double p95;
+  /** 99th percentile of power (estimate) */
+  double p99;
+} emlDataStats_t;
+
+/** Number of datapoints decoded at a time from compressed data blocks (see
+ * @ref emlDataIterNext) */
+#define EML_DATAITER_SPAN 256
+
+/** Iterator over the datapoints of a data object, in spans of consecutive
+ * datapoints (see @ref emlDataIterNext). Members are private. */
+typedef struct emlDataIter {
+  /** Data being iterated */
+  const emlData_t* data;
+  /** Next data block to be returned */
+  const void* block;
+  /** Index of the next datapoint within the block */
+  size_t next;
+  /** Decoding state for compressed blocks */
+  const unsigned char* packed[3];
+  unsigned long long value[3];
+  unsigned long long delta[3];
+  /** Columns decoded from compressed blocks */
+  unsigned long long buffer[3][EML_DATAITER_SPAN];
+} emlDataIter_t;
+
 /**
  * Dumps the data as JSON to a file.
  *
@@ -42,9 +85,68 @@ typedef struct emlData emlData_t;
  *
  * @retval EML_SUCCESS @a data has been dumped
  * @retval EML_INVALID_PARAMETER @a dumpfile is invalid or @a data is NULL
+ * @retval EML_NO_MEMORY Insufficient memory for the output buffer
+ * @retval EML_UNKNOWN Writing to @a dumpfile failed
  */
 emlError_t emlDataDumpJSON(const emlData_t* data, FILE* dumpfile);
 
+/**
+ * Dumps the data as CSV to a file.
+ *
+ * The first line names the columns: @c timestamp, followed by @c inst_energy
+ * and/or @c inst_power depending on the device. Each following line holds a datapoint, with
+ * raw values as in JSON dumps (see [JSON serialization](doc/json.md)). Datasets
+ * from totals-only runs produce the header line only.
+ *
+ * @param[in] data Data to be dumped
+ * @param[out] dumpfile File to dump the data to
+ *
+ * @retval EML_SUCCESS @a data has been dumped
+ * @retval EML_INVALID_PARAMETER @a dumpfile is invalid or @a data is NULL
+ * @retval EML_NO_MEMORY Insufficient memory for the output buffer
+ * @retval EML_UNKNOWN Writing to @a dumpfile failed
+ */
+emlError_t emlDataDumpCSV(const emlData_t* data, FILE* dumpfile);
+
+/**
+ * Dumps the data in compact binary format to a file.
+ *
+ * Datapoints are written in columns of raw values, as they are kept in
+ * memory. Files can be read back through @ref emlDataFileOpen. The format is
+ * described on [Binary serialization](doc/binary.md).
+ *
+ * @param[in] data Data to be dumped
+ * @param[out] dumpfile File to dump the data to (opened in binary mode)
+ *
+ * @retval EML_SUCCESS @a data has been dumped
+ * @retval EML_INVALID_PARAMETER @a dumpfile is invalid or @a data is NULL
+ * @retval EML_UNKNOWN Writing to @a dumpfile failed
+ */
+emlError_t emlDataDumpBinary(const emlData_t* data, FILE* dumpfile);
+
+/**
+ * Loads data dumped to a file back into a new data object.
+ *
+ * Reads either format written by @ref emlDataDumpJSON or @ref
+ * emlDataDumpBinary (including streams cut short, see the @c stream_dir
+ * option), from the current position of the file. Datapoints are kept in
+ * blocks as for live measurements, so totals and every analysis function
+ * work on the loaded data the same way. Totals are taken from the file when
+ * recorded there. The library does not need to be initialized.
+ *
+ * @param[in] file File to read the data from (opened in binary mode)
+ * @param[out] data Reference in which to return the data, which must be
+ * freed through @ref emlDataFree
+ *
+ * @retval EML_SUCCESS @a data has been set
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ * @retval EML_PARSING_ERROR The file contents are malformed or truncated
+ * @retval EML_UNSUPPORTED The file format version or data fields are not
+ * supported
+ * @retval EML_NO_MEMORY Insufficient memory for the data
+ */
+emlError_t emlDataLoad(FILE* file, emlData_t** data);
+
 /**
  * Frees resources associated with the data object.
  *
@@ -76,6 +178,127 @@ emlError_t emlDataGetConsumed(const emlData_t* data, double* consumed);
  */
 emlError_t emlDataGetElapsed(const emlData_t* data, double* elapsed);
 
+/**
+ * Retrieves the factors converting raw datapoint values to base SI units.
+ *
+ * @param[in] data Data returned for the monitoring section
+ * @param[out] time Reference in which to return the factor for timestamps (s)
+ * @param[out] energy Reference in which to return the factor for energy (J)
+ * @param[out] power Reference in which to return the factor for power (W), or
+ * 0 if the device reports no power
+ *
+ * @retval EML_SUCCESS The factors have been set
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ */
+emlError_t emlDataGetFactors(
+    const emlData_t* data,
+    double* time,
+    double* energy,
+    double* power);
+
+/**
+ * Computes power statistics over the datapoints of a section.
+ *
+ * Power values are the power readings of each datapoint or, for devices with
+ * energy counters, the average power between consecutive datapoints.
+ * Statistics are computed in a single pass with constant memory, so
+ * percentiles are estimates (through the P-square algorithm), which are exact
+ * for up to 5 values.
+ *
+ * @param[in] data Data returned for the monitoring section
+ * @param[out] stats Reference in which to return the statistics (all 0 if
+ * there are no power values)
+ *
+ * @retval EML_SUCCESS @a stats has been set
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ * @retval EML_UNSUPPORTED @a data only holds totals (see the @c data_mode
+ * option)
+ */
+emlError_t emlDataGetStats(const emlData_t* data, emlDataStats_t* stats);
+
+/**
+ * Prepares an iterator over the datapoints of a data object.
+ *
+ * @param[in] data Data returned for the monitoring section
+ * @param[out] iter Iterator to be initialized
+ *
+ * @retval EML_SUCCESS @a iter has been initialized
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ */
+emlError_t emlDataIterInit(const emlData_t* data, emlDataIter_t* iter);
+
+/**
+ * Retrieves the columns of the next span of consecutive datapoints, in raw
+ * device units.
+ *
+ * Columns point directly into the memory holding the datapoints, and stay
+ * valid until the data object is freed. Compressed data blocks (see the @c
+ * compress_blocks option) are decoded into the iterator instead, in spans of
+ * up to @ref EML_DATAITER_SPAN datapoints which stay valid until the next
+ * call. Once every datapoint has been returned, @a npoints is set to 0.
+ * Datasets from totals-only runs hold no datapoints.
+ *
+ * @param[in,out] iter Iterator initialized through @ref emlDataIterInit
+ * @param[out] npoints Reference in which to return the number of datapoints
+ * @param[out] timestamps Reference in which to return the timestamp column
+ * @param[out] energy Reference in which to return the energy column (energy
+ * consumed since the previous datapoint), or NULL if not available
+ * @param[out] power Reference in which to return the power column, or NULL if
+ * not available
+ *
+ * @retval EML_SUCCESS The columns have been set
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ */
+emlError_t emlDataIterNext(
+    emlDataIter_t* iter,
+    size_t* npoints,
+    const unsigned long long** timestamps,
+    const unsigned long long** energy,
+    const unsigned long long** power);
+
+/**
+ * Retrieves the energy consumed by the device between two points in time
+ * within a section, in Joules.
+ *
+ * Times are counted in seconds from the first datapoint of @a data. Energy is
+ * computed from the first datapoint taken at or after @a t0 to the last one
+ * taken at or before @a t1, as for @ref emlDataSlice. Datapoints are found by
+ * binary search, so the cost does not depend on the length of the section.
+ *
+ * @param[in] data Data returned for the monitoring section
+ * @param[in] t0 Start time, in seconds
+ * @param[in] t1 End time, in seconds
+ * @param[out] consumed Reference in which to return consumed energy
+ *
+ * @retval EML_SUCCESS @a consumed has been set
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ * @retval EML_UNSUPPORTED @a data only holds totals (see the @c data_mode
+ * option)
+ */
+emlError_t emlDataEnergyBetween(const emlData_t* data, double t0, double t1, double* consumed);
+
+/**
+ * Cuts the datapoints of a section between two points in time into a new
+ * data object.
+ *
+ * Times are counted in seconds from the first datapoint of @a data. The slice
+ * holds the datapoints taken from @a t0 to @a t1, both included, and shares
+ * them with @a data without copying. It can be used as any other data object,
+ * including further slicing, and must be freed through @ref emlDataFree.
+ *
+ * @param[in] data Data returned for the monitoring section
+ * @param[in] t0 Start time, in seconds
+ * @param[in] t1 End time, in seconds
+ * @param[out] slice Reference in which to return the new data object
+ *
+ * @retval EML_SUCCESS @a slice has been set
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ * @retval EML_NO_MEMORY Insufficient memory for the new data object
+ * @retval EML_UNSUPPORTED @a data only holds totals (see the @c data_mode
+ * option)
+ */
+emlError_t emlDataSlice(const emlData_t* data, double t0, double t1, emlData_t** slice);
+
 /** @} */
 
 #ifdef __cplusplus
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/**
+ * @file
+ * @ingroup externalapi
+ * @copydoc externalapi_datafile
+ */
+
+#ifndef EMLAPI_DATAFILE_H
+#define EMLAPI_DATAFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include <eml/error.h>
+
+/**
+ * @defgroup externalapi_datafile Data files
+ * @ingroup externalapi
+ * Definition of @ref emlDataFile_t and related functions
+ * @{
+ */
+
+/** A binary dataset file written by @ref emlDataDumpBinary, mapped in memory */
+typedef struct emlDataFile emlDataFile_t;
+
+/**
+ * Opens a binary dataset file.
+ *
+ * The file is memory-mapped, and only its header and chunk headers are read,
+ * so opening is fast regardless of file size. Does not require the library
+ * to be initialized.
+ *
+ * @param[in] path Path to the file
+ * @param[out] file Reference in which to return the file handle
+ *
+ * @retval EML_SUCCESS @a file has been set
+ * @retval EML_INVALID_PARAMETER @a path could not be opened
+ * @retval EML_NO_PERMISSION Insufficient permissions to read @a path
+ * @retval EML_PARSING_ERROR The file is malformed
+ * @retval EML_UNSUPPORTED The file format version, or the host byte order, is
+ * not supported
+ * @retval EML_NO_MEMORY Insufficient memory to map the file
+ */
+emlError_t emlDataFileOpen(const char* path, emlDataFile_t** file);
+
+/**
+ * Closes a binary dataset file.
+ *
+ * Column pointers returned for the file become invalid.
+ *
+ * @param[in] file File to be closed
+ *
+ * @retval EML_SUCCESS @a file has been closed
+ * @retval EML_INVALID_PARAMETER @a file is NULL
+ */
+emlError_t emlDataFileClose(emlDataFile_t* file);
+
+/**
+ * Retrieves the internal name of the device the data was measured on.
+ *
+ * @param[in] file Dataset file
+ * @param[out] name Reference in which to return the device name
+ *
+ * @retval EML_SUCCESS @a name has been set
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ */
+emlError_t emlDataFileGetDevice(const emlDataFile_t* file, const char** name);
+
+/**
+ * Retrieves the totals for the dataset, in Joules and seconds.
+ *
+ * @param[in] file Dataset file
+ * @param[out] consumed Reference in which to return consumed energy
+ * @param[out] elapsed Reference in which to return elapsed time
+ *
+ * @retval EML_SUCCESS The totals have been set
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ */
+emlError_t emlDataFileGetTotals(const emlDataFile_t* file, double* consumed, double* elapsed);
+
+/**
+ * Retrieves the factors converting raw column values to base SI units.
+ *
+ * @param[in] file Dataset file
+ * @param[out] time Reference in which to return the factor for timestamps (s)
+ * @param[out] energy Reference in which to return the factor for energy (J)
+ * @param[out] power Reference in which to return the factor for power (W), or
+ * 0 if the device reports no power
+ *
+ * @retval EML_SUCCESS The factors have been set
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ */
+emlError_t emlDataFileGetFactors(
+    const emlDataFile_t* file,
+    double* time,
+    double* energy,
+    double* power);
+
+/**
+ * Retrieves the number of chunks in the file.
+ *
+ * Datapoints are stored in chunks of consecutive datapoints. Datasets from
+ * totals-only runs have no chunks.
+ *
+ * @param[in] file Dataset file
+ * @param[out] count Reference in which to return the chunk count
+ *
+ * @retval EML_SUCCESS @a count has been set
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ */
+emlError_t emlDataFileGetChunkCount(const emlDataFile_t* file, size_t* count);
+
+/**
+ * Retrieves the columns of a chunk, in raw device units.
+ *
+ * Columns point directly into the mapped file, and stay valid until the file
+ * is closed.
+ *
+ * @param[in] file Dataset file
+ * @param[in] chunk Chunk index
+ * @param[out] npoints Reference in which to return the number of datapoints
+ * @param[out] timestamps Reference in which to return the timestamp column
+ * @param[out] energy Reference in which to return the energy column (energy
+ * consumed since the previous datapoint), or NULL if not available
+ * @param[out] power Reference in which to return the power column, or NULL if
+ * not available
+ *
+ * @retval EML_SUCCESS The columns have been set
+ * @retval EML_INVALID_PARAMETER @a chunk or another parameter is invalid
+ */
+emlError_t emlDataFileGetChunk(
+    const emlDataFile_t* file,
+    size_t chunk,
+    size_t* npoints,
+    const unsigned long long** timestamps,
+    const unsigned long long** energy,
+    const unsigned long long** power);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*EMLAPI_DATAFILE_H*/
@@ -55,6 +55,34 @@ typedef enum emlDeviceType {
   EML_DEVICE_TYPE_COUNT
 } emlDeviceType_t;
 
+/** A single sample, as delivered to subscribers (see @ref emlDeviceSubscribe) */
+typedef struct emlSample {
+  /** Index of the sample within the current measurement run */
+  size_t index;
+  /** Timestamp, in seconds */
+  double timestamp;
+  /** Energy consumed since the previous sample delivered, in Joules */
+  double energy;
+  /** Power reading, or average power since the previous sample, in Watts */
+  double power;
+} emlSample_t;
+
+/** Callback receiving samples from a device */
+typedef void (*emlSampleCallback_t)(
+    const emlDevice_t* device,
+    const emlSample_t* sample,
+    void* ctx);
+
+/** Sample delivery modes for subscribers */
+typedef enum emlDelivery {
+  /** Callbacks run on the thread taking each sample, right after it is taken
+   * (see @ref emlDeviceSubscribe) */
+  EML_DELIVERY_INLINE = 0,
+  /** Samples go through a bounded queue, and callbacks run on a separate
+   * delivery thread. Samples are dropped if the queue is full. */
+  EML_DELIVERY_QUEUED = 1,
+} emlDelivery_t;
+
 /** Device type support status */
 typedef enum emlDeviceTypeStatus {
   /** This type is available for measurements */
@@ -169,6 +197,161 @@ emlError_t emlDeviceStart(const emlDevice_t* device);
  */
 emlError_t emlDeviceStop(const emlDevice_t* device, emlData_t** result);
 
+/**
+ * Retrieves consumption data for the innermost monitoring section on a device,
+ * without ending it.
+ *
+ * Only reads totals kept up to date by the data collection thread, without
+ * taking any locks, so it can be called often. Totals run from the last sample
+ * taken before the section was started to the latest sample, so they may
+ * differ from those returned by @ref emlDeviceStop by up to one sampling
+ * interval (or one counter snapshot period, for devices read through counter
+ * snapshots).
+ *
+ * @param[in] device Target device
+ * @param[out] consumed Reference in which to return consumed energy, in Joules
+ * @param[out] elapsed Reference in which to return elapsed time, in seconds
+ * @param[out] power Reference in which to return the latest power reading (or
+ * the average power over the last sampling interval), in Watts
+ *
+ * @retval EML_SUCCESS Consumption data has been returned
+ * @retval EML_INVALID_PARAMETER @a device or an output reference is invalid
+ * @retval EML_NOT_INITIALIZED The library had not been initialized
+ * @retval EML_NOT_STARTED No monitoring section is open on the device
+ */
+emlError_t emlDeviceGetLiveTotals(
+    const emlDevice_t* device,
+    double* consumed,
+    double* elapsed,
+    double* power);
+
+/**
+ * Retrieves the number of sampling deadlines missed by a device.
+ *
+ * Only the @c skip and @c catchup sampling policies keep track of missed
+ * deadlines (see [Configuration](doc/configuration.md)). A growing count means
+ * that the device cannot sustain the configured sampling interval.
+ *
+ * @param[in] device Target device
+ * @param[out] overruns Reference in which to return the number of missed
+ * deadlines since the library was initialized
+ *
+ * @retval EML_SUCCESS @a overruns has been set
+ * @retval EML_INVALID_PARAMETER @a device is invalid
+ * @retval EML_NOT_INITIALIZED The library had not been initialized
+ */
+emlError_t emlDeviceGetOverruns(const emlDevice_t* device, unsigned long long* overruns);
+
+/**
+ * Retrieves the number of samples dropped by a device.
+ *
+ * Samples are only dropped if memory for new data blocks could not be
+ * allocated. Measurements go on, but with missing datapoints.
+ *
+ * @param[in] device Target device
+ * @param[out] dropped Reference in which to return the number of dropped
+ * samples since the library was initialized
+ *
+ * @retval EML_SUCCESS @a dropped has been set
+ * @retval EML_INVALID_PARAMETER @a device is invalid
+ * @retval EML_NOT_INITIALIZED The library had not been initialized
+ */
+emlError_t emlDeviceGetDropped(const emlDevice_t* device, unsigned long long* dropped);
+
+/**
+ * Registers a callback to receive samples from a device as they are taken.
+ *
+ * Replaces any previous subscriber for the device. Only one sample out of
+ * every @a decimation is delivered, with the energy consumed by the skipped
+ * samples added to the next delivered one.
+ *
+ * With @ref EML_DELIVERY_INLINE, callbacks run on the thread taking each
+ * sample and delay further samples, so they must return quickly. That is
+ * usually the sampling thread, but samples taken when measurements start or
+ * stop (section_samples, and counter snapshots in the totals data mode) are
+ * delivered on the thread calling @ref emlDeviceStart or @ref emlDeviceStop,
+ * and periodic counter snapshots on the watchdog thread. With @ref
+ * EML_DELIVERY_QUEUED, a slow callback causes samples to be dropped instead
+ * (see @ref emlDeviceGetSubscriberDrops).
+ *
+ * @param[in] device Target device
+ * @param[in] callback Function to be called for each delivered sample
+ * @param[in] ctx Pointer passed back to @a callback
+ * @param[in] decimation Deliver one sample out of this many (at least 1)
+ * @param[in] delivery Delivery mode
+ *
+ * @retval EML_SUCCESS The subscriber was registered
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ * @retval EML_NOT_INITIALIZED The library had not been initialized
+ * @retval EML_ALREADY_STARTED The device is being monitored
+ * @retval EML_NO_MEMORY Insufficient memory for the subscriber
+ * @retval EML_UNKNOWN The delivery thread could not be created
+ */
+emlError_t emlDeviceSubscribe(
+    const emlDevice_t* device,
+    emlSampleCallback_t callback,
+    void* ctx,
+    size_t decimation,
+    emlDelivery_t delivery);
+
+/**
+ * Unregisters the subscriber for a device.
+ *
+ * Samples still queued are delivered before returning.
+ *
+ * @param[in] device Target device
+ *
+ * @retval EML_SUCCESS The subscriber was unregistered
+ * @retval EML_INVALID_PARAMETER @a device is invalid
+ * @retval EML_NOT_INITIALIZED The library had not been initialized
+ * @retval EML_ALREADY_STARTED The device is being monitored
+ * @retval EML_NOT_STARTED The device had no subscriber
+ */
+emlError_t emlDeviceUnsubscribe(const emlDevice_t* device);
+
+/**
+ * Retrieves the number of samples dropped because the subscriber queue for
+ * a device was full.
+ *
+ * @param[in] device Target device
+ * @param[out] drops Reference in which to return the number of dropped
+ * samples since the subscriber was registered
+ *
+ * @retval EML_SUCCESS @a drops has been set
+ * @retval EML_INVALID_PARAMETER @a device is invalid
+ * @retval EML_NOT_INITIALIZED The library had not been initialized
+ * @retval EML_NOT_STARTED The device has no subscriber
+ */
+emlError_t emlDeviceGetSubscriberDrops(const emlDevice_t* device, unsigned long long* drops);
+
+/**
+ * Streams the datapoints of subsequent measurement runs on a device to a file
+ * descriptor, as they are taken.
+ *
+ * Full data blocks are appended to @a fd by a separate thread in the binary
+ * format (see [Binary serialization](doc/binary.md)), so that datapoints are
+ * on file even if the application never stops measuring. Blocks are then
+ * released, so long runs need little memory unless retention options are set
+ * (see [Configuration](doc/configuration.md)). Datasets for a streamed run
+ * only hold the datapoints still in memory, but their totals are complete.
+ *
+ * If @a fd is seekable, the header is completed with final counts and totals
+ * when the run ends. Every run starts a new file at the current offset of @a
+ * fd, so a new descriptor should be set between runs. @a fd is not closed by
+ * EML.
+ *
+ * @param[in] device Target device
+ * @param[in] fd File descriptor open for writing, or -1 to stop streaming
+ *
+ * @retval EML_SUCCESS Subsequent runs will be streamed to @a fd
+ * @retval EML_INVALID_PARAMETER @a device or @a fd is invalid
+ * @retval EML_NOT_INITIALIZED The library had not been initialized
+ * @retval EML_ALREADY_STARTED The device is being monitored
+ * @retval EML_UNSUPPORTED The device only keeps totals (see the @c data_mode
+ * option)
+ */
+emlError_t emlDeviceSetStream(const emlDevice_t* device, int fd);
+
 /** @} */
 
 #ifdef __cplusplus
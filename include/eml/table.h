@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/**
+ * @file
+ * @ingroup externalapi
+ * @copydoc externalapi_table
+ */
+
+#ifndef EMLAPI_TABLE_H
+#define EMLAPI_TABLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include <eml/data.h>
+#include <eml/error.h>
+
+/**
+ * @defgroup externalapi_table Tables
+ * @ingroup externalapi
+ * Definition of @ref emlTable_t and related functions
+ * @{
+ */
+
+/** Power values of one or more datasets on a regular time grid, in columns */
+typedef struct emlTable emlTable_t;
+
+/** Interpolation methods between datapoints */
+typedef enum emlResampleMethod {
+  /** Zero-order hold: the last value at or before each grid point */
+  EML_RESAMPLE_HOLD = 0,
+  /** Linear interpolation between the values around each grid point */
+  EML_RESAMPLE_LINEAR = 1,
+} emlResampleMethod_t;
+
+/**
+ * Resamples the power values of a section onto a regular time grid.
+ *
+ * Power values are the power readings of each datapoint or, for devices with
+ * energy counters, the average power since the previous datapoint (as for
+ * @ref emlDataGetStats). The grid starts at the first power value and ends at
+ * or before the last one. Datapoints are read block by block, without
+ * intermediate copies.
+ *
+ * @param[in] data Data returned for the monitoring section
+ * @param[in] period Grid period, in seconds
+ * @param[in] method Interpolation method
+ * @param[out] table Reference in which to return a table with a single column
+ *
+ * @retval EML_SUCCESS @a table has been set
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ * @retval EML_NO_MEMORY Insufficient memory for the table
+ * @retval EML_UNSUPPORTED @a data only holds totals (see the @c data_mode
+ * option)
+ */
+emlError_t emlDataResample(
+    const emlData_t* data,
+    double period,
+    emlResampleMethod_t method,
+    emlTable_t** table);
+
+/**
+ * Resamples the power values of several sections onto a shared time grid.
+ *
+ * Timestamps from every device are taken from the same clock, so datasets
+ * from different devices can be correlated once converted to seconds. The
+ * grid spans the time covered by all of them, and has a column for each
+ * dataset, in order. See @ref emlDataResample.
+ *
+ * @param[in] datas Data returned for the monitoring sections
+ * @param[in] ndatas Number of datasets
+ * @param[in] period Grid period, in seconds
+ * @param[in] method Interpolation method
+ * @param[out] table Reference in which to return the table
+ *
+ * @retval EML_SUCCESS @a table has been set
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ * @retval EML_NO_MEMORY Insufficient memory for the table
+ * @retval EML_UNSUPPORTED A dataset only holds totals
+ */
+emlError_t emlDataAlign(
+    const emlData_t* const* datas,
+    size_t ndatas,
+    double period,
+    emlResampleMethod_t method,
+    emlTable_t** table);
+
+/**
+ * Frees a table.
+ *
+ * Column pointers returned for the table become invalid.
+ *
+ * @param[in] table Table to be freed
+ *
+ * @retval EML_SUCCESS @a table has been freed
+ */
+emlError_t emlTableFree(emlTable_t* table);
+
+/**
+ * Retrieves the dimensions of a table.
+ *
+ * @param[in] table Table
+ * @param[out] nrows Reference in which to return the number of grid points
+ * @param[out] ncolumns Reference in which to return the number of columns
+ *
+ * @retval EML_SUCCESS The dimensions have been set
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ */
+emlError_t emlTableGetSize(const emlTable_t* table, size_t* nrows, size_t* ncolumns);
+
+/**
+ * Retrieves the time grid of a table.
+ *
+ * Grid point @e i is at @a start + @e i * @a period.
+ *
+ * @param[in] table Table
+ * @param[out] start Reference in which to return the time of the first grid
+ * point, in seconds on the clock used for timestamps
+ * @param[out] period Reference in which to return the grid period, in seconds
+ *
+ * @retval EML_SUCCESS The grid has been set
+ * @retval EML_INVALID_PARAMETER A parameter is invalid
+ */
+emlError_t emlTableGetGrid(const emlTable_t* table, double* start, double* period);
+
+/**
+ * Retrieves a column of a table.
+ *
+ * @param[in] table Table
+ * @param[in] column Column index
+ * @param[out] values Reference in which to return the power values for each
+ * grid point, in Watts
+ *
+ * @retval EML_SUCCESS @a values has been set
+ * @retval EML_INVALID_PARAMETER @a column or another parameter is invalid
+ */
+emlError_t emlTableGetColumn(const emlTable_t* table, size_t column, const double** values);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*EMLAPI_TABLE_H*/
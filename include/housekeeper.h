@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/**
+ * @file
+ * Internal functions for the housekeeping thread
+ * @ingroup internalapi
+ *
+ * Samplers must never wait for memory allocation or block compression. A
+ * single housekeeping thread, started on first use, does that work for them:
+ * samplers flag their monitor and wake the thread up through @ref
+ * emlHousekeeperWake, which never blocks, and the thread calls @ref
+ * emlDeviceMonitorHousekeep for every device added to it.
+ */
+
+#ifndef EML_HOUSEKEEPER_H
+#define EML_HOUSEKEEPER_H
+
+#include "error.h"
+
+struct emlDevice;
+
+/**
+ * Adds a device to the housekeeper.
+ *
+ * @param[in] device Device to be looked after while measuring
+ *
+ * @retval EML_SUCCESS The device was added
+ * @retval EML_NO_MEMORY Insufficient memory for the device
+ * @retval EML_UNKNOWN The housekeeping thread could not be created
+ */
+enum emlError emlHousekeeperAdd(const struct emlDevice* device);
+
+/**
+ * Wakes the housekeeping thread up. Never blocks, so it can be called from
+ * samplers.
+ */
+void emlHousekeeperWake();
+
+/**
+ * Removes a device from the housekeeper.
+ *
+ * If the device is being looked after at the time of the call, waits until
+ * the work is complete.
+ *
+ * @param[in] device Device to be removed
+ *
+ * @retval EML_SUCCESS The device was removed
+ * @retval EML_NOT_STARTED The device was not added
+ */
+enum emlError emlHousekeeperRemove(const struct emlDevice* device);
+
+/**
+ * Stops the housekeeping thread, if started.
+ *
+ * No devices should be added when this is called.
+ *
+ * @retval EML_SUCCESS The housekeeper was stopped
+ */
+enum emlError emlHousekeeperShutdown();
+
+#endif /*EML_HOUSEKEEPER_H*/
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/**
+ * @file
+ * Internal functions for loading datasets from files
+ * @ingroup internalapi
+ *
+ * Loaded datapoints are kept in data blocks, as for live measurement runs, so
+ * that datasets loaded from files can be processed the same way.
+ */
+
+#ifndef EML_LOAD_H
+#define EML_LOAD_H
+
+#include <stddef.h>
+
+#include "data.h"
+#include "error.h"
+
+/** Builds a dataset out of datapoints read in order */
+struct emlDataLoader {
+  /** Dataset being built (NULL once finished) */
+  struct emlData* data;
+  /** Block holding the next datapoint (NULL if none was reserved yet) */
+  struct emlDataBlock* curblk;
+  /** Last block in the run */
+  struct emlDataBlock* lastblock;
+  /** Field values for the last datapoint committed */
+  unsigned long long lastpoint[EML_DATAPOINT_MAX_FIELDS];
+  /** Energy consumed from the first datapoint committed */
+  unsigned long long energy;
+};
+
+/**
+ * Creates an empty dataset, along with its own measurement run.
+ *
+ * @param[out] loader Loader to be initialized
+ * @param[in] props Measurement properties (copied)
+ * @param[in] devname Device name (copied)
+ *
+ * @retval EML_SUCCESS The loader was initialized
+ * @retval EML_NO_MEMORY Insufficient memory for the dataset
+ */
+enum emlError emlDataLoaderInit(
+    struct emlDataLoader* loader,
+    const struct emlDataProperties* props,
+    const char* devname);
+
+/**
+ * Makes room for more datapoints.
+ *
+ * Datapoint @e i of the dataset is to be written at index @e i minus the
+ * @a first index of its block, where blocks follow one another from the
+ * returned one.
+ *
+ * @param[in] loader Loader
+ * @param[in] npoints Number of datapoints to be added
+ *
+ * @return Block for the next datapoint, or NULL if out of memory
+ */
+struct emlDataBlock* emlDataLoaderReserve(struct emlDataLoader* loader, size_t npoints);
+
+/**
+ * Adds datapoints written to the reserved blocks to the dataset, computing
+ * energy prefix sums.
+ *
+ * @param[in] loader Loader
+ * @param[in] npoints Number of datapoints written
+ */
+void emlDataLoaderCommit(struct emlDataLoader* loader, size_t npoints);
+
+/**
+ * Completes the dataset.
+ *
+ * @param[in] loader Loader
+ * @param[in] samples Whether datapoints were kept (unset for datasets from
+ * totals-only runs)
+ * @param[in] totals Whether @a elapsed and @a consumed are known (otherwise,
+ * totals are computed from the datapoints)
+ * @param[in] elapsed Total elapsed time, in device units
+ * @param[in] consumed Total consumed energy, in device units
+ *
+ * @return The new dataset
+ */
+struct emlData* emlDataLoaderFinish(
+    struct emlDataLoader* loader,
+    int samples,
+    int totals,
+    unsigned long long elapsed,
+    unsigned long long consumed);
+
+/**
+ * Frees an unfinished dataset.
+ *
+ * @param[in] loader Loader
+ */
+void emlDataLoaderAbort(struct emlDataLoader* loader);
+
+#endif /*EML_LOAD_H*/
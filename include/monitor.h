@@ -16,6 +16,8 @@
 #ifndef EML_MONITOR_H
 #define EML_MONITOR_H
 
+#include <eml/device.h>
+
 #include "error.h"
 
 struct emlData;
@@ -49,7 +51,7 @@ enum emlError emlDeviceMonitorShutdown(struct emlDevice* device);
 enum emlError emlDeviceMonitorStart(const struct emlDevice* device);
 
 /**
- * Stop a monitored section on a device monitor and return results
+ * Stop a monitored section on a device monitor and return results (with totals)
  *
  * @param[in] device Device whose monitor is to be started
  * @param[out] result Address where a handle to the data will be copied
@@ -58,4 +60,161 @@ enum emlError emlDeviceMonitorStart(const struct emlDevice* device);
  */
 enum emlError emlDeviceMonitorStop(const struct emlDevice* device, struct emlData** result);
 
+/**
+ * Take a single sample from a monitored device
+ *
+ * Called periodically by the device sampling thread, or by the shared
+ * scheduler if enabled. Also called when measurements are started or stopped
+ * if the @c section_samples option is set, in which case samples are
+ * serialized through a lock. Devices sampled through a batch are not sampled
+ * with this function (see @ref emlBatchSample).
+ *
+ * @param[in] device Device to be sampled
+ *
+ * @retval EML_SUCCESS The sample was recorded
+ * @retval EML_NO_MEMORY Insufficient memory for a new data block
+ */
+enum emlError emlDeviceMonitorSample(const struct emlDevice* device);
+
+/**
+ * Store a data point measured for a monitored device
+ *
+ * Called by the sampler of the device (or its batch), which must serialize
+ * calls for the same device. If no free block is available, the data point is
+ * dropped and any energy it reports is added to the next one.
+ *
+ * @param[in] device Device that was measured
+ * @param[in,out] point Field values for the data point, indexed by field
+ * number (energy from dropped data points may be added)
+ * @param[out] stored Whether the data point was stored
+ *
+ * @retval EML_SUCCESS The data point was stored or dropped
+ */
+enum emlError emlDeviceMonitorStore(
+    const struct emlDevice* device,
+    unsigned long long* point,
+    int* stored);
+
+/**
+ * Do the work requested by the sampler of a monitored device, if any
+ *
+ * Called by the housekeeping thread, so that samplers never wait for memory
+ * allocation or compression: refills the block pool with blocks of the size
+ * the sampler takes next, and compresses full blocks if enabled.
+ *
+ * @param[in] device Device looked after
+ */
+void emlDeviceMonitorHousekeep(const struct emlDevice* device);
+
+/**
+ * Compute the deadline for the next sample of a device
+ *
+ * Follows the sampling policy configured for the device, and counts any
+ * missed deadlines as overruns.
+ *
+ * @param[in] device Device that was just sampled
+ * @param[in] deadline Deadline of the sample that was just taken
+ *
+ * @return Deadline for the next sample, in @ref monotonictimestamp units
+ */
+unsigned long long emlDeviceMonitorNextDeadline(
+    const struct emlDevice* device,
+    unsigned long long deadline);
+
+/**
+ * Retrieve the number of sampling deadlines missed by a device monitor
+ *
+ * @param[in] device Target device
+ * @param[out] overruns Address where the count will be copied
+ *
+ * @retval EML_SUCCESS The overrun count was returned
+ */
+enum emlError emlDeviceMonitorGetOverruns(
+    const struct emlDevice* device,
+    unsigned long long* overruns);
+
+/**
+ * Retrieve running totals for the innermost monitored section, without
+ * stopping it
+ *
+ * Lock-free: only reads progress published by the sampler, and the start of
+ * the section published by @ref emlDeviceMonitorStart and @ref
+ * emlDeviceMonitorStop.
+ *
+ * @param[in] device Target device
+ * @param[out] consumed Address where the energy consumed (J) will be copied
+ * @param[out] elapsed Address where the time elapsed (s) will be copied
+ * @param[out] power Address where the current power (W) will be copied
+ *
+ * @retval EML_SUCCESS The totals were returned
+ * @retval EML_NOT_STARTED No section is being monitored on the device
+ */
+enum emlError emlDeviceMonitorGetLiveTotals(
+    const struct emlDevice* device,
+    double* consumed,
+    double* elapsed,
+    double* power);
+
+/**
+ * Set or remove the sample subscriber for a device monitor
+ *
+ * @param[in] device Target device
+ * @param[in] callback Function to be called for each sample (NULL to remove
+ * the current subscriber)
+ * @param[in] ctx Pointer passed back to @a callback
+ * @param[in] decimation Deliver one sample out of this many
+ * @param[in] delivery Delivery mode
+ *
+ * @retval EML_SUCCESS The subscriber was set or removed
+ * @retval EML_ALREADY_STARTED The device is being monitored
+ * @retval EML_NOT_STARTED There was no subscriber to be removed
+ * @retval EML_NO_MEMORY Insufficient memory for the subscriber
+ * @retval EML_UNKNOWN The delivery thread could not be created
+ */
+enum emlError emlDeviceMonitorSubscribe(
+    const struct emlDevice* device,
+    emlSampleCallback_t callback,
+    void* ctx,
+    size_t decimation,
+    enum emlDelivery delivery);
+
+/**
+ * Set the file descriptor that measurement runs on a device are streamed to
+ *
+ * @param[in] device Target device
+ * @param[in] fd File descriptor (-1 to stop streaming)
+ *
+ * @retval EML_SUCCESS The file descriptor was set
+ * @retval EML_ALREADY_STARTED The device is being monitored
+ * @retval EML_UNSUPPORTED The device monitor only keeps totals
+ */
+enum emlError emlDeviceMonitorSetStream(const struct emlDevice* device, int fd);
+
+/**
+ * Retrieve the number of samples dropped from the subscriber queue of a
+ * device monitor
+ *
+ * @param[in] device Target device
+ * @param[out] drops Address where the count will be copied
+ *
+ * @retval EML_SUCCESS The dropped sample count was returned
+ * @retval EML_NOT_STARTED The device monitor has no subscriber
+ */
+enum emlError emlDeviceMonitorGetSubscriberDrops(
+    const struct emlDevice* device,
+    unsigned long long* drops);
+
+/**
+ * Retrieve the number of samples dropped by a device monitor for lack of
+ * free data blocks
+ *
+ * @param[in] device Target device
+ * @param[out] dropped Address where the count will be copied
+ *
+ * @retval EML_SUCCESS The dropped sample count was returned
+ */
+enum emlError emlDeviceMonitorGetDropped(
+    const struct emlDevice* device,
+    unsigned long long* dropped);
+
 #endif /*EML_MONITOR_H*/
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/**
+ * @file
+ * Internal functions for compressed data blocks
+ * @ingroup internalapi
+ *
+ * Full blocks may be compressed to save memory (see the @c compress_blocks
+ * option). Each column is encoded on its own as a sequence of variable-length
+ * integers (7 bits per byte, least significant first): the first value as it
+ * is, followed by the zig-zag encoded difference to the previous value.
+ * Timestamps are taken at a regular interval, so their differences are
+ * encoded as well (delta-of-delta), which takes a single byte for most
+ * datapoints.
+ *
+ * Compressed blocks can only be read in order, through a @ref
+ * emlDataBlockReader or @ref emlDataBlockValue. Blocks covered by a live
+ * dataset are never compressed (see @ref emlDataRunPack), so a dataset never
+ * sees its blocks change.
+ */
+
+#ifndef EML_PACK_H
+#define EML_PACK_H
+
+#include <stddef.h>
+
+#include "data.h"
+#include "error.h"
+
+/**
+ * Compresses the field values of a full block, leaving the block unchanged.
+ *
+ * Only reads the raw values, so it can run without the run lock as long as
+ * the block is not evicted meanwhile. The compressed values are installed
+ * with @ref emlDataBlockSetPacked.
+ *
+ * @param[in] block Full block
+ * @param[in] nfields Number of fields in each datapoint
+ * @param[out] packed Address where the compressed values will be copied
+ * @param[out] packedoff Byte offset of each column within the compressed
+ * values (@a nfields entries)
+ *
+ * @retval EML_SUCCESS The block was compressed
+ * @retval EML_NO_MEMORY Insufficient memory for the compressed values
+ * @retval EML_UNSUPPORTED Compressed values would not be smaller
+ */
+enum emlError emlDataBlockPack(
+    const struct emlDataBlock* block,
+    size_t nfields,
+    unsigned char** packed,
+    size_t* packedoff);
+
+/**
+ * Replaces the raw field values of a block with compressed ones, freeing the
+ * raw values.
+ *
+ * @param[in,out] block Full block, not referenced by any dataset
+ * @param[in] nfields Number of fields in each datapoint
+ * @param[in] packed Compressed values from @ref emlDataBlockPack
+ * @param[in] packedoff Column offsets from @ref emlDataBlockPack
+ */
+void emlDataBlockSetPacked(
+    struct emlDataBlock* block,
+    size_t nfields,
+    unsigned char* packed,
+    const size_t* packedoff);
+
+/**
+ * Prepares to decode a column of a compressed block from its start.
+ *
+ * @param[out] column Decoding state
+ * @param[in] block Compressed block
+ * @param[in] field Field number
+ */
+void emlPackedColumnInit(
+    struct emlPackedColumn* column,
+    const struct emlDataBlock* block,
+    size_t field);
+
+/**
+ * Decodes the next value of a compressed column.
+ *
+ * @param[in,out] column Decoding state
+ * @param[in] field Field number
+ * @param[in] first Whether this is the first value of the column
+ *
+ * @return Decoded value
+ */
+unsigned long long emlPackedColumnNext(
+    struct emlPackedColumn* column,
+    size_t field,
+    int first);
+
+/**
+ * Prepares to read the datapoints of a block.
+ *
+ * For compressed blocks, the datapoints before @a i are decoded and skipped.
+ *
+ * @param[out] reader Reader
+ * @param[in] block Block to be read
+ * @param[in] nfields Number of fields in each datapoint
+ * @param[in] i Index of the first datapoint to be read
+ */
+void emlDataBlockReaderInit(
+    struct emlDataBlockReader* reader,
+    const struct emlDataBlock* block,
+    size_t nfields,
+    size_t i);
+
+/**
+ * Reads the next datapoint of a block.
+ *
+ * @param[in,out] reader Reader
+ * @param[out] point Field values for the datapoint
+ */
+void emlDataBlockReaderNext(struct emlDataBlockReader* reader, unsigned long long* point);
+
+/**
+ * Returns a single field value from a block.
+ *
+ * Constant time for raw blocks. For compressed blocks, the column is decoded
+ * up to @a i, except for the first value, which is stored as it is.
+ *
+ * @param[in] block Block
+ * @param[in] field Field number
+ * @param[in] i Index of the datapoint within the block
+ *
+ * @return Field value
+ */
+unsigned long long emlDataBlockValue(
+    const struct emlDataBlock* block,
+    size_t field,
+    size_t i);
+
+#endif /*EML_PACK_H*/
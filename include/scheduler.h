@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/**
+ * @file
+ * Internal functions for the shared sampling scheduler
+ * @ingroup internalapi
+ *
+ * When enabled, a fixed pool of threads takes samples for every monitored
+ * device, instead of running a dedicated thread per device. Devices (and
+ * batches of devices sampled together) are kept in a queue ordered by the
+ * deadline of their next sample.
+ */
+
+#ifndef EML_SCHEDULER_H
+#define EML_SCHEDULER_H
+
+#include <stddef.h>
+
+#include "error.h"
+
+struct emlBatch;
+struct emlDevice;
+
+/**
+ * Starts the shared scheduler.
+ *
+ * @param[in] nthreads Number of sampling threads in the pool (0 to disable)
+ *
+ * @retval EML_SUCCESS The scheduler was started (or left disabled)
+ * @retval EML_NO_MEMORY Insufficient memory for the scheduler
+ * @retval EML_UNKNOWN Sampling threads could not be created
+ */
+enum emlError emlSchedulerInit(size_t nthreads);
+
+/**
+ * Stops the shared scheduler and joins its sampling threads.
+ *
+ * No devices or batches should be scheduled when this is called.
+ *
+ * @retval EML_SUCCESS The scheduler was stopped
+ */
+enum emlError emlSchedulerShutdown();
+
+/**
+ * Returns whether the shared scheduler is running.
+ *
+ * @return 1 if devices should be sampled by the scheduler, 0 otherwise
+ */
+int emlSchedulerEnabled();
+
+/**
+ * Adds a device to the sampling queue. Its first sample is due immediately.
+ *
+ * @param[in] device Device to be sampled
+ *
+ * @retval EML_SUCCESS The device was scheduled
+ * @retval EML_NO_MEMORY Insufficient memory to grow the queue
+ */
+enum emlError emlSchedulerAdd(const struct emlDevice* device);
+
+/**
+ * Adds a batch to the sampling queue. Its first sample is due immediately.
+ *
+ * @param[in] batch Batch to be sampled (see @ref emlBatchSample)
+ *
+ * @retval EML_SUCCESS The batch was scheduled
+ * @retval EML_NO_MEMORY Insufficient memory to grow the queue
+ */
+enum emlError emlSchedulerAddBatch(struct emlBatch* batch);
+
+/**
+ * Removes a device from the sampling queue.
+ *
+ * If the device is being sampled at the time of the call, waits until the
+ * sample is complete.
+ *
+ * @param[in] device Device to be removed
+ *
+ * @retval EML_SUCCESS The device is no longer scheduled
+ * @retval EML_NOT_STARTED The device was not scheduled
+ */
+enum emlError emlSchedulerRemove(const struct emlDevice* device);
+
+/**
+ * Removes a batch from the sampling queue.
+ *
+ * If the batch is being sampled at the time of the call, waits until the
+ * sample is complete.
+ *
+ * @param[in] batch Batch to be removed
+ *
+ * @retval EML_SUCCESS The batch is no longer scheduled
+ * @retval EML_NOT_STARTED The batch was not scheduled
+ */
+enum emlError emlSchedulerRemoveBatch(struct emlBatch* batch);
+
+#endif /*EML_SCHEDULER_H*/
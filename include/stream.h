@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/**
+ * @file
+ * Internal functions for streaming measurement runs to a file
+ * @ingroup internalapi
+ *
+ * A stream writes the datapoints of a measurement run in the binary format
+ * (see [Binary serialization](doc/binary.md)) while it is still running. Full
+ * blocks are handed to a writer thread, which appends their columns to the
+ * file as they are kept in memory. Blocks are only evicted after they have
+ * been written (see @ref emlDataRun::streamed).
+ */
+
+#ifndef EML_STREAM_H
+#define EML_STREAM_H
+
+#include <stddef.h>
+
+#include "error.h"
+
+struct emlDataRun;
+struct emlStream;
+
+/**
+ * Writes the stream header and starts the writer thread.
+ *
+ * @param[out] stream Address where the new stream will be copied
+ * @param[in] fd File descriptor to write to
+ * @param[in] closefd Whether @a fd should be closed along with the stream
+ * @param[in] run Measurement run, which must outlive the stream
+ * @param[in] devname Device name
+ *
+ * @retval EML_SUCCESS The stream was started
+ * @retval EML_NO_MEMORY Insufficient memory for the stream
+ * @retval EML_UNSUPPORTED Streams are not supported on big-endian hosts
+ * @retval EML_UNKNOWN The header could not be written, or the writer thread
+ * could not be created
+ */
+enum emlError emlStreamOpen(
+    struct emlStream** stream,
+    int fd,
+    int closefd,
+    struct emlDataRun* run,
+    const char* devname);
+
+/**
+ * Hands full blocks to the writer thread.
+ *
+ * Called from the sampling thread, never blocks for long.
+ *
+ * @param[in] stream Stream
+ * @param[in] npoints Number of datapoints in full blocks
+ */
+void emlStreamNotify(struct emlStream* stream, size_t npoints);
+
+/**
+ * Writes the remaining datapoints, stops the writer thread and frees a
+ * stream.
+ *
+ * Must be called once the run is no longer being sampled. If the file is
+ * seekable, the header is rewritten with final counts and totals.
+ *
+ * @param[in] stream Stream
+ * @param[in] npoints Total number of datapoints in the run
+ * @param[in] elapsed Total elapsed time, in device units
+ * @param[in] consumed Total consumed energy, in device units
+ *
+ * @retval EML_SUCCESS All datapoints were written
+ * @retval EML_UNKNOWN Writing to the file failed
+ */
+enum emlError emlStreamClose(
+    struct emlStream* stream,
+    size_t npoints,
+    unsigned long long elapsed,
+    unsigned long long consumed);
+
+#endif /*EML_STREAM_H*/
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/**
+ * @file
+ * Internal functions for sample subscribers
+ * @ingroup internalapi
+ *
+ * A subscriber receives samples from a single device, either directly on the
+ * thread taking each sample or through a bounded single-producer/single-consumer queue
+ * drained by a delivery thread.
+ */
+
+#ifndef EML_SUBSCRIBER_H
+#define EML_SUBSCRIBER_H
+
+#include <eml/device.h>
+
+#include "error.h"
+
+#ifndef EML_SUBSCRIBER_QUEUE_SIZE
+/** Number of samples the delivery queue can hold (compile-time option) */
+#define EML_SUBSCRIBER_QUEUE_SIZE 1024
+#endif
+
+struct emlDevice;
+struct emlSubscriber;
+
+/**
+ * Creates a subscriber, starting its delivery thread if needed.
+ *
+ * @param[out] sub Address where the new subscriber will be copied
+ * @param[in] device Device the samples come from
+ * @param[in] callback Function to be called for each delivered sample
+ * @param[in] ctx Pointer passed back to @a callback
+ * @param[in] decimation Deliver one sample out of this many
+ * @param[in] delivery Delivery mode
+ *
+ * @retval EML_SUCCESS The subscriber was created
+ * @retval EML_NO_MEMORY Insufficient memory for the subscriber
+ * @retval EML_UNKNOWN The delivery queue or thread could not be created
+ */
+enum emlError emlSubscriberCreate(
+    struct emlSubscriber** sub,
+    const struct emlDevice* device,
+    emlSampleCallback_t callback,
+    void* ctx,
+    size_t decimation,
+    enum emlDelivery delivery);
+
+/**
+ * Delivers any queued samples, stops the delivery thread and frees a
+ * subscriber.
+ *
+ * @param[in] sub Subscriber
+ *
+ * @retval EML_SUCCESS The subscriber was freed
+ */
+enum emlError emlSubscriberDestroy(struct emlSubscriber* sub);
+
+/**
+ * Hands a new sample to a subscriber. Never blocks on queued delivery.
+ *
+ * Called by the thread taking each sample. Calls never overlap, as samples
+ * for a device are serialized when more than one thread takes them.
+ *
+ * @param[in] sub Subscriber
+ * @param[in] sample New sample, with the energy consumed since the previous one
+ */
+void emlSubscriberPush(struct emlSubscriber* sub, const struct emlSample* sample);
+
+/**
+ * Returns the number of samples dropped because the queue was full.
+ *
+ * @param[in] sub Subscriber
+ *
+ * @return Number of dropped samples
+ */
+unsigned long long emlSubscriberDrops(const struct emlSubscriber* sub);
+
+#endif /*EML_SUBSCRIBER_H*/
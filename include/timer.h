@@ -36,5 +36,15 @@ unsigned long long nanotimestamp();
  */
 unsigned long long millitimestamp();
 
+/**
+ * Returns nanoseconds on @c CLOCK_MONOTONIC.
+ *
+ * Unlike @ref nanotimestamp, this is guaranteed to be the clock used for
+ * sampling deadlines (@c clock_nanosleep and condition variable timeouts).
+ *
+ * @return Timestamp in nanoseconds.
+ */
+unsigned long long monotonictimestamp();
+
 
 #endif /*EML_TIMER_H*/
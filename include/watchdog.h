@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/**
+ * @file
+ * Internal functions for the counter watchdog
+ * @ingroup internalapi
+ *
+ * Devices measured through counter snapshots (see @ref
+ * emlDriver::counter_snapshots) have no sampling thread of their own. A
+ * single watchdog thread, started on first use, samples each of them once per
+ * counter period, so that no counter wraps around more than once between
+ * samples however long measurements last.
+ */
+
+#ifndef EML_WATCHDOG_H
+#define EML_WATCHDOG_H
+
+#include "error.h"
+
+struct emlDevice;
+
+/**
+ * Adds a device to the watchdog. Its first sample is due after @a period.
+ *
+ * @param[in] device Device to be sampled
+ * @param[in] period Interval between samples, in nanoseconds
+ *
+ * @retval EML_SUCCESS The device is being watched
+ * @retval EML_NO_MEMORY Insufficient memory for the device
+ * @retval EML_UNKNOWN The watchdog thread could not be created
+ */
+enum emlError emlWatchdogAdd(const struct emlDevice* device, unsigned long long period);
+
+/**
+ * Removes a device from the watchdog.
+ *
+ * If the device is being sampled at the time of the call, waits until the
+ * sample is complete.
+ *
+ * @param[in] device Device to be removed
+ *
+ * @retval EML_SUCCESS The device is no longer watched
+ * @retval EML_NOT_STARTED The device was not watched
+ */
+enum emlError emlWatchdogRemove(const struct emlDevice* device);
+
+/**
+ * Stops the watchdog thread, if started.
+ *
+ * No devices should be watched when this is called.
+ *
+ * @retval EML_SUCCESS The watchdog was stopped
+ */
+enum emlError emlWatchdogShutdown();
+
+#endif /*EML_WATCHDOG_H*/
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/**
+ * @file
+ * Internal buffered text writer for dataset dumps
+ * @ingroup internalapi
+ *
+ * Text is accumulated in a large buffer and written out with a single
+ * @c fwrite when full, and integers are formatted without going through stdio.
+ */
+
+#ifndef EML_WRITER_H
+#define EML_WRITER_H
+
+#include <stdio.h>
+
+#include "error.h"
+
+#ifndef EML_WRITER_BUFSIZE
+/** Size of the writer buffer, in bytes (compile-time option) */
+#define EML_WRITER_BUFSIZE (256 * 1024)
+#endif
+
+/** Maximum number of digits in an unsigned long long */
+#define EML_WRITER_ULL_DIGITS 20
+
+/** Buffered writer */
+struct emlWriter {
+  /** Destination file */
+  FILE* file;
+  /** Buffered text */
+  char* buf;
+  /** Number of buffered bytes */
+  size_t len;
+};
+
+/**
+ * Initializes a writer.
+ *
+ * @param[out] writer Writer to be initialized
+ * @param[in] file Destination file
+ *
+ * @retval EML_SUCCESS The writer was initialized
+ * @retval EML_NO_MEMORY Insufficient memory for the buffer
+ */
+enum emlError emlWriterInit(struct emlWriter* writer, FILE* file);
+
+/**
+ * Flushes any buffered text and frees the writer buffer.
+ *
+ * @param[in] writer Writer
+ *
+ * @retval EML_SUCCESS All text was written
+ * @retval EML_UNKNOWN Writing to the destination file failed
+ */
+enum emlError emlWriterClose(struct emlWriter* writer);
+
+/**
+ * Writes buffered text to the destination file.
+ *
+ * @param[in] writer Writer
+ */
+void emlWriterFlush(struct emlWriter* writer);
+
+/**
+ * Appends a string.
+ *
+ * @param[in] writer Writer
+ * @param[in] str Text to be appended
+ * @param[in] len Length of @a str
+ */
+void emlWriterPutString(struct emlWriter* writer, const char* str, size_t len);
+
+/**
+ * Appends a character.
+ *
+ * @param[in] writer Writer
+ * @param[in] c Character to be appended
+ */
+void emlWriterPutChar(struct emlWriter* writer, char c);
+
+/**
+ * Appends an unsigned integer in decimal.
+ *
+ * @param[in] writer Writer
+ * @param[in] value Value to be appended
+ */
+void emlWriterPutULL(struct emlWriter* writer, unsigned long long value);
+
+/**
+ * Formats an unsigned integer in decimal.
+ *
+ * @param[out] dst Buffer of at least @ref EML_WRITER_ULL_DIGITS characters
+ * (not NUL-terminated)
+ * @param[in] value Value to be formatted
+ *
+ * @return Number of characters written
+ */
+size_t emlFormatULL(char* dst, unsigned long long value);
+
+#endif /*EML_WRITER_H*/
@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+//feature test macro for pthread_condattr_setclock(), etc
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "batch.h"
+#include "data.h"
+#include "debug.h"
+#include "device.h"
+#include "driver.h"
+#include "monitor.h"
+#include "scheduler.h"
+#include "timer.h"
+
+static const unsigned long long NS_PER_SEC = 1000000000ULL;
+
+/// Sampling state shared by all devices of a driver
+struct emlBatch {
+  /// Driver measured
+  const struct emlDriver* driver;
+  /// Number of devices in the driver
+  size_t ndevices;
+
+  /// Devices being measured, by device ID (NULL if not measured)
+  const struct emlDevice** members;
+  /// Number of devices being measured (read by the sampling thread)
+  size_t nmembers;
+  /// Field values for every device in the last sample
+  /// (EML_DATAPOINT_MAX_FIELDS per device)
+  unsigned long long* values;
+  /// Protects the members, and is held while a sample is taken and stored
+  pthread_mutex_t lock;
+
+  /// Serializes joining and leaving, which start and stop sampling
+  pthread_mutex_t startlock;
+  /// Thread that samples the batch periodically (unless the scheduler is
+  /// enabled)
+  pthread_t thread;
+  /// Wakes the sampling thread when the last device leaves
+  pthread_mutex_t wakelock;
+  pthread_cond_t wakecond;
+
+  /// Reference count
+  size_t refcount;
+};
+
+enum emlError emlBatchCreate(
+    struct emlBatch** const batch,
+    const struct emlDriver* const driver)
+{
+  assert(driver->measure_all);
+
+  struct emlBatch* b = malloc(sizeof(*b));
+  if (!b)
+    return EML_NO_MEMORY;
+
+  b->driver = driver;
+  b->ndevices = driver->ndevices;
+  b->members = calloc(driver->ndevices, sizeof(*b->members));
+  b->values = calloc(driver->ndevices * EML_DATAPOINT_MAX_FIELDS, sizeof(*b->values));
+  if (!b->members || !b->values) {
+    free(b->members);
+    free(b->values);
+    free(b);
+    return EML_NO_MEMORY;
+  }
+  b->nmembers = 0;
+  b->refcount = 1;
+  pthread_mutex_init(&b->lock, NULL);
+  pthread_mutex_init(&b->startlock, NULL);
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&b->wakecond, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_mutex_init(&b->wakelock, NULL);
+
+  *batch = b;
+  return EML_SUCCESS;
+}
+
+void emlBatchRetain(struct emlBatch* const batch) {
+  batch->refcount++;
+}
+
+enum emlError emlBatchRelease(struct emlBatch* const batch) {
+  if (--batch->refcount)
+    return EML_SUCCESS;
+
+  assert(!batch->nmembers);
+  pthread_mutex_destroy(&batch->lock);
+  pthread_mutex_destroy(&batch->startlock);
+  pthread_cond_destroy(&batch->wakecond);
+  pthread_mutex_destroy(&batch->wakelock);
+  free(batch->members);
+  free(batch->values);
+  free(batch);
+  return EML_SUCCESS;
+}
+
+const char* emlBatchName(const struct emlBatch* const batch) {
+  return batch->driver->name;
+}
+
+static void* batch_thread(void* arg) {
+  struct emlBatch* batch = arg;
+
+  unsigned long long deadline = monotonictimestamp();
+
+  //as long as there is at least one device being measured:
+  while (__atomic_load_n(&batch->nmembers, __ATOMIC_RELAXED)) {
+    //sample all devices and wait until the next sample is due
+    enum emlError err = emlBatchSample(batch);
+    if (err != EML_SUCCESS) {
+      dbglog_error("%s: sampling stopped: %s", batch->driver->name, emlErrorMessage(err));
+      return NULL;
+    }
+
+    deadline = emlBatchNextDeadline(batch, deadline);
+    const struct timespec wakeup = {
+      .tv_sec = deadline / NS_PER_SEC,
+      .tv_nsec = deadline % NS_PER_SEC,
+    };
+    int werr = 0;
+    pthread_mutex_lock(&batch->wakelock);
+    while (__atomic_load_n(&batch->nmembers, __ATOMIC_RELAXED) && werr != ETIMEDOUT) {
+      werr = pthread_cond_timedwait(&batch->wakecond, &batch->wakelock, &wakeup);
+      assert(werr != EINVAL);
+    }
+    pthread_mutex_unlock(&batch->wakelock);
+  }
+
+  return NULL;
+}
+
+enum emlError emlBatchJoin(
+    struct emlBatch* const batch,
+    const struct emlDevice* const device)
+{
+  assert(device->index < batch->ndevices);
+  enum emlError ret = EML_SUCCESS;
+
+  pthread_mutex_lock(&batch->startlock);
+
+  pthread_mutex_lock(&batch->lock);
+  assert(!batch->members[device->index]);
+  batch->members[device->index] = device;
+  const size_t nmembers = batch->nmembers + 1;
+  __atomic_store_n(&batch->nmembers, nmembers, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&batch->lock);
+
+  //start sampling for the first device
+  if (nmembers == 1) {
+    if (emlSchedulerEnabled()) {
+      ret = emlSchedulerAddBatch(batch);
+    }
+    else {
+      int err = pthread_create(&batch->thread, NULL, &batch_thread, batch);
+      if (err) {
+        dbglog_error("pthread_create returned %d", err);
+        ret = EML_UNKNOWN;
+      }
+    }
+
+    if (ret != EML_SUCCESS) {
+      pthread_mutex_lock(&batch->lock);
+      batch->members[device->index] = NULL;
+      __atomic_store_n(&batch->nmembers, 0, __ATOMIC_RELAXED);
+      pthread_mutex_unlock(&batch->lock);
+    }
+  }
+
+  pthread_mutex_unlock(&batch->startlock);
+  return ret;
+}
+
+enum emlError emlBatchLeave(
+    struct emlBatch* const batch,
+    const struct emlDevice* const device)
+{
+  assert(device->index < batch->ndevices);
+  enum emlError ret = EML_SUCCESS;
+
+  pthread_mutex_lock(&batch->startlock);
+
+  //samples are stored under the lock, so none is in progress for the device
+  //once it is out
+  pthread_mutex_lock(&batch->lock);
+  assert(batch->members[device->index] == device);
+  batch->members[device->index] = NULL;
+  const size_t nmembers = batch->nmembers - 1;
+  __atomic_store_n(&batch->nmembers, nmembers, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&batch->lock);
+
+  //stop sampling after the last device
+  if (!nmembers) {
+    if (emlSchedulerEnabled()) {
+      emlSchedulerRemoveBatch(batch);
+    }
+    else {
+      pthread_mutex_lock(&batch->wakelock);
+      pthread_cond_signal(&batch->wakecond);
+      pthread_mutex_unlock(&batch->wakelock);
+      if (pthread_join(batch->thread, NULL))
+        ret = EML_UNKNOWN;
+    }
+  }
+
+  pthread_mutex_unlock(&batch->startlock);
+  return ret;
+}
+
+enum emlError emlBatchSample(struct emlBatch* const batch) {
+  enum emlError err = EML_SUCCESS;
+
+  pthread_mutex_lock(&batch->lock);
+
+  //devices past the last one being measured are not read at all, and a single
+  //device is measured on its own
+  size_t ndevices = 0;
+  for (size_t i = 0; i < batch->ndevices; i++) {
+    if (batch->members[i])
+      ndevices = i + 1;
+  }
+  if (batch->nmembers == 1) {
+    unsigned long long* values = batch->values + (ndevices - 1) * EML_DATAPOINT_MAX_FIELDS;
+    memset(values, 0, EML_DATAPOINT_MAX_FIELDS * sizeof(*values));
+    err = batch->driver->measure(ndevices - 1, values);
+  }
+  else if (ndevices) {
+    memset(batch->values, 0, ndevices * EML_DATAPOINT_MAX_FIELDS * sizeof(*batch->values));
+    err = batch->driver->measure_all(batch->values, ndevices);
+  }
+
+  //fan values out to every device being measured
+  for (size_t i = 0; i < ndevices && err == EML_SUCCESS; i++) {
+    if (!batch->members[i])
+      continue;
+    int stored;
+    err = emlDeviceMonitorStore(batch->members[i],
+        batch->values + i * EML_DATAPOINT_MAX_FIELDS, &stored);
+  }
+
+  pthread_mutex_unlock(&batch->lock);
+  return err;
+}
+
+enum emlError emlBatchSampleDevice(
+    struct emlBatch* const batch,
+    const struct emlDevice* const device,
+    int* const stored)
+{
+  unsigned long long point[EML_DATAPOINT_MAX_FIELDS] = {0};
+
+  //taking the lock keeps samples for the device in order
+  pthread_mutex_lock(&batch->lock);
+  enum emlError err = batch->driver->measure(device->index, point);
+  *stored = 0;
+  if (err == EML_SUCCESS)
+    err = emlDeviceMonitorStore(device, point, stored);
+  pthread_mutex_unlock(&batch->lock);
+  return err;
+}
+
+unsigned long long emlBatchNextDeadline(
+    struct emlBatch* const batch,
+    const unsigned long long deadline)
+{
+  //devices share the driver sampling options, but overruns are counted for
+  //each of them
+  unsigned long long next = 0;
+  pthread_mutex_lock(&batch->lock);
+  for (size_t i = 0; i < batch->ndevices; i++) {
+    if (batch->members[i])
+      next = emlDeviceMonitorNextDeadline(batch->members[i], deadline);
+  }
+  pthread_mutex_unlock(&batch->lock);
+
+  //sampling is about to stop if no devices are left
+  return next ? next : monotonictimestamp();
+}
@@ -8,12 +8,16 @@
  */
 
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "data.h"
 #include "device.h"
 #include "error.h"
+#include "pack.h"
+#include "writer.h"
 
 void emlDataFactorDump(int factor, FILE* dumpfile) {
   if (factor >= 0) {
@@ -53,33 +57,363 @@ void emlDataPropertiesDump(
   fprintf(dumpfile, "],\n");
 }
 
+size_t emlDataFieldCount(const struct emlDataProperties* const props) {
+  size_t nfields = 1;
+  if (props->inst_energy_field) nfields++;
+  if (props->inst_power_field) nfields++;
+  return nfields;
+}
+
+enum emlError emlDataBlockPoolCreate(
+    struct emlDataBlockPool** const pool,
+    const size_t nfields)
+{
+  struct emlDataBlockPool* p = malloc(sizeof(*p));
+  if (!p)
+    return EML_NO_MEMORY;
+
+  for (size_t c = 0; c < EML_DATABLOCK_CLASSES; c++) {
+    p->head[c] = NULL;
+    p->nfree[c] = 0;
+  }
+  p->nfields = nfields;
+  p->refcount = 1;
+
+  *pool = p;
+  return EML_SUCCESS;
+}
+
+static void block_free(struct emlDataBlock* const block) {
+  free(block->fields);
+  free(block->energy);
+  free(block->packed);
+  free(block);
+}
+
+enum emlError emlDataBlockPoolRelease(struct emlDataBlockPool* const pool) {
+  assert(__atomic_load_n(&pool->refcount, __ATOMIC_RELAXED));
+
+  if (!__atomic_sub_fetch(&pool->refcount, 1, __ATOMIC_ACQ_REL)) {
+    for (size_t c = 0; c < EML_DATABLOCK_CLASSES; c++) {
+      struct emlDataBlock* block = pool->head[c];
+      while (block) {
+        struct emlDataBlock* next = SLIST_NEXT(block, entries);
+        block_free(block);
+        block = next;
+      }
+    }
+    free(pool);
+  }
+
+  return EML_SUCCESS;
+}
+
+size_t emlDataBlockNextSize(const size_t size) {
+  return size < DATABLOCK_SIZE / 2 ? 2 * size : DATABLOCK_SIZE;
+}
+
+//returns the index of the free block stack for a block size
+static size_t size_class(const size_t size) {
+  size_t c = 0;
+  for (size_t s = DATABLOCK_MIN_SIZE; s < size; s = emlDataBlockNextSize(s))
+    c++;
+  assert(c < EML_DATABLOCK_CLASSES);
+  return c;
+}
+
+static void pool_push(struct emlDataBlockPool* const pool, struct emlDataBlock* const block) {
+  const size_t c = size_class(block->size);
+  struct emlDataBlock* head = __atomic_load_n(&pool->head[c], __ATOMIC_RELAXED);
+  do {
+    SLIST_NEXT(block, entries) = head;
+  } while (!__atomic_compare_exchange_n(&pool->head[c], &head, block,
+        1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  __atomic_fetch_add(&pool->nfree[c], 1, __ATOMIC_RELAXED);
+}
+
+enum emlError emlDataBlockPoolFill(
+    struct emlDataBlockPool* const pool,
+    const size_t size,
+    const size_t nblocks)
+{
+  const size_t c = size_class(size);
+  while (__atomic_load_n(&pool->nfree[c], __ATOMIC_RELAXED) < nblocks) {
+    struct emlDataBlock* block = malloc(sizeof(*block));
+    if (!block)
+      return EML_NO_MEMORY;
+    block->fields = malloc(pool->nfields * size * sizeof(*block->fields));
+    block->energy = malloc(size * sizeof(*block->energy));
+    if (!block->fields || !block->energy) {
+      free(block->fields);
+      free(block->energy);
+      free(block);
+      return EML_NO_MEMORY;
+    }
+    block->size = size;
+    block->packed = NULL;
+    pool_push(pool, block);
+  }
+
+  return EML_SUCCESS;
+}
+
+//as there is a single consumer, a popped block cannot be pushed back
+//while we are popping it (no ABA problem)
+struct emlDataBlock* emlDataBlockPoolTake(
+    struct emlDataBlockPool* const pool,
+    const size_t size)
+{
+  const size_t c = size_class(size);
+  struct emlDataBlock* head = __atomic_load_n(&pool->head[c], __ATOMIC_ACQUIRE);
+  while (head && !__atomic_compare_exchange_n(&pool->head[c], &head,
+        SLIST_NEXT(head, entries), 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+  if (head)
+    __atomic_fetch_sub(&pool->nfree[c], 1, __ATOMIC_RELAXED);
+  return head;
+}
+
+void emlDataBlockPoolGive(
+    struct emlDataBlockPool* const pool,
+    struct emlDataBlock* const block)
+{
+  //compressed blocks have no raw buffer left to be reused
+  if (block->packed || __atomic_load_n(&pool->nfree[size_class(block->size)], __ATOMIC_RELAXED)
+      >= EML_DATABLOCK_POOL_MAX)
+    block_free(block);
+  else
+    pool_push(pool, block);
+}
+
+static unsigned long long step_energy(
+    const struct emlDataProperties* const props,
+    const unsigned long long prevts,
+    const unsigned long long prevpower,
+    const unsigned long long ts,
+    const unsigned long long energy)
+{
+  //...from energy counter readings
+  if (props->inst_energy_field)
+    return energy;
+
+  //...from instant power readings
+  if (props->inst_power_field) {
+    unsigned long long pwrdelta = prevpower * (ts - prevts);
+    if (props->time_factor >= 0)
+      return pwrdelta * props->time_factor;
+    else
+      return pwrdelta / (-props->time_factor);
+  }
+
+  return 0;
+}
+
+unsigned long long emlDataPointEnergy(
+    const struct emlDataProperties* const props,
+    const unsigned long long* const prev,
+    const unsigned long long* const cur)
+{
+  return step_energy(props,
+      prev[timestamp_field],
+      prev[props->inst_power_field],
+      cur[timestamp_field],
+      cur[props->inst_energy_field]);
+}
+
+unsigned long long emlDataEnergyAt(
+    const struct emlDataBlock* const block,
+    const size_t i)
+{
+  return block->energy_base + block->energy[i];
+}
+
+void emlDataRunEvict(
+    struct emlDataRun* const run,
+    const size_t* const keep,
+    const size_t nkeep,
+    const unsigned long long now)
+{
+  struct emlDataBlock* prev = NULL;
+  struct emlDataBlock* bp = SLIST_FIRST(&run->blocks);
+  int evicted = 0;
+
+  //never go past the current block, the first block of a live dataset or the
+  //block being compressed
+  while (bp && SLIST_NEXT(bp, entries) && !bp->refs && bp != run->packing) {
+    struct emlDataBlock* next = SLIST_NEXT(bp, entries);
+
+    //blocks are in time order, so stop at the first one within limits
+    const int toomany = run->maxblocks && run->nblocks > run->maxblocks;
+    const int tooold = run->maxtime
+      && now - emlDataBlockValue(bp, timestamp_field, bp->size - 1) > run->maxtime;
+    if (!toomany && !tooold)
+      break;
+    if (bp->first + bp->size > __atomic_load_n(&run->streamed, __ATOMIC_ACQUIRE))
+      break;
+
+    int kept = 0;
+    for (size_t k = 0; k < nkeep && !kept; k++)
+      kept = keep[k] >= bp->first && keep[k] <= bp->first + bp->size;
+    if (kept) {
+      prev = bp;
+      bp = next;
+      continue;
+    }
+
+    if (prev)
+      SLIST_NEXT(prev, entries) = next;
+    else
+      SLIST_FIRST(&run->blocks) = next;
+    emlDataBlockPoolGive(run->pool, bp);
+    run->nblocks--;
+    evicted = 1;
+
+    bp = next;
+  }
+
+  //evicted blocks may be anywhere in the index, so build it again
+  if (evicted)
+    run->nindexed = 0;
+}
+
+//returns the next block to be compressed (NULL if none), with the lock held
+static struct emlDataBlock* next_to_pack(
+    const struct emlDataRun* const run,
+    const size_t npoints)
+{
+  const size_t streamed = __atomic_load_n(&run->streamed, __ATOMIC_ACQUIRE);
+
+  //never go past the first block of a live dataset, nor the last block with
+  //published datapoints (the sampler may be appending blocks after it)
+  for (struct emlDataBlock* bp = SLIST_FIRST(&run->blocks);
+      bp && bp->first + bp->size < npoints && !bp->refs; bp = SLIST_NEXT(bp, entries)) {
+    if (bp->first + bp->size <= run->npacked)
+      continue;
+    if (bp->first + bp->size > streamed)
+      break;
+    return bp;
+  }
+  return NULL;
+}
+
+//checks that no dataset covers a block, with the lock held
+static int packable(const struct emlDataRun* const run, const struct emlDataBlock* const block) {
+  //the block is in the list, as it is not evicted while being compressed
+  const struct emlDataBlock* bp = SLIST_FIRST(&run->blocks);
+  while (bp != block && !bp->refs)
+    bp = SLIST_NEXT(bp, entries);
+  return !bp->refs;
+}
+
+void emlDataRunPack(struct emlDataRun* const run, const size_t npoints) {
+  const size_t nfields = emlDataFieldCount(run->props);
+  unsigned char* packed;
+  size_t packedoff[EML_DATAPOINT_MAX_FIELDS];
+
+  pthread_mutex_lock(&run->lock);
+  struct emlDataBlock* bp;
+  while ((bp = next_to_pack(run, npoints))) {
+    //full blocks do not change, and this one is not evicted meanwhile
+    run->packing = bp;
+    pthread_mutex_unlock(&run->lock);
+    enum emlError err = emlDataBlockPack(bp, nfields, &packed, packedoff);
+    pthread_mutex_lock(&run->lock);
+    run->packing = NULL;
+
+    //a dataset covering the block may have been created meanwhile, in which
+    //case it is left for later
+    if (!packable(run, bp)) {
+      if (err == EML_SUCCESS)
+        free(packed);
+      continue;
+    }
+
+    //blocks that do not compress well are left as they are
+    if (err == EML_SUCCESS)
+      emlDataBlockSetPacked(bp, nfields, packed, packedoff);
+    run->npacked = bp->first + bp->size;
+  }
+  pthread_mutex_unlock(&run->lock);
+}
+
+void emlDataRunIndex(struct emlDataRun* const run) {
+  struct emlDataBlock* bp = run->nindexed ?
+    SLIST_NEXT(run->index[run->nindexed - 1].block, entries) : SLIST_FIRST(&run->blocks);
+
+  for (; bp != NULL; bp = SLIST_NEXT(bp, entries)) {
+    if (run->nindexed == run->indexcap) {
+      const size_t cap = run->indexcap ? 2 * run->indexcap : 64;
+      struct emlDataIndexEntry* index = realloc(run->index, cap * sizeof(*index));
+      if (!index)
+        return;
+      run->index = index;
+      run->indexcap = cap;
+    }
+
+    run->index[run->nindexed].block = bp;
+    run->index[run->nindexed].firstts = emlDataBlockValue(bp, timestamp_field, 0);
+    run->nindexed++;
+  }
+}
+
+const char* emlDataRunDeviceName(const struct emlDataRun* const run) {
+  if (!run->device)
+    return run->devname;
+
+  const char* devname;
+  emlDeviceGetName(run->device, &devname);
+  return devname;
+}
+
 /// Decreases the reference count for a data run, freeing if it becomes 0
 enum emlError emlDataRunRelease(struct emlDataRun* run) {
-  assert(run->refcount);
-  run->refcount--;
+  assert(__atomic_load_n(&run->refcount, __ATOMIC_RELAXED));
 
-  //free run memory if no data interval needs it now
-  if (!run->refcount) {
+  //give blocks back to the pool if no data interval needs them now
+  if (!__atomic_sub_fetch(&run->refcount, 1, __ATOMIC_ACQ_REL)) {
     while (!SLIST_EMPTY(&run->blocks)) {
       struct emlDataBlock* first = SLIST_FIRST(&run->blocks);
       SLIST_REMOVE_HEAD(&run->blocks, entries);
-      free(first->fields);
-      free(first);
+      emlDataBlockPoolGive(run->pool, first);
     }
+    emlDataBlockPoolRelease(run->pool);
+    free(run->index);
+    free(run->devname);
+    pthread_mutex_destroy(&run->lock);
+    free(run);
   }
 
   return EML_SUCCESS;
 }
 
 enum emlError emlDataFree(struct emlData* data) {
+  //let the first block of this dataset be evicted
+  if (data->firstblock) {
+    pthread_mutex_lock(&data->run->lock);
+    assert(data->firstblock->refs);
+    data->firstblock->refs--;
+    pthread_mutex_unlock(&data->run->lock);
+  }
+
   emlDataRunRelease(data->run);
   free(data);
 
   return EML_SUCCESS;
 }
 
+//blocks after the end of the dataset may still be being filled
+const struct emlDataBlock* emlDataNextBlock(
+    const struct emlData* const data,
+    const struct emlDataBlock* const bp)
+{
+  if (bp->first + bp->size >= data->firstpoint + data->npoints)
+    return NULL;
+  return SLIST_NEXT(bp, entries);
+}
+
 enum emlError emlDataUpdateTotals(struct emlData* data) {
-  const struct emlDataProperties* props = data->run->props;
+  if (data->run->totals_only)
+    return EML_SUCCESS;
 
   data->elapsed_time = 0;
   data->consumed_energy = 0;
@@ -87,62 +421,496 @@ enum emlError emlDataUpdateTotals(struct emlData* data) {
   if (!data->npoints)
     return EML_SUCCESS;
 
-  size_t remaining = data->npoints;
-  unsigned long long total_elapsed = 0;
-  for (const struct emlDataBlock* bp = data->firstblock; bp != NULL && remaining; bp = SLIST_NEXT(bp, entries)) {
-    //find current block size
-    size_t blockstart = (bp == data->firstblock) ? (data->firstpoint % DATABLOCK_SIZE) : 0;
-    size_t blocksize = DATABLOCK_SIZE - blockstart;
-    int lastblock = 0;
-    if (remaining < blocksize) {
-      blocksize = remaining;
-      lastblock = 1;
+  //find the block holding the last datapoint (blocks may be missing in
+  //between if evicted, so go by run indexes)
+  const struct emlDataBlock* lastblock = data->firstblock;
+  for (const struct emlDataBlock* bp = data->firstblock; bp != NULL; bp = emlDataNextBlock(data, bp))
+    lastblock = bp;
+
+  const size_t first = data->firstpoint - data->firstblock->first;
+  const size_t last = data->firstpoint + data->npoints - 1 - lastblock->first;
+  assert(first < data->firstblock->size && last < lastblock->size);
+
+  //compute total elapsed time from first and last timestamps
+  data->elapsed_time = emlDataBlockValue(lastblock, timestamp_field, last)
+    - emlDataBlockValue(data->firstblock, timestamp_field, first);
+
+  //compute total consumed energy from prefix sums
+  data->consumed_energy = emlDataEnergyAt(lastblock, last)
+    - emlDataEnergyAt(data->firstblock, first);
+
+  return EML_SUCCESS;
+}
+
+void emlDataPowerCursorInit(
+    struct emlDataPowerCursor* const cursor,
+    const struct emlData* const data)
+{
+  cursor->data = data;
+  cursor->block = data->npoints ? data->firstblock : NULL;
+  if (cursor->block)
+    emlDataBlockReaderInit(&cursor->reader, cursor->block, emlDataFieldCount(data->run->props),
+        data->firstpoint - data->firstblock->first);
+  cursor->hasprev = 0;
+  cursor->prevts = 0;
+}
+
+int emlDataPowerNext(
+    struct emlDataPowerCursor* const cursor,
+    double* const time,
+    double* const power)
+{
+  const struct emlData* data = cursor->data;
+  const struct emlDataProperties* props = data->run->props;
+  const size_t end = data->firstpoint + data->npoints;
+
+  while (cursor->block) {
+    const struct emlDataBlock* bp = cursor->block;
+    const size_t blockend = end - bp->first < bp->size ? end - bp->first : bp->size;
+    if (cursor->reader.i >= blockend) {
+      //energy steps across evicted blocks are unknown
+      const struct emlDataBlock* next = emlDataNextBlock(data, bp);
+      if (next && next->first != bp->first + bp->size)
+        cursor->hasprev = 0;
+      cursor->block = next;
+      if (next)
+        emlDataBlockReaderInit(&cursor->reader, next, cursor->reader.nfields, 0);
+      continue;
     }
-    assert(blocksize);
-
-    //compute total elapsed time from first and last timestamps
-    const unsigned long long* ts = bp->fields + timestamp_field * DATABLOCK_SIZE;
-    if (bp == data->firstblock)
-      total_elapsed = ts[blockstart];
-    if (lastblock)
-      total_elapsed = ts[blockstart + blocksize - 1] - total_elapsed;
-
-    //compute total consumed energy...
-    //...from energy counter readings
-    if (props->inst_energy_field) {
-      const unsigned long long* energy = bp->fields + props->inst_energy_field * DATABLOCK_SIZE;
-      for (size_t i = 1; i < blocksize; i++)
-        data->consumed_energy += energy[i];
+
+    unsigned long long point[EML_DATAPOINT_MAX_FIELDS];
+    emlDataBlockReaderNext(&cursor->reader, point);
+    const unsigned long long ts = point[timestamp_field];
+    const int hasprev = cursor->hasprev;
+    const unsigned long long prevts = cursor->prevts;
+    cursor->hasprev = 1;
+    cursor->prevts = ts;
+
+    //use power readings, or the average power since the previous datapoint
+    *time = emlDataApplyFactor(ts, props->time_factor);
+    if (props->inst_power_field) {
+      *power = emlDataApplyFactor(point[props->inst_power_field], props->power_factor);
+      return 1;
     }
+    if (!hasprev || ts <= prevts)
+      continue;
+    *power = emlDataApplyFactor(point[props->inst_energy_field], props->energy_factor)
+      / emlDataApplyFactor(ts - prevts, props->time_factor);
+    return 1;
+  }
 
-    //...from instant power readings
-    else if (props->inst_power_field) {
-      const unsigned long long* power = bp->fields + props->inst_power_field * DATABLOCK_SIZE;
-      for (size_t i = blockstart + 1; i < blockstart + blocksize; i++) {
-        unsigned long long pwrdelta = power[i-1] * (ts[i] - ts[i-1]);
-        if (props->time_factor >= 0)
-          data->consumed_energy += pwrdelta * props->time_factor;
-        else
-          data->consumed_energy += pwrdelta / (-props->time_factor);
-      }
+  return 0;
+}
+
+/// P-square estimator for a single quantile (Jain and Chlamtac, 1985)
+struct emlQuantile {
+  /// Target quantile, between 0 and 1
+  double p;
+  /// Number of values seen
+  size_t count;
+  /// Marker heights (the first values seen, until there are 5)
+  double q[5];
+  /// Actual marker positions
+  double n[5];
+  /// Desired marker positions
+  double np[5];
+};
+
+static void quantile_init(struct emlQuantile* const qt, const double p) {
+  qt->p = p;
+  qt->count = 0;
+}
+
+static int cmp_double(const void* a, const void* b) {
+  const double x = *(const double*) a;
+  const double y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+static void quantile_add(struct emlQuantile* const qt, const double x) {
+  double* q = qt->q;
+  double* n = qt->n;
+  double* np = qt->np;
+
+  //keep the first values as they come
+  if (qt->count < 5) {
+    q[qt->count++] = x;
+    if (qt->count == 5) {
+      qsort(q, 5, sizeof(*q), &cmp_double);
+      for (size_t i = 0; i < 5; i++)
+        n[i] = i + 1;
+      np[0] = 1;
+      np[1] = 1 + 2 * qt->p;
+      np[2] = 1 + 4 * qt->p;
+      np[3] = 3 + 2 * qt->p;
+      np[4] = 5;
+    }
+    return;
+  }
+  qt->count++;
+
+  //find the cell holding x, extending the extremes if needed
+  size_t k;
+  if (x < q[0]) {
+    q[0] = x;
+    k = 0;
+  }
+  else if (x >= q[4]) {
+    q[4] = x;
+    k = 3;
+  }
+  else {
+    for (k = 0; x >= q[k + 1]; k++);
+  }
+
+  for (size_t i = k + 1; i < 5; i++)
+    n[i]++;
+  const double dn[5] = { 0, qt->p / 2, qt->p, (1 + qt->p) / 2, 1 };
+  for (size_t i = 0; i < 5; i++)
+    np[i] += dn[i];
+
+  //move the middle markers towards their desired positions
+  for (size_t i = 1; i < 4; i++) {
+    const double d = np[i] - n[i];
+    if ((d >= 1 && n[i + 1] - n[i] > 1) || (d <= -1 && n[i - 1] - n[i] < -1)) {
+      const int s = d > 0 ? 1 : -1;
+      //piecewise-parabolic prediction, or linear if out of order
+      const double qp = q[i] + s / (n[i + 1] - n[i - 1])
+        * ((n[i] - n[i - 1] + s) * (q[i + 1] - q[i]) / (n[i + 1] - n[i])
+            + (n[i + 1] - n[i] - s) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+      if (q[i - 1] < qp && qp < q[i + 1])
+        q[i] = qp;
+      else
+        q[i] += s * (q[i + s] - q[i]) / (n[i + s] - n[i]);
+      n[i] += s;
+    }
+  }
+}
+
+static double quantile_get(const struct emlQuantile* const qt) {
+  if (!qt->count)
+    return 0;
+  if (qt->count >= 5)
+    return qt->q[2];
+
+  //exact for few values (nearest rank)
+  double sorted[5];
+  memcpy(sorted, qt->q, qt->count * sizeof(*sorted));
+  qsort(sorted, qt->count, sizeof(*sorted), &cmp_double);
+  size_t rank = (size_t) ceil(qt->p * qt->count);
+  return sorted[rank ? rank - 1 : 0];
+}
+
+enum emlError emlDataGetStats(const struct emlData* const data, struct emlDataStats* const stats) {
+  if (!data || !stats)
+    return EML_INVALID_PARAMETER;
+  if (data->run->totals_only)
+    return EML_UNSUPPORTED;
+
+  struct emlQuantile p50, p95, p99;
+  quantile_init(&p50, 0.50);
+  quantile_init(&p95, 0.95);
+  quantile_init(&p99, 0.99);
+
+  //running mean and variance (Welford)
+  size_t count = 0;
+  double min = 0, max = 0, mean = 0, m2 = 0;
+
+  struct emlDataPowerCursor cursor;
+  emlDataPowerCursorInit(&cursor, data);
+  double time, value;
+  while (emlDataPowerNext(&cursor, &time, &value)) {
+    count++;
+    if (count == 1 || value < min)
+      min = value;
+    if (count == 1 || value > max)
+      max = value;
+    const double delta = value - mean;
+    mean += delta / count;
+    m2 += delta * (value - mean);
+
+    quantile_add(&p50, value);
+    quantile_add(&p95, value);
+    quantile_add(&p99, value);
+  }
+
+  stats->count = count;
+  stats->min = min;
+  stats->max = max;
+  stats->mean = mean;
+  stats->stddev = count ? sqrt(m2 / count) : 0;
+  stats->p50 = quantile_get(&p50);
+  stats->p95 = quantile_get(&p95);
+  stats->p99 = quantile_get(&p99);
+
+  return EML_SUCCESS;
+}
+
+/// Position of a datapoint within a dataset
+struct emlDataPos {
+  /// Block holding the datapoint (NULL if there is no such datapoint)
+  const struct emlDataBlock* block;
+  /// Index of the datapoint within the block
+  size_t i;
+};
+
+//finds the last datapoint of a dataset taken at or before ts, through the
+//run index first and then walking blocks not indexed yet
+static struct emlDataPos find_point(
+    const struct emlData* const data,
+    const unsigned long long ts)
+{
+  const struct emlDataRun* run = data->run;
+  const size_t end = data->firstpoint + data->npoints;
+  const struct emlDataBlock* bp = data->firstblock;
+
+  //last indexed block within the dataset starting at or before ts
+  size_t lo = 0, hi = run->nindexed;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (run->index[mid].block->first < end && run->index[mid].firstts <= ts)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo && run->index[lo - 1].block->first > bp->first)
+    bp = run->index[lo - 1].block;
+
+  const struct emlDataBlock* next;
+  while ((next = emlDataNextBlock(data, bp))
+      && emlDataBlockValue(next, timestamp_field, 0) <= ts)
+    bp = next;
+
+  //last datapoint within the block range at or before ts (compressed blocks
+  //can only be scanned)
+  const size_t blockstart = (bp == data->firstblock) ? data->firstpoint - bp->first : 0;
+  const size_t blockend = end - bp->first < bp->size ? end - bp->first : bp->size;
+  if (bp->fields) {
+    const unsigned long long* tsfield = bp->fields + timestamp_field * bp->size;
+    lo = blockstart;
+    hi = blockend;
+    while (lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (tsfield[mid] <= ts)
+        lo = mid + 1;
+      else
+        hi = mid;
     }
-    if (remaining - blocksize > 0) {
-      remaining -= blocksize;
-    } else {
-      remaining = 0;
+  }
+  else {
+    struct emlPackedColumn column;
+    emlPackedColumnInit(&column, bp, timestamp_field);
+    for (lo = 0; lo < blockend; lo++) {
+      if (emlPackedColumnNext(&column, timestamp_field, !lo) > ts && lo >= blockstart)
+        break;
     }
   }
 
-  data->elapsed_time = total_elapsed;
+  struct emlDataPos pos = { .block = NULL, .i = 0 };
+  if (lo > blockstart) {
+    pos.block = bp;
+    pos.i = lo - 1;
+  }
+  return pos;
+}
+
+//moves to the datapoint following pos within a dataset, or to the first one
+//if pos is empty
+static struct emlDataPos next_point(
+    const struct emlData* const data,
+    struct emlDataPos pos)
+{
+  if (!pos.block) {
+    pos.block = data->firstblock;
+    pos.i = data->firstpoint - data->firstblock->first;
+  }
+  else if (pos.block->first + pos.i + 1 >= data->firstpoint + data->npoints) {
+    pos.block = NULL;
+  }
+  else if (pos.i + 1 < pos.block->size) {
+    pos.i++;
+  }
+  else {
+    pos.block = emlDataNextBlock(data, pos.block);
+    pos.i = 0;
+  }
+  return pos;
+}
+
+//converts seconds from the first datapoint of a dataset to a timestamp
+static unsigned long long to_timestamp(
+    const struct emlData* const data,
+    const double seconds)
+{
+  const int factor = data->run->props->time_factor;
+  const unsigned long long first = emlDataBlockValue(data->firstblock, timestamp_field,
+      data->firstpoint - data->firstblock->first);
+
+  if (seconds <= 0)
+    return first;
+  if (factor >= 0)
+    return first + (unsigned long long) (seconds / factor);
+  else
+    return first + (unsigned long long) (seconds * -factor);
+}
+
+//finds the first and last datapoints of a dataset between t0 and t1
+static int find_range(
+    const struct emlData* const data,
+    const double t0,
+    const double t1,
+    struct emlDataPos* const first,
+    struct emlDataPos* const last)
+{
+  if (!data->npoints || t1 < t0)
+    return 0;
+
+  const unsigned long long ts0 = to_timestamp(data, t0);
+  const unsigned long long ts1 = to_timestamp(data, t1);
+  *first = ts0 ? find_point(data, ts0 - 1) : (struct emlDataPos) { .block = NULL, .i = 0 };
+  *first = next_point(data, *first);
+  *last = find_point(data, ts1);
+
+  return first->block && last->block
+    && first->block->first + first->i <= last->block->first + last->i;
+}
+
+enum emlError emlDataEnergyBetween(
+    const struct emlData* const data,
+    const double t0,
+    const double t1,
+    double* const consumed)
+{
+  if (!data || !consumed)
+    return EML_INVALID_PARAMETER;
+  if (data->run->totals_only)
+    return EML_UNSUPPORTED;
+
+  const struct emlDataProperties* props = data->run->props;
+  struct emlDataPos first, last;
+
+  //the index may be rebuilt by the sampler if the run is still going on
+  pthread_mutex_lock(&data->run->lock);
+  unsigned long long energy = 0;
+  if (find_range(data, t0, t1, &first, &last))
+    energy = emlDataEnergyAt(last.block, last.i)
+      - emlDataEnergyAt(first.block, first.i);
+  pthread_mutex_unlock(&data->run->lock);
+
+  *consumed = emlDataApplyFactor(energy, props->energy_factor);
+  return EML_SUCCESS;
+}
+
+enum emlError emlDataSlice(
+    const struct emlData* const data,
+    const double t0,
+    const double t1,
+    struct emlData** const slice)
+{
+  if (!data || !slice)
+    return EML_INVALID_PARAMETER;
+  if (data->run->totals_only)
+    return EML_UNSUPPORTED;
+
+  struct emlData* s = malloc(sizeof(*s));
+  if (!s)
+    return EML_NO_MEMORY;
+
+  struct emlDataPos first, last;
+
+  s->run = data->run;
+  s->firstblock = NULL;
+  s->firstpoint = 0;
+  s->npoints = 0;
+  s->elapsed_time = 0;
+  s->consumed_energy = 0;
+
+  //blocks for the slice are kept as long as it lives, as for any dataset
+  pthread_mutex_lock(&data->run->lock);
+  __atomic_fetch_add(&s->run->refcount, 1, __ATOMIC_RELAXED);
+  if (find_range(data, t0, t1, &first, &last)) {
+    s->firstblock = (struct emlDataBlock*) first.block;
+    s->firstblock->refs++;
+    s->firstpoint = first.block->first + first.i;
+    s->npoints = last.block->first + last.i + 1 - s->firstpoint;
+
+    s->elapsed_time = emlDataBlockValue(last.block, timestamp_field, last.i)
+      - emlDataBlockValue(first.block, timestamp_field, first.i);
+    s->consumed_energy = emlDataEnergyAt(last.block, last.i)
+      - emlDataEnergyAt(first.block, first.i);
+  }
+  pthread_mutex_unlock(&data->run->lock);
+
+  *slice = s;
   return EML_SUCCESS;
 }
 
+/// Text formats for datapoints
+enum emlDumpFormat {
+  EML_DUMP_JSON,
+  EML_DUMP_CSV,
+};
+
+//formats all datapoints through a buffered writer, skipping evicted blocks
+static enum emlError write_rows(
+    const struct emlData* const data,
+    const enum emlDumpFormat format,
+    FILE* const dumpfile)
+{
+  const struct emlDataProperties* props = data->run->props;
+
+  struct emlWriter writer;
+  enum emlError ret = emlWriterInit(&writer, dumpfile);
+  if (ret != EML_SUCCESS)
+    return ret;
+
+  char delim = ' ';
+  const size_t end = data->firstpoint + data->npoints;
+  for (const struct emlDataBlock* bp = data->npoints ? data->firstblock : NULL; bp != NULL; bp = emlDataNextBlock(data, bp)) {
+    //find current block range
+    size_t blockstart = (bp == data->firstblock) ? data->firstpoint - bp->first : 0;
+    size_t blockend = end - bp->first < bp->size ? end - bp->first : bp->size;
+    assert(blockstart < blockend);
+
+    struct emlDataBlockReader reader;
+    emlDataBlockReaderInit(&reader, bp, emlDataFieldCount(props), blockstart);
+
+    for (size_t i = blockstart; i < blockend; i++) {
+      unsigned long long point[EML_DATAPOINT_MAX_FIELDS];
+      emlDataBlockReaderNext(&reader, point);
+
+      if (format == EML_DUMP_JSON) {
+        emlWriterPutString(&writer, "   ", 3);
+        emlWriterPutChar(&writer, delim);
+        emlWriterPutChar(&writer, '[');
+        delim = ',';
+      }
+
+      emlWriterPutULL(&writer, point[timestamp_field]);
+      if (props->inst_energy_field) {
+        emlWriterPutChar(&writer, ',');
+        emlWriterPutULL(&writer, point[props->inst_energy_field]);
+      }
+      if (props->inst_power_field) {
+        emlWriterPutChar(&writer, ',');
+        emlWriterPutULL(&writer, point[props->inst_power_field]);
+      }
+
+      if (format == EML_DUMP_JSON)
+        emlWriterPutString(&writer, "]\n", 2);
+      else
+        emlWriterPutChar(&writer, '\n');
+    }
+  }
+
+  return emlWriterClose(&writer);
+}
+
 enum emlError emlDataDumpJSON(const struct emlData* data, FILE* dumpfile) {
   if (!data || !dumpfile)
     return EML_INVALID_PARAMETER;
 
-  const char* devname;
-  emlDeviceGetName(data->run->device, &devname);
+  const char* devname = emlDataRunDeviceName(data->run);
 
   fprintf(dumpfile,
     "{\n"
@@ -157,35 +925,162 @@ enum emlError emlDataDumpJSON(const struct emlData* data, FILE* dumpfile) {
 
   emlDataPropertiesDump(data->run->props, dumpfile);
 
-  fprintf(dumpfile, "  \"data\": [\n");
-  char delim = ' ';
-  size_t remaining = data->npoints;
-  for (const struct emlDataBlock* bp = data->firstblock; bp != NULL && remaining; bp = SLIST_NEXT(bp, entries), remaining -= DATABLOCK_SIZE) {
-    //find current block size
-    size_t blockstart = (bp == data->firstblock) ? (data->firstpoint % DATABLOCK_SIZE) : 0;
-    size_t blocksize = DATABLOCK_SIZE - blockstart;
-    if (remaining < blocksize)
-      blocksize = remaining;
-    assert(blocksize);
-
-    for (size_t i = blockstart; i < blockstart + blocksize; i++) {
-      fprintf(dumpfile, "   %c[%llu", delim, bp->fields[i + timestamp_field * DATABLOCK_SIZE]);
-
-      if (data->run->props->inst_energy_field)
-        fprintf(dumpfile, ",%llu", bp->fields[i + data->run->props->inst_energy_field * DATABLOCK_SIZE]);
-
-      if (data->run->props->inst_power_field)
-        fprintf(dumpfile, ",%llu", bp->fields[i + data->run->props->inst_power_field * DATABLOCK_SIZE]);
-
-      fprintf(dumpfile, "]\n");
-      delim = ',';
-    }
+  //datapoints are not kept in totals-only mode
+  if (data->run->totals_only) {
+    fprintf(dumpfile,
+        "  \"samples\": false,\n"
+        "  \"data\": []\n"
+        "}\n");
+    return EML_SUCCESS;
   }
 
+  fprintf(dumpfile, "  \"data\": [\n");
+  enum emlError ret = write_rows(data, EML_DUMP_JSON, dumpfile);
   fprintf(dumpfile,
       "  ]\n"
       "}\n");
 
+  return ret;
+}
+
+enum emlError emlDataDumpCSV(const struct emlData* data, FILE* dumpfile) {
+  if (!data || !dumpfile)
+    return EML_INVALID_PARAMETER;
+
+  //columns are named as in the JSON header
+  fprintf(dumpfile, "timestamp");
+  if (data->run->props->inst_energy_field)
+    fprintf(dumpfile, ",inst_energy");
+  if (data->run->props->inst_power_field)
+    fprintf(dumpfile, ",inst_power");
+  fprintf(dumpfile, "\n");
+
+  if (data->run->totals_only)
+    return EML_SUCCESS;
+
+  return write_rows(data, EML_DUMP_CSV, dumpfile);
+}
+
+double emlDataApplyFactor(const unsigned long long value, const int factor) {
+  if (factor >= 0)
+    return value * factor;
+  else
+    return (double) value / (double) (-factor);
+}
+
+enum emlError emlDataGetFactors(
+    const struct emlData* const data,
+    double* const time,
+    double* const energy,
+    double* const power)
+{
+  if (!data || !time || !energy || !power)
+    return EML_INVALID_PARAMETER;
+
+  const struct emlDataProperties* props = data->run->props;
+  *time = emlDataApplyFactor(1, props->time_factor);
+  *energy = emlDataApplyFactor(1, props->energy_factor);
+  *power = props->inst_power_field ? emlDataApplyFactor(1, props->power_factor) : 0;
+  return EML_SUCCESS;
+}
+
+//moves an iterator to datapoint i of a block, decoding the datapoints before
+//it for compressed blocks
+static void iter_seek(
+    struct emlDataIter* const iter,
+    const struct emlDataBlock* const bp,
+    const size_t i)
+{
+  iter->block = bp;
+  iter->next = i;
+  if (!bp || bp->fields)
+    return;
+
+  const size_t nfields = emlDataFieldCount(iter->data->run->props);
+  for (size_t field = 0; field < nfields; field++) {
+    struct emlPackedColumn column;
+    emlPackedColumnInit(&column, bp, field);
+    for (size_t j = 0; j < i; j++)
+      emlPackedColumnNext(&column, field, !j);
+    iter->packed[field] = column.p;
+    iter->value[field] = column.value;
+    iter->delta[field] = column.delta;
+  }
+}
+
+enum emlError emlDataIterInit(const struct emlData* const data, struct emlDataIter* const iter) {
+  if (!data || !iter)
+    return EML_INVALID_PARAMETER;
+
+  iter->data = data;
+  iter_seek(iter, NULL, 0);
+  if (!data->run->totals_only && data->npoints)
+    iter_seek(iter, data->firstblock, data->firstpoint - data->firstblock->first);
+  return EML_SUCCESS;
+}
+
+//blocks of a dataset are never evicted nor changed, so no locks are needed
+enum emlError emlDataIterNext(
+    struct emlDataIter* const iter,
+    size_t* const npoints,
+    const unsigned long long** const timestamps,
+    const unsigned long long** const energy,
+    const unsigned long long** const power)
+{
+  if (!iter || !iter->data || !npoints || !timestamps || !energy || !power)
+    return EML_INVALID_PARAMETER;
+
+  const struct emlData* data = iter->data;
+  const struct emlDataBlock* bp = iter->block;
+  if (!bp) {
+    *npoints = 0;
+    *timestamps = *energy = *power = NULL;
+    return EML_SUCCESS;
+  }
+
+  const struct emlDataProperties* props = data->run->props;
+  const size_t end = data->firstpoint + data->npoints;
+  const size_t blockstart = iter->next;
+  const size_t blockend = end - bp->first < bp->size ? end - bp->first : bp->size;
+
+  //raw blocks become a span each
+  if (bp->fields) {
+    *npoints = blockend - blockstart;
+    *timestamps = bp->fields + timestamp_field * bp->size + blockstart;
+    *energy = props->inst_energy_field ?
+      bp->fields + props->inst_energy_field * bp->size + blockstart : NULL;
+    *power = props->inst_power_field ?
+      bp->fields + props->inst_power_field * bp->size + blockstart : NULL;
+
+    iter_seek(iter, emlDataNextBlock(data, bp), 0);
+    return EML_SUCCESS;
+  }
+
+  //compressed blocks are decoded a few datapoints at a time
+  const size_t nfields = emlDataFieldCount(props);
+  const size_t n = blockend - blockstart < EML_DATAITER_SPAN ?
+    blockend - blockstart : EML_DATAITER_SPAN;
+  for (size_t field = 0; field < nfields; field++) {
+    struct emlPackedColumn column = {
+      .p = iter->packed[field],
+      .value = iter->value[field],
+      .delta = iter->delta[field],
+    };
+    for (size_t j = 0; j < n; j++)
+      iter->buffer[field][j] = emlPackedColumnNext(&column, field, !(blockstart + j));
+    iter->packed[field] = column.p;
+    iter->value[field] = column.value;
+    iter->delta[field] = column.delta;
+  }
+
+  *npoints = n;
+  *timestamps = iter->buffer[timestamp_field];
+  *energy = props->inst_energy_field ? iter->buffer[props->inst_energy_field] : NULL;
+  *power = props->inst_power_field ? iter->buffer[props->inst_power_field] : NULL;
+
+  iter->next += n;
+  if (iter->next == blockend)
+    iter_seek(iter, emlDataNextBlock(data, bp), 0);
   return EML_SUCCESS;
 }
 
@@ -193,12 +1088,7 @@ enum emlError emlDataGetElapsed(
     const struct emlData* data,
     double* elapsed)
 {
-  const int factor = data->run->props->time_factor;
-  if (factor >= 0)
-    *elapsed = data->elapsed_time * factor;
-  else
-    *elapsed = (double) data->elapsed_time / (double) (-factor);
-
+  *elapsed = emlDataApplyFactor(data->elapsed_time, data->run->props->time_factor);
   return EML_SUCCESS;
 }
 
@@ -206,11 +1096,6 @@ enum emlError emlDataGetConsumed(
     const struct emlData* data,
     double* consumed)
 {
-  const int factor = data->run->props->energy_factor;
-  if (factor >= 0)
-    *consumed = data->consumed_energy * factor;
-  else
-    *consumed = (double) data->consumed_energy / (double) (-factor);
-
+  *consumed = emlDataApplyFactor(data->consumed_energy, data->run->props->energy_factor);
   return EML_SUCCESS;
 }
@@ -0,0 +1,536 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+//feature test macro for mmap(), etc
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <eml/datafile.h>
+
+#include "data.h"
+#include "datafile.h"
+#include "debug.h"
+#include "device.h"
+#include "error.h"
+#include "load.h"
+#include "pack.h"
+
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#define EML_DATAFILE_SWAP 1
+#endif
+
+/// Memory-mapped binary dataset
+struct emlDataFile {
+  /// Mapped file contents
+  const unsigned char* map;
+  size_t size;
+
+  /// Measurement properties from the header
+  struct emlDataProperties props;
+  /// Number of fields in each datapoint
+  size_t nfields;
+  /// Header flags
+  uint32_t flags;
+  /// Device name (points into the map)
+  const char* device;
+  /// Dataset totals, in device units
+  unsigned long long elapsed;
+  unsigned long long consumed;
+  /// Total number of datapoints
+  unsigned long long npoints;
+
+  /// Byte offset of each chunk
+  size_t* chunks;
+  size_t nchunks;
+};
+
+static void put_le32(unsigned char* const dst, const uint32_t value) {
+  for (size_t i = 0; i < 4; i++)
+    dst[i] = value >> (8 * i);
+}
+
+static void put_le64(unsigned char* const dst, const uint64_t value) {
+  for (size_t i = 0; i < 8; i++)
+    dst[i] = value >> (8 * i);
+}
+
+static uint32_t get_le32(const unsigned char* const src) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < 4; i++)
+    value |= (uint32_t) src[i] << (8 * i);
+  return value;
+}
+
+static uint64_t get_le64(const unsigned char* const src) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < 8; i++)
+    value |= (uint64_t) src[i] << (8 * i);
+  return value;
+}
+
+static size_t pad8(const size_t len) {
+  return (len + 7) & ~(size_t) 7;
+}
+
+//writes a column slice as little-endian 64-bit values
+static void write_column(
+    const unsigned long long* const values,
+    const size_t count,
+    FILE* const dumpfile)
+{
+#ifndef EML_DATAFILE_SWAP
+  fwrite(values, sizeof(*values), count, dumpfile);
+#else
+  unsigned char buf[8 * 512];
+  for (size_t i = 0; i < count; ) {
+    size_t n = 0;
+    for (; n < sizeof(buf) / 8 && i < count; n++, i++)
+      put_le64(buf + 8 * n, values[i]);
+    fwrite(buf, 8, n, dumpfile);
+  }
+#endif
+}
+
+//writes a column slice from a compressed block, decoding it in pieces
+static void write_packed_column(
+    const struct emlDataBlock* const bp,
+    const size_t field,
+    const size_t start,
+    const size_t end,
+    FILE* const dumpfile)
+{
+  struct emlPackedColumn column;
+  emlPackedColumnInit(&column, bp, field);
+  for (size_t i = 0; i < start; i++)
+    emlPackedColumnNext(&column, field, !i);
+
+  unsigned long long values[512];
+  for (size_t i = start; i < end; ) {
+    size_t n = 0;
+    for (; n < sizeof(values) / sizeof(*values) && i < end; n++, i++)
+      values[n] = emlPackedColumnNext(&column, field, !i);
+    write_column(values, n, dumpfile);
+  }
+}
+
+size_t emlDataFileFormatHeader(
+    unsigned char* const header,
+    const struct emlDataProperties* const props,
+    const char* const devname,
+    const unsigned int flags,
+    const unsigned long long npoints,
+    const unsigned long long elapsed,
+    const unsigned long long consumed,
+    const unsigned long long nchunks)
+{
+  const size_t namelen = strlen(devname);
+  const size_t header_size = EML_DATAFILE_OFF_NAME + pad8(namelen + 1);
+  assert(header_size <= EML_DATAFILE_HEADER_MAX);
+
+  memset(header, 0, header_size);
+  memcpy(header + EML_DATAFILE_OFF_MAGIC, EML_DATAFILE_MAGIC, sizeof(EML_DATAFILE_MAGIC));
+  put_le32(header + EML_DATAFILE_OFF_VERSION, EML_DATAFILE_VERSION);
+  put_le32(header + EML_DATAFILE_OFF_HEADER_SIZE, header_size);
+  put_le32(header + EML_DATAFILE_OFF_TIME_FACTOR, props->time_factor);
+  put_le32(header + EML_DATAFILE_OFF_ENERGY_FACTOR, props->energy_factor);
+  put_le32(header + EML_DATAFILE_OFF_POWER_FACTOR, props->power_factor);
+  put_le32(header + EML_DATAFILE_OFF_NFIELDS, emlDataFieldCount(props));
+  put_le32(header + EML_DATAFILE_OFF_ENERGY_FIELD, props->inst_energy_field);
+  put_le32(header + EML_DATAFILE_OFF_POWER_FIELD, props->inst_power_field);
+  put_le32(header + EML_DATAFILE_OFF_FLAGS, flags);
+  put_le32(header + EML_DATAFILE_OFF_NAMELEN, namelen);
+  put_le64(header + EML_DATAFILE_OFF_NPOINTS, npoints);
+  put_le64(header + EML_DATAFILE_OFF_ELAPSED, elapsed);
+  put_le64(header + EML_DATAFILE_OFF_CONSUMED, consumed);
+  put_le64(header + EML_DATAFILE_OFF_NCHUNKS, nchunks);
+  memcpy(header + EML_DATAFILE_OFF_NAME, devname, namelen);
+
+  return header_size;
+}
+
+void emlDataFileFormatChunkHeader(unsigned char* const header, const unsigned long long npoints) {
+  put_le64(header, npoints);
+}
+
+enum emlError emlDataDumpBinary(const struct emlData* const data, FILE* const dumpfile) {
+  if (!data || !dumpfile)
+    return EML_INVALID_PARAMETER;
+
+  const struct emlDataProperties* props = data->run->props;
+  const size_t nfields = emlDataFieldCount(props);
+  const size_t end = data->firstpoint + data->npoints;
+
+  //count the chunks first (blocks may be missing if evicted)
+  size_t nchunks = 0;
+  unsigned long long npoints = 0;
+  const struct emlDataBlock* firstblock = NULL;
+  if (!data->run->totals_only && data->npoints)
+    firstblock = data->firstblock;
+  for (const struct emlDataBlock* bp = firstblock; bp != NULL; bp = emlDataNextBlock(data, bp)) {
+    size_t blockstart = (bp == data->firstblock) ? data->firstpoint - bp->first : 0;
+    size_t blockend = end - bp->first < bp->size ? end - bp->first : bp->size;
+    npoints += blockend - blockstart;
+    nchunks++;
+  }
+
+  const char* devname = emlDataRunDeviceName(data->run);
+  unsigned char header[EML_DATAFILE_HEADER_MAX];
+  const size_t header_size = emlDataFileFormatHeader(header, props, devname,
+      data->run->totals_only ? 0 : EML_DATAFILE_SAMPLES,
+      npoints, data->elapsed_time, data->consumed_energy, nchunks);
+  fwrite(header, 1, header_size, dumpfile);
+
+  //each block becomes a chunk, written column by column
+  for (const struct emlDataBlock* bp = firstblock; bp != NULL; bp = emlDataNextBlock(data, bp)) {
+    size_t blockstart = (bp == data->firstblock) ? data->firstpoint - bp->first : 0;
+    size_t blockend = end - bp->first < bp->size ? end - bp->first : bp->size;
+    assert(blockstart < blockend);
+
+    unsigned char chunkheader[EML_DATAFILE_CHUNK_HEADER_SIZE];
+    emlDataFileFormatChunkHeader(chunkheader, blockend - blockstart);
+    fwrite(chunkheader, 1, sizeof(chunkheader), dumpfile);
+
+    for (size_t field = 0; field < nfields; field++) {
+      if (bp->fields)
+        write_column(bp->fields + field * bp->size + blockstart, blockend - blockstart, dumpfile);
+      else
+        write_packed_column(bp, field, blockstart, blockend, dumpfile);
+    }
+  }
+
+  if (ferror(dumpfile))
+    return EML_UNKNOWN;
+  return EML_SUCCESS;
+}
+
+enum emlError emlDataFileParseHeader(
+    const unsigned char* const header,
+    const size_t size,
+    struct emlDataFileHeader* const info)
+{
+  if (size < EML_DATAFILE_OFF_NAME
+      || memcmp(header + EML_DATAFILE_OFF_MAGIC, EML_DATAFILE_MAGIC, sizeof(EML_DATAFILE_MAGIC)))
+    return EML_PARSING_ERROR;
+  if (get_le32(header + EML_DATAFILE_OFF_VERSION) != EML_DATAFILE_VERSION)
+    return EML_UNSUPPORTED;
+
+  const size_t header_size = get_le32(header + EML_DATAFILE_OFF_HEADER_SIZE);
+  const size_t namelen = get_le32(header + EML_DATAFILE_OFF_NAMELEN);
+  if (header_size > size || header_size % 8 || header_size <= EML_DATAFILE_OFF_NAME
+      || namelen >= header_size - EML_DATAFILE_OFF_NAME
+      || header[EML_DATAFILE_OFF_NAME + namelen] != '\0')
+    return EML_PARSING_ERROR;
+  info->size = header_size;
+  info->device = (const char*) header + EML_DATAFILE_OFF_NAME;
+
+  info->props.time_factor = (int32_t) get_le32(header + EML_DATAFILE_OFF_TIME_FACTOR);
+  info->props.energy_factor = (int32_t) get_le32(header + EML_DATAFILE_OFF_ENERGY_FACTOR);
+  info->props.power_factor = (int32_t) get_le32(header + EML_DATAFILE_OFF_POWER_FACTOR);
+  info->props.inst_energy_field = get_le32(header + EML_DATAFILE_OFF_ENERGY_FIELD);
+  info->props.inst_power_field = get_le32(header + EML_DATAFILE_OFF_POWER_FIELD);
+  info->nfields = get_le32(header + EML_DATAFILE_OFF_NFIELDS);
+  info->flags = get_le32(header + EML_DATAFILE_OFF_FLAGS);
+  info->npoints = get_le64(header + EML_DATAFILE_OFF_NPOINTS);
+  info->elapsed = get_le64(header + EML_DATAFILE_OFF_ELAPSED);
+  info->consumed = get_le64(header + EML_DATAFILE_OFF_CONSUMED);
+  info->nchunks = get_le64(header + EML_DATAFILE_OFF_NCHUNKS);
+
+  if (!info->nfields || info->nfields > EML_DATAPOINT_MAX_FIELDS
+      || info->props.inst_energy_field >= info->nfields
+      || info->props.inst_power_field >= info->nfields
+      || !info->props.time_factor || !info->props.energy_factor)
+    return EML_PARSING_ERROR;
+
+  return EML_SUCCESS;
+}
+
+//checks the header and locates every chunk without reading any datapoint
+static enum emlError parse_file(struct emlDataFile* const file) {
+  const unsigned char* const map = file->map;
+  const size_t size = file->size;
+
+  struct emlDataFileHeader info;
+  enum emlError ret = emlDataFileParseHeader(map, size, &info);
+  if (ret != EML_SUCCESS)
+    return ret;
+
+  const size_t header_size = info.size;
+  const uint64_t nchunks = info.nchunks;
+  file->device = info.device;
+  file->props = info.props;
+  file->nfields = info.nfields;
+  file->flags = info.flags;
+  file->npoints = info.npoints;
+  file->elapsed = info.elapsed;
+  file->consumed = info.consumed;
+  if (nchunks > (size - header_size) / 8)
+    return EML_PARSING_ERROR;
+
+  //streams cut short have no counts, so chunks are taken up to the last
+  //complete one
+  const int partial = file->flags & EML_DATAFILE_STREAM;
+  size_t capacity = partial ? 16 : nchunks;
+  file->nchunks = 0;
+  file->chunks = malloc((capacity ? capacity : 1) * sizeof(*file->chunks));
+  if (!file->chunks)
+    return EML_NO_MEMORY;
+
+  size_t offset = header_size;
+  uint64_t npoints = 0;
+  while (partial || file->nchunks < nchunks) {
+    const uint64_t count = size - offset < 8 ? 0 : get_le64(map + offset);
+    if (size - offset < 8 || count > (size - offset - 8) / 8 / file->nfields) {
+      if (partial)
+        break;
+      return EML_PARSING_ERROR;
+    }
+
+    if (file->nchunks == capacity) {
+      capacity *= 2;
+      size_t* chunks = realloc(file->chunks, capacity * sizeof(*chunks));
+      if (!chunks)
+        return EML_NO_MEMORY;
+      file->chunks = chunks;
+    }
+    file->chunks[file->nchunks++] = offset;
+    offset += 8 + count * 8 * file->nfields;
+    npoints += count;
+  }
+  if (partial)
+    file->npoints = npoints;
+  if (npoints != file->npoints)
+    return EML_PARSING_ERROR;
+
+  return EML_SUCCESS;
+}
+
+enum emlError emlDataFileOpen(const char* const path, struct emlDataFile** const file) {
+  if (!path || !file)
+    return EML_INVALID_PARAMETER;
+
+#ifdef EML_DATAFILE_SWAP
+  //columns are exposed in place, so they must be in host byte order
+  return EML_UNSUPPORTED;
+#endif
+
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    const int err = errno;
+    dbglog_warn("%s: %s", path, strerror(err));
+    return err == EACCES ? EML_NO_PERMISSION : EML_INVALID_PARAMETER;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+    close(fd);
+    return EML_PARSING_ERROR;
+  }
+
+  struct emlDataFile* f = calloc(1, sizeof(*f));
+  if (!f) {
+    close(fd);
+    return EML_NO_MEMORY;
+  }
+
+  f->size = st.st_size;
+  void* map = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    dbglog_warn("%s: mmap: %s", path, strerror(errno));
+    free(f);
+    return EML_NO_MEMORY;
+  }
+  f->map = map;
+
+  enum emlError ret = parse_file(f);
+  if (ret != EML_SUCCESS) {
+    emlDataFileClose(f);
+    return ret;
+  }
+
+  *file = f;
+  return EML_SUCCESS;
+}
+
+enum emlError emlDataFileClose(struct emlDataFile* const file) {
+  if (!file)
+    return EML_INVALID_PARAMETER;
+
+  munmap((void*) file->map, file->size);
+  free(file->chunks);
+  free(file);
+  return EML_SUCCESS;
+}
+
+//reads one column of a chunk into consecutive blocks, reserving them as
+//datapoints arrive (so a bogus count cannot make us allocate ahead of the data)
+static enum emlError read_column(
+    struct emlDataLoader* const loader,
+    FILE* const file,
+    const size_t field,
+    const uint64_t count)
+{
+  struct emlDataBlock* bp = NULL;
+  size_t done = 0;
+  while (done < count) {
+    if (!field) {
+      if (!emlDataLoaderReserve(loader, done + 1))
+        return EML_NO_MEMORY;
+    }
+    bp = bp ? SLIST_NEXT(bp, entries) : loader->curblk;
+    const size_t i = loader->data->npoints + done - bp->first;
+    const size_t n = count - done < bp->size - i ? count - done : bp->size - i;
+
+    unsigned long long* const values = bp->fields + field * bp->size + i;
+    if (fread(values, sizeof(*values), n, file) != n)
+      return EML_PARSING_ERROR;
+#ifdef EML_DATAFILE_SWAP
+    for (size_t j = 0; j < n; j++)
+      values[j] = get_le64((const unsigned char*) &values[j]);
+#endif
+    done += n;
+  }
+
+  return EML_SUCCESS;
+}
+
+enum emlError emlDataFileLoad(FILE* const file, struct emlData** const data) {
+  //the header size is known once the fixed fields are in
+  unsigned char header[EML_DATAFILE_HEADER_MAX];
+  if (fread(header, 1, EML_DATAFILE_OFF_NAME, file) != EML_DATAFILE_OFF_NAME)
+    return EML_PARSING_ERROR;
+  const size_t header_size = get_le32(header + EML_DATAFILE_OFF_HEADER_SIZE);
+  if (header_size > sizeof(header) || header_size < EML_DATAFILE_OFF_NAME
+      || fread(header + EML_DATAFILE_OFF_NAME, 1, header_size - EML_DATAFILE_OFF_NAME, file)
+        != header_size - EML_DATAFILE_OFF_NAME)
+    return EML_PARSING_ERROR;
+
+  struct emlDataFileHeader info;
+  enum emlError ret = emlDataFileParseHeader(header, header_size, &info);
+  if (ret != EML_SUCCESS)
+    return ret;
+  if (info.nfields != emlDataFieldCount(&info.props))
+    return EML_PARSING_ERROR;
+
+  struct emlDataLoader loader;
+  ret = emlDataLoaderInit(&loader, &info.props, info.device);
+  if (ret != EML_SUCCESS)
+    return ret;
+
+  //streams cut short go on up to the last whole chunk
+  const int partial = info.flags & EML_DATAFILE_STREAM;
+  for (uint64_t chunk = 0; partial || chunk < info.nchunks; chunk++) {
+    unsigned char chunkheader[EML_DATAFILE_CHUNK_HEADER_SIZE];
+    if (fread(chunkheader, 1, sizeof(chunkheader), file) != sizeof(chunkheader)) {
+      if (!partial)
+        ret = EML_PARSING_ERROR;
+      break;
+    }
+    const uint64_t count = get_le64(chunkheader);
+
+    for (size_t field = 0; ret == EML_SUCCESS && field < info.nfields; field++)
+      ret = read_column(&loader, file, field, count);
+    if (ret == EML_PARSING_ERROR && partial) {
+      ret = EML_SUCCESS;
+      break;
+    }
+    if (ret != EML_SUCCESS)
+      break;
+    emlDataLoaderCommit(&loader, count);
+  }
+  if (ret == EML_SUCCESS && !partial && loader.data->npoints != info.npoints)
+    ret = EML_PARSING_ERROR;
+  if (ret == EML_SUCCESS && !(info.flags & EML_DATAFILE_SAMPLES) && loader.data->npoints)
+    ret = EML_PARSING_ERROR;
+
+  if (ret != EML_SUCCESS) {
+    emlDataLoaderAbort(&loader);
+    return ret;
+  }
+
+  *data = emlDataLoaderFinish(&loader, info.flags & EML_DATAFILE_SAMPLES, !partial,
+      info.elapsed, info.consumed);
+  return EML_SUCCESS;
+}
+
+enum emlError emlDataFileGetDevice(const struct emlDataFile* const file, const char** const name) {
+  if (!file || !name)
+    return EML_INVALID_PARAMETER;
+
+  *name = file->device;
+  return EML_SUCCESS;
+}
+
+enum emlError emlDataFileGetTotals(
+    const struct emlDataFile* const file,
+    double* const consumed,
+    double* const elapsed)
+{
+  if (!file || !consumed || !elapsed)
+    return EML_INVALID_PARAMETER;
+
+  *consumed = emlDataApplyFactor(file->consumed, file->props.energy_factor);
+  *elapsed = emlDataApplyFactor(file->elapsed, file->props.time_factor);
+  return EML_SUCCESS;
+}
+
+enum emlError emlDataFileGetFactors(
+    const struct emlDataFile* const file,
+    double* const time,
+    double* const energy,
+    double* const power)
+{
+  if (!file || !time || !energy || !power)
+    return EML_INVALID_PARAMETER;
+
+  *time = emlDataApplyFactor(1, file->props.time_factor);
+  *energy = emlDataApplyFactor(1, file->props.energy_factor);
+  *power = file->props.power_factor ? emlDataApplyFactor(1, file->props.power_factor) : 0;
+  return EML_SUCCESS;
+}
+
+enum emlError emlDataFileGetChunkCount(const struct emlDataFile* const file, size_t* const count) {
+  if (!file || !count)
+    return EML_INVALID_PARAMETER;
+
+  *count = file->nchunks;
+  return EML_SUCCESS;
+}
+
+enum emlError emlDataFileGetChunk(
+    const struct emlDataFile* const file,
+    const size_t chunk,
+    size_t* const npoints,
+    const unsigned long long** const timestamps,
+    const unsigned long long** const energy,
+    const unsigned long long** const power)
+{
+  if (!file || chunk >= file->nchunks || !npoints || !timestamps || !energy || !power)
+    return EML_INVALID_PARAMETER;
+
+  const unsigned char* const base = file->map + file->chunks[chunk];
+  const size_t count = get_le64(base);
+  const unsigned long long* const columns = (const unsigned long long*) (base + 8);
+
+  *npoints = count;
+  *timestamps = columns + timestamp_field * count;
+  *energy = file->props.inst_energy_field ? columns + file->props.inst_energy_field * count : NULL;
+  *power = file->props.inst_power_field ? columns + file->props.inst_power_field * count : NULL;
+  return EML_SUCCESS;
+}
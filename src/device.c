@@ -21,7 +21,10 @@
 #include "driver.h"
 #include "eml.h"
 #include "error.h"
+#include "housekeeper.h"
 #include "monitor.h"
+#include "scheduler.h"
+#include "watchdog.h"
 
 static const struct emlDriver* drivers[EML_DEVICE_TYPE_COUNT] = {0};
 static struct emlDevice** devices = NULL;
@@ -106,6 +109,8 @@ enum emlError emlInit() {
     CFG_SEC("pmlib", drivers[EML_DEV_PMLIB]->cfgopts, CFGF_NONE),
 #endif
 
+    CFG_INT("scheduler_threads", 0, CFGF_NONE),
+    CFG_STR("data_mode", "samples", CFGF_NONE),
     CFG_END()
   };
 
@@ -123,6 +128,14 @@ enum emlError emlInit() {
   if (!devices)
     return EML_NO_MEMORY;
 
+  const long nthreads = cfg_getint(config, "scheduler_threads");
+  enum emlError err = emlSchedulerInit(nthreads > 0 ? nthreads : 0);
+  if (err != EML_SUCCESS) {
+    free(devices);
+    devices = NULL;
+    return err;
+  }
+
   for (size_t i = 0; i < EML_DEVICE_TYPE_COUNT; i++) {
     const struct emlDriver* drv = drivers[i];
 
@@ -141,6 +154,10 @@ enum emlError emlInit() {
       continue;
     }
 
+    //drivers without their own data mode use the global one
+    if (!cfg_getstr(drvconfig, "data_mode"))
+      cfg_setstr(drvconfig, "data_mode", cfg_getstr(config, "data_mode"));
+
     enum emlError ret = drv->init(drvconfig);
 
     assert(ret != EML_ALREADY_INITIALIZED);
@@ -156,17 +173,24 @@ enum emlError emlInit() {
       if (!tmpdevices) {
         free(devices);
         devices = NULL;
+        emlSchedulerShutdown();
         return EML_NO_MEMORY;
       }
       devices = tmpdevices;
 
-      //initialize all driver devices and register them by ID
+      //initialize all driver devices and register them by ID, leaving out
+      //those that cannot be monitored
+      size_t added = 0;
       for (size_t j = 0; j < drv->ndevices; j++) {
-        devices[ndevices + j] = &drv->devices[j];
-        emlDeviceMonitorInit(devices[ndevices + j]);
+        ret = emlDeviceMonitorInit(&drv->devices[j]);
+        if (ret != EML_SUCCESS) {
+          dbglog_warn("Device '%s' disabled: %s", drv->devices[j].name, emlErrorMessage(ret));
+          continue;
+        }
+        devices[ndevices + added++] = &drv->devices[j];
       }
 
-      ndevices += drv->ndevices;
+      ndevices += added;
     }
   }
 
@@ -180,6 +204,10 @@ enum emlError emlShutdown() {
   for (size_t i = 0; i < ndevices; i++)
     emlDeviceMonitorShutdown(devices[i]);
 
+  emlSchedulerShutdown();
+  emlWatchdogShutdown();
+  emlHousekeeperShutdown();
+
   for (size_t i = 0; i < EML_DEVICE_TYPE_COUNT; i++) {
     const struct emlDriver* drv = drivers[i];
 
@@ -197,6 +225,7 @@ enum emlError emlShutdown() {
 
   free(devices);
   devices = NULL;
+  ndevices = 0;
 
   cfg_free(config);
 
@@ -280,16 +309,100 @@ enum emlError emlDeviceStop(
   if (!data)
     return EML_NO_MEMORY;
 
+  //totals are filled in by the monitor
   enum emlError ret = emlDeviceMonitorStop(device, &data);
 
-  if (ret == EML_SUCCESS) {
-    ret = emlDataUpdateTotals(data);
+  if (ret == EML_SUCCESS)
     *result = data;
-  }
 
   return ret;
 }
 
+enum emlError emlDeviceGetLiveTotals(
+    const struct emlDevice* const device,
+    double* const consumed,
+    double* const elapsed,
+    double* const power)
+{
+  if (!devices)
+    return EML_NOT_INITIALIZED;
+  if (!device || !consumed || !elapsed || !power)
+    return EML_INVALID_PARAMETER;
+
+  return emlDeviceMonitorGetLiveTotals(device, consumed, elapsed, power);
+}
+
+enum emlError emlDeviceSubscribe(
+    const struct emlDevice* const device,
+    const emlSampleCallback_t callback,
+    void* const ctx,
+    const size_t decimation,
+    const enum emlDelivery delivery)
+{
+  if (!devices)
+    return EML_NOT_INITIALIZED;
+  if (!device || !callback || !decimation)
+    return EML_INVALID_PARAMETER;
+  if (delivery != EML_DELIVERY_INLINE && delivery != EML_DELIVERY_QUEUED)
+    return EML_INVALID_PARAMETER;
+
+  return emlDeviceMonitorSubscribe(device, callback, ctx, decimation, delivery);
+}
+
+enum emlError emlDeviceUnsubscribe(const struct emlDevice* const device) {
+  if (!devices)
+    return EML_NOT_INITIALIZED;
+  if (!device)
+    return EML_INVALID_PARAMETER;
+
+  return emlDeviceMonitorSubscribe(device, NULL, NULL, 0, EML_DELIVERY_INLINE);
+}
+
+enum emlError emlDeviceSetStream(const struct emlDevice* const device, const int fd) {
+  if (!devices)
+    return EML_NOT_INITIALIZED;
+  if (!device || fd < -1)
+    return EML_INVALID_PARAMETER;
+
+  return emlDeviceMonitorSetStream(device, fd);
+}
+
+enum emlError emlDeviceGetSubscriberDrops(
+    const struct emlDevice* const device,
+    unsigned long long* const drops)
+{
+  if (!devices)
+    return EML_NOT_INITIALIZED;
+  if (!device || !drops)
+    return EML_INVALID_PARAMETER;
+
+  return emlDeviceMonitorGetSubscriberDrops(device, drops);
+}
+
+enum emlError emlDeviceGetOverruns(
+    const struct emlDevice* const device,
+    unsigned long long* const overruns)
+{
+  if (!devices)
+    return EML_NOT_INITIALIZED;
+  if (!device || !overruns)
+    return EML_INVALID_PARAMETER;
+
+  return emlDeviceMonitorGetOverruns(device, overruns);
+}
+
+enum emlError emlDeviceGetDropped(
+    const struct emlDevice* const device,
+    unsigned long long* const dropped)
+{
+  if (!devices)
+    return EML_NOT_INITIALIZED;
+  if (!device || !dropped)
+    return EML_INVALID_PARAMETER;
+
+  return emlDeviceMonitorGetDropped(device, dropped);
+}
+
 enum emlError emlStart() {
   if (!devices)
     return EML_NOT_INITIALIZED;
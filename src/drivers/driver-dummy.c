@@ -76,7 +76,20 @@ static enum emlError measure(size_t devno, unsigned long long* values) {
   assert(devno < dummy_driver.ndevices); // Shouldn't be more than one anyways
 
   values[0] = millitimestamp();
-  values[dummy_driver.default_props->inst_power_field * DATABLOCK_SIZE] = values[0]; 
+  values[dummy_driver.default_props->inst_power_field] = values[0]; 
+  return EML_SUCCESS;
+}
+
+static enum emlError measure_all(unsigned long long* values, size_t ndevices) {
+  assert(dummy_driver.initialized);
+  assert(ndevices <= dummy_driver.ndevices);
+
+  const unsigned long long now = millitimestamp();
+  for (size_t i = 0; i < ndevices; i++) {
+    unsigned long long* devvalues = values + i * EML_DATAPOINT_MAX_FIELDS;
+    devvalues[0] = now;
+    devvalues[dummy_driver.default_props->inst_power_field] = now;
+  }
   return EML_SUCCESS;
 }
 
@@ -92,6 +105,7 @@ static struct emlDataProperties default_props = {
 static cfg_opt_t cfgopts[] = {
   CFG_BOOL("disabled", cfg_true, CFGF_NONE),
   CFG_INT("sampling_interval", DUMMY_DEFAULT_SAMPLING_INTERVAL, CFGF_NONE),
+  EML_MONITOR_CFGOPTS,
   CFG_END()
 };
 
@@ -107,4 +121,5 @@ struct emlDriver dummy_driver = {
   .init = &init,
   .shutdown = &shutdown,
   .measure = &measure,
+  .measure_all = &measure_all,
 };
@@ -287,7 +287,7 @@ static enum emlError measure(size_t devno, unsigned long long* values) {
     goto err_free;
 
   values[0] = nanotimestamp();
-  values[labee_driver.default_props->inst_power_field * DATABLOCK_SIZE] = power; 
+  values[labee_driver.default_props->inst_power_field] = power; 
 
   free_xml(xc);
   return EML_SUCCESS;
@@ -312,6 +312,7 @@ static struct emlDataProperties default_props = {
 static cfg_opt_t cfgopts[] = {
   CFG_BOOL(LABEE_STATUS_CFG, LABEE_DEFAULT_STATUS, CFGF_NONE),
   CFG_INT(LABEE_SAMPLING_INTERVAL_CFG, LABEE_DEFAULT_SAMPLING_INTERVAL, CFGF_NONE),
+  EML_MONITOR_CFGOPTS,
   CFG_STR(LABEE_API_URL_CFG, LABEE_DEFAULT_API_URL, CFGF_NONE),
   CFG_STR(LABEE_HOSTNAME_CFG, "", CFGF_NONE),
   CFG_STR(LABEE_NODELIST_FILENAME_CFG, "./nodelist", CFGF_NONE),
@@ -261,7 +261,7 @@ static enum emlError measure(size_t devno, unsigned long long* values) {
     dbglog_error("mic_get_inst_power_readings: %s", dl_mic_get_error_string());
     return EML_UNKNOWN;
   }
-  values[mic_driver.default_props->inst_power_field * DATABLOCK_SIZE] = power;
+  values[mic_driver.default_props->inst_power_field] = power;
 
   dl_mic_free_power_utilization_info(power_info);
   if (ret != E_MIC_SUCCESS) {
@@ -283,6 +283,7 @@ static const struct emlDataProperties default_props = {
 static cfg_opt_t cfgopts[] = {
   CFG_BOOL("disabled", cfg_false, CFGF_NONE),
   CFG_INT("sampling_interval", MIC_DEFAULT_SAMPLING_INTERVAL, CFGF_NONE),
+  EML_MONITOR_CFGOPTS,
   CFG_END()
 };
 
@@ -246,7 +246,7 @@ static enum emlError measure(size_t devno, unsigned long long* values) {
   else if (!power) {
     dbglog_warn("nvmlDeviceGetPowerUsage returned 0, no error code");
   }
-  values[nvml_driver.default_props->inst_power_field * DATABLOCK_SIZE] = power;
+  values[nvml_driver.default_props->inst_power_field] = power;
 
   return EML_SUCCESS;
 }
@@ -263,6 +263,7 @@ static const struct emlDataProperties default_props = {
 static cfg_opt_t cfgopts[] = {
   CFG_BOOL("disabled", cfg_false, CFGF_NONE),
   CFG_INT("sampling_interval", NVML_DEFAULT_SAMPLING_INTERVAL, CFGF_NONE),
+  EML_MONITOR_CFGOPTS,
   CFG_END()
 };
 
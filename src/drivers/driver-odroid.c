@@ -238,7 +238,7 @@ static enum emlError measure(size_t devno, unsigned long long* values) {
       return err; 
     power += aux;
   }
-  values[odroid_driver.default_props->inst_power_field * DATABLOCK_SIZE] = power; 
+  values[odroid_driver.default_props->inst_power_field] = power; 
   return EML_SUCCESS;
 }
 
@@ -254,6 +254,7 @@ static struct emlDataProperties default_props = {
 static cfg_opt_t cfgopts[] = {
   CFG_BOOL("disabled", cfg_false, CFGF_NONE),
   CFG_INT("sampling_interval", ODROID_DEFAULT_SAMPLING_INTERVAL, CFGF_NONE),
+  EML_MONITOR_CFGOPTS,
   CFG_END()
 };
 
@@ -401,6 +401,25 @@ static enum emlError shutdown_pmlib() {
 }
 
 
+//reads all outlet measurements from a device (msglock must be held)
+static void pmlib_read_outlets(struct pmlibstate* const state) {
+    pmlib_read_int(state); // Read num lines, required by the pmlib server every time
+    for (int i = 0; i < state->n_outlets; i++) {
+        // PMlib also requires reading all lines sequentially
+        state->last_measurement[i] = pmlib_read_double(state);
+    }
+    state->last_timestamp = millitimestamp();
+}
+
+//reads all outlet measurements from a device, unless the last ones are still
+//fresh (msglock must be held)
+static void pmlib_refresh_outlets(struct pmlibstate* const state) {
+    unsigned long long now = millitimestamp();
+    if (!state->last_timestamp || (now - state->last_timestamp) > measurement_interval) {
+        pmlib_read_outlets(state);
+    }
+}
+
 static enum emlError measure(size_t devno, unsigned long long *values) {
     assert(pmlib_driver.initialized);
     assert(devno < pmlib_driver.ndevices); // Shouldn't be more than one anyways
@@ -409,20 +428,36 @@ static enum emlError measure(size_t devno, unsigned long long *values) {
 
     //only actually query the pdu if there is no fresh block
     pthread_mutex_lock(&pmlibstate[pduno]->connection.msglock);
-    unsigned long long now = millitimestamp();
-    if (!pmlibstate[pduno]->last_timestamp || (now - pmlibstate[pduno]->last_timestamp) > measurement_interval) {
-        pmlib_read_int(pmlibstate[pduno]); // Read num lines, required by the pmlib server every time
-        for (int i = 0; i < pmlibstate[pduno]->n_outlets; i++) {
-            // PMlib also requires reading all lines sequentially
-            pmlibstate[pduno]->last_measurement[i] = pmlib_read_double(pmlibstate[pduno]);
-        }
-        pmlibstate[pduno]->last_timestamp = millitimestamp();
-    }
-    pthread_mutex_unlock(&pmlibstate[pduno]->connection.msglock);
+    pmlib_refresh_outlets(pmlibstate[pduno]);
 
     values[0] = pmlibstate[pduno]->last_timestamp;
 
-    values[pmlib_driver.default_props->inst_power_field * DATABLOCK_SIZE] = pmlibstate[pduno]->last_measurement[outlet];
+    values[pmlib_driver.default_props->inst_power_field] = pmlibstate[pduno]->last_measurement[outlet];
+    pthread_mutex_unlock(&pmlibstate[pduno]->connection.msglock);
+
+    return EML_SUCCESS;
+}
+
+static enum emlError measure_all(unsigned long long *values, size_t ndevices) {
+    assert(pmlib_driver.initialized);
+    assert(ndevices <= pmlib_driver.ndevices);
+
+    //one pass per pmlib device covers all of its outlets, which are numbered in order
+    //(devices with fresh measurements are not read again, as in measure)
+    size_t devno = 0;
+    for (size_t pduno = 0; pduno < pmlib_distinct_devices && devno < ndevices; pduno++) {
+        struct pmlibstate* const state = pmlibstate[pduno];
+
+        pthread_mutex_lock(&state->connection.msglock);
+        pmlib_refresh_outlets(state);
+
+        for (; devno < ndevices && devstate[devno].pdu == pduno; devno++) {
+            unsigned long long *devvalues = values + devno * EML_DATAPOINT_MAX_FIELDS;
+            devvalues[0] = state->last_timestamp;
+            devvalues[pmlib_driver.default_props->inst_power_field] = state->last_measurement[devstate[devno].outlet];
+        }
+        pthread_mutex_unlock(&state->connection.msglock);
+    }
 
     return EML_SUCCESS;
 }
@@ -451,6 +486,7 @@ static cfg_opt_t deviceopts[] = {
 static cfg_opt_t cfgopts[] = {
         CFG_BOOL("disabled", cfg_false, CFGF_NONE),
         CFG_INT("sampling_interval", PMLIB_DEFAULT_SAMPLING_INTERVAL, CFGF_NONE),
+        EML_MONITOR_CFGOPTS,
         CFG_SEC("device", deviceopts, CFGF_MULTI | CFGF_TITLE | CFGF_NO_TITLE_DUPES),
         CFG_END()
 };
@@ -467,4 +503,5 @@ struct emlDriver pmlib_driver = {
         .init = &init,
         .shutdown = &shutdown_pmlib, // shutdown exists in socket.h
         .measure = &measure,
+        .measure_all = &measure_all,
 };
@@ -12,7 +12,9 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -35,8 +37,19 @@ struct emlDriver rapl_driver;
 //MSR_PKG_ENERGY_STATUS is updated every ~1ms
 #define RAPL_DEFAULT_SAMPLING_INTERVAL 1000000L
 
+//sampling_interval value for "auto": derived from package power limits
+#define RAPL_AUTO_SAMPLING_INTERVAL -1L
+
+//power may exceed TDP for a while (turbo), so auto intervals assume this
+//much more than the highest power limit
+#define RAPL_AUTO_POWER_MARGIN 2
+
+//powercap zones are exposed by the Linux intel_rapl driver (also on AMD)
+#define RAPL_DEFAULT_POWERCAP_ROOT "/sys/class/powercap"
+
 static const size_t MSR_SIZE = 8;
 static const unsigned long long WRAP_VALUE = 1ULL << 32;
+static const unsigned long long NO_ENERGY = ~0ULL;
 
 struct msr_config {
   //Units register
@@ -68,6 +81,12 @@ struct msr_config {
   off_t ENERGY_UNIT_MASK;
   off_t TIME_UNIT_OFFSET;
   off_t TIME_UNIT_MASK;
+
+  //MSR_PKG_POWER_INFO fields
+  off_t THERMAL_SPEC_POWER_OFFSET;
+  off_t THERMAL_SPEC_POWER_MASK;
+  off_t MAXIMUM_POWER_OFFSET;
+  off_t MAXIMUM_POWER_MASK;
 };
 
 static const struct msr_config default_msr_config = {
@@ -93,15 +112,48 @@ static const struct msr_config default_msr_config = {
   .ENERGY_UNIT_MASK = 0x1F00,
   .TIME_UNIT_OFFSET = 0x10,
   .TIME_UNIT_MASK = 0xF000,
+  .THERMAL_SPEC_POWER_OFFSET = 0x0,
+  .THERMAL_SPEC_POWER_MASK = 0x7FFF,
+  .MAXIMUM_POWER_OFFSET = 0x20,
+  .MAXIMUM_POWER_MASK = 0x7FFF00000000,
 };
 
+//RAPL domain measured as a device
+struct rapl_domain {
+  //suffix for the device name
+  const char* suffix;
+  //package the domain belongs to
+  size_t package;
+  //energy status register (MSR backend)
+  off_t msr;
+  //open energy_uj file (powercap backend, -1 otherwise)
+  int fd;
+  //left shift from domain energy units to driver energy units
+  unsigned int shift;
+  //energy counter readings wrap around at this value
+  unsigned long long range;
+  //last energy counter reading (NO_ENERGY if none yet)
+  unsigned long long prev_energy;
+  //highest power limit of the package, in Watts (package domains only, 0 if
+  //unknown)
+  double max_power;
+};
+
+//names of the domains below packages, in device order, along with the
+//names of their powercap zones
+static const char* const plane_names[] = { "pp0", "pp1", "dram" };
+static const char* const plane_zones[] = { "core", "uncore", "dram" };
+static const size_t nplanes = sizeof(plane_names) / sizeof(*plane_names);
+
 //local state
+static int use_powercap;
+static const char* system_root;
 static int* msrfd;
+static size_t nmsrfds;
 static size_t npackages;
-static size_t ncores;
-static size_t* package_for_core;
+static size_t cpu_model;
 static size_t* core_from_package;
-static unsigned long long* prev_energy;
+static struct rapl_domain* domains;
 static const struct msr_config* cfg = &default_msr_config;
 
 //unit scaling divisors from MSR_RAPL_POWER_UNIT
@@ -111,14 +163,18 @@ static unsigned int power_divisor = 1 << 0x3;
 static unsigned int energy_divisor = 1 << 0x10;
 static unsigned int time_divisor = 1 << 0xA;
 
+//server models count DRAM energy in fixed units of 15.3uJ instead
+static const unsigned int DRAM_SERVER_ENERGY_UNIT = 0x10;
+
 static struct emlDataProperties default_props;
 
-static enum emlError open_msr(size_t core) {
+//opens the MSR device of the core representing a package
+static enum emlError open_msr(size_t pkg) {
   char filename[BUFSIZ];
-  snprintf(filename, sizeof(filename), "/dev/cpu/%zu/msr", core);
+  snprintf(filename, sizeof(filename), "%s/dev/cpu/%zu/msr", system_root, core_from_package[pkg]);
 
-  msrfd[core] = open(filename, O_RDONLY);
-  if (msrfd[core] < 0) {
+  msrfd[pkg] = open(filename, O_RDONLY);
+  if (msrfd[pkg] < 0) {
     if (errno == ENXIO || errno == EIO)
       return EML_UNSUPPORTED;
     else if (errno == EACCES)
@@ -130,8 +186,31 @@ static enum emlError open_msr(size_t core) {
   return EML_SUCCESS;
 }
 
-static int read_msr(size_t core, off_t offset, unsigned long long* value) {
-  return (pread(msrfd[core], value, MSR_SIZE, offset) != (ssize_t) MSR_SIZE);
+static int read_msr(size_t pkg, off_t offset, unsigned long long* value) {
+  return (pread(msrfd[pkg], value, MSR_SIZE, offset) != (ssize_t) MSR_SIZE);
+}
+
+//reads the first line of a file under a root directory, dropping the
+//trailing newline
+static int read_attr(
+    const char* root,
+    const char* dir,
+    const char* attr,
+    char* buffer,
+    size_t size)
+{
+  char path[BUFSIZ];
+  snprintf(path, sizeof(path), "%s/%s/%s", root, dir, attr);
+  FILE* file = fopen(path, "r");
+  if (!file)
+    return 1;
+
+  const char* pos = fgets(buffer, size, file);
+  fclose(file);
+  if (!pos)
+    return 1;
+  buffer[strcspn(buffer, "\n")] = '\0';
+  return 0;
 }
 
 static int parse_size(const char* from, size_t* to) {
@@ -147,27 +226,27 @@ static int parse_size(const char* from, size_t* to) {
   return 0;
 }
 
-static int is_cpu_model_supported(int model) {
-  enum cpu_model {
-    CPU_SANDYBRIDGE = 42,
-    CPU_SANDYBRIDGE_EP = 45,
-    CPU_IVYBRIDGE = 58,
-    CPU_IVYBRIDGE_EP = 62,
-    CPU_HASWELL_1 = 60,
-    CPU_HASWELL_2 = 69,
-    CPU_HASWELL_3 = 70,
-    CPU_HASWELL_EP = 63,
-    CPU_BROADWELL_1 = 61,
-    CPU_BROADWELL_2 = 71,
-    CPU_BROADWELL_EP = 79,
-    CPU_BROADWELL_DE = 86,
-    CPU_SKYLAKE_1 = 78,
-    CPU_SKYLAKE_2 = 94,
-    CPU_SKYLAKE_3 = 85,
-    CPU_KABYLAKE_1 = 142,
-    CPU_KABYLAKE_2 = 158,
-  };
+enum cpu_model {
+  CPU_SANDYBRIDGE = 42,
+  CPU_SANDYBRIDGE_EP = 45,
+  CPU_IVYBRIDGE = 58,
+  CPU_IVYBRIDGE_EP = 62,
+  CPU_HASWELL_1 = 60,
+  CPU_HASWELL_2 = 69,
+  CPU_HASWELL_3 = 70,
+  CPU_HASWELL_EP = 63,
+  CPU_BROADWELL_1 = 61,
+  CPU_BROADWELL_2 = 71,
+  CPU_BROADWELL_EP = 79,
+  CPU_BROADWELL_DE = 86,
+  CPU_SKYLAKE_1 = 78,
+  CPU_SKYLAKE_2 = 94,
+  CPU_SKYLAKE_3 = 85,
+  CPU_KABYLAKE_1 = 142,
+  CPU_KABYLAKE_2 = 158,
+};
 
+static int is_cpu_model_supported(int model) {
   switch(model) {
     case CPU_SANDYBRIDGE:
     case CPU_SANDYBRIDGE_EP:
@@ -192,6 +271,17 @@ static int is_cpu_model_supported(int model) {
   }
 }
 
+static int has_server_dram_unit(int model) {
+  switch(model) {
+    case CPU_HASWELL_EP:
+    case CPU_BROADWELL_EP:
+    case CPU_SKYLAKE_3:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
 static enum emlError find_supported_cpu() {
   const unsigned int supported_family = 6;
   const char supported_vendor[] = "GenuineIntel";
@@ -202,18 +292,21 @@ static enum emlError find_supported_cpu() {
   char buffer[BUFSIZ];
   enum emlError err;
 
-  const char* filename = "/proc/cpuinfo";
+  char filename[BUFSIZ];
+  snprintf(filename, sizeof(filename), "%s/proc/cpuinfo", system_root);
   FILE* file = fopen(filename, "r");
   if (!file) {
     err = EML_UNSUPPORTED;
     snprintf(rapl_driver.failed_reason, sizeof(rapl_driver.failed_reason),
-        "%s: %s", emlErrorMessage(err), filename);
+        "%s: %s/proc/cpuinfo", emlErrorMessage(err), system_root);
     return err;
   }
 
+  //every processor is the same model, so the first one is enough
   const char* line;
+  int seen = 0;
   err = EML_SUCCESS;
-  while ((line = fgets(buffer, sizeof(buffer), file))) {
+  while (seen != 0x7 && (line = fgets(buffer, sizeof(buffer), file))) {
     size_t fldlen = 0;
 
     //find separator and key length
@@ -233,11 +326,13 @@ static enum emlError find_supported_cpu() {
     //skip this line if no value
     if (!*p) continue;
 
-    if (!strncmp(line, vendorfld, fldlen))
+    if (!strncmp(line, vendorfld, fldlen)) {
       if (strncmp(p, supported_vendor, sizeof(supported_vendor)-1)) {
         err = EML_UNSUPPORTED_HARDWARE;
         break;
       }
+      seen |= 0x1;
+    }
 
     if (!strncmp(line, familyfld, fldlen)) {
       size_t family;
@@ -246,6 +341,7 @@ static enum emlError find_supported_cpu() {
         err = EML_UNSUPPORTED_HARDWARE;
         break;
       }
+      seen |= 0x2;
     }
 
     if (!strncmp(line, modelfld, fldlen)) {
@@ -255,6 +351,8 @@ static enum emlError find_supported_cpu() {
         err = EML_UNSUPPORTED_HARDWARE;
         break;
       }
+      cpu_model = model;
+      seen |= 0x4;
     }
   }
 
@@ -262,142 +360,589 @@ static enum emlError find_supported_cpu() {
   return err;
 }
 
+//parses the next range of a CPU list such as "0-3,8,10-11" (see cpuset(7)),
+//returning 1 if a range was found, 0 at the end of the list and -1 on error
+static int next_cpu_range(const char** list, size_t* first, size_t* last) {
+  const char* pos = *list;
+  if (*pos == ',')
+    pos++;
+  if (*pos == '\0' || *pos == '\n')
+    return 0;
+
+  char* endptr;
+  errno = 0;
+  *first = strtoul(pos, &endptr, 10);
+  if (errno == ERANGE || endptr == pos || !isdigit(*pos))
+    return -1;
+  *last = *first;
+  if (*endptr == '-') {
+    pos = endptr + 1;
+    *last = strtoul(pos, &endptr, 10);
+    if (errno == ERANGE || endptr == pos || !isdigit(*pos) || *last < *first)
+      return -1;
+  }
+  if (*endptr != '\0' && *endptr != ',' && *endptr != '\n')
+    return -1;
+
+  *list = endptr;
+  return 1;
+}
+
+//finds a representative CPU for each package, skipping the other CPUs of
+//each package found (so only a couple of files are read per package)
 static enum emlError get_cpu_topology() {
   enum emlError err;
-  char buffer[BUFSIZ - 2];
-  FILE* file;
-  const char* pos;
+  char buffer[BUFSIZ];
+  char dir[BUFSIZ];
 
-  const char* filename = "/sys/devices/system/cpu/present";
-  file = fopen(filename, "r");
-  if (!file) {
+  //present CPUs may be sparse, or offline
+  if (read_attr(system_root, "sys/devices/system/cpu", "present", buffer, sizeof(buffer))) {
     err = EML_UNSUPPORTED;
     snprintf(rapl_driver.failed_reason, sizeof(rapl_driver.failed_reason),
-        "%s: %s", emlErrorMessage(err), filename);
+        "%s: %s/sys/devices/system/cpu/present", emlErrorMessage(err), system_root);
     return err;
   }
 
-  pos = fgets(buffer, sizeof(buffer), file);
-  fclose(file);
-  if (!pos)
-    return EML_PARSING_ERROR;
-
-  //skip to start of last present CPU
-  pos = strchr(pos, '-');
-  if (!pos)
-    return EML_PARSING_ERROR;
-  pos++;
-
-  int fmterr = parse_size(pos, &ncores);
-  if (fmterr || !ncores)
+  size_t maxcpu = 0;
+  size_t first, last;
+  const char* pos = buffer;
+  int found;
+  while ((found = next_cpu_range(&pos, &first, &last)) > 0) {
+    if (last > maxcpu)
+      maxcpu = last;
+  }
+  if (found < 0 || pos == buffer)
     return EML_PARSING_ERROR;
 
-  int package_found[ncores];
-  for (size_t i = 0; i < ncores; i++)
-    package_found[i] = 0;
-
-  msrfd = malloc(ncores * sizeof(*msrfd));
-  package_for_core = malloc(ncores * sizeof(*package_for_core));
-  core_from_package = malloc(ncores * sizeof(*core_from_package));
-  if (!msrfd || !package_for_core || !core_from_package) {
+  unsigned char* covered = calloc(maxcpu + 1, sizeof(*covered));
+  size_t* package_ids = malloc((maxcpu + 1) * sizeof(*package_ids));
+  core_from_package = malloc((maxcpu + 1) * sizeof(*core_from_package));
+  if (!covered || !package_ids || !core_from_package) {
     err = EML_NO_MEMORY;
     goto err_free;
   }
 
   npackages = 0;
-  for (size_t i = 0; i < ncores; i++) {
-    snprintf(buffer, sizeof(buffer),
-        "/sys/devices/system/cpu/cpu%zu/topology/physical_package_id", i);
-    file = fopen(buffer, "r");
-    if (!file) {
-      err = EML_UNSUPPORTED;
-      snprintf(rapl_driver.failed_reason, sizeof(rapl_driver.failed_reason),
-          "%s: %s", emlErrorMessage(err), buffer);
-      goto err_free;
-    }
-
-    pos = fgets(buffer, sizeof(buffer), file);
-    fclose(file);
-    if (!pos) {
-      err = EML_PARSING_ERROR;
-      goto err_free;
-    }
+  pos = buffer;
+  while (next_cpu_range(&pos, &first, &last) > 0) {
+    for (size_t cpu = first; cpu <= last; cpu++) {
+      if (covered[cpu])
+        continue;
+      covered[cpu] = 1;
+
+      //offline CPUs have no topology, and their MSRs cannot be read
+      char value[BUFSIZ];
+      snprintf(dir, sizeof(dir), "sys/devices/system/cpu/cpu%zu/topology", cpu);
+      if (read_attr(system_root, dir, "physical_package_id", value, sizeof(value)))
+        continue;
+
+      size_t pkg;
+      if (parse_size(value, &pkg)) {
+        err = EML_PARSING_ERROR;
+        goto err_free;
+      }
 
-    size_t pkg;
-    int fmterr = parse_size(pos, &pkg);
-    if (fmterr) {
-      err = EML_PARSING_ERROR;
-      goto err_free;
-    }
+      //skip the other CPUs in the package (package_cpus_list is only
+      //available on recent kernels)
+      if (!read_attr(system_root, dir, "package_cpus_list", value, sizeof(value))
+          || !read_attr(system_root, dir, "core_siblings_list", value, sizeof(value)))
+      {
+        const char* siblings = value;
+        size_t sfirst, slast;
+        while (next_cpu_range(&siblings, &sfirst, &slast) > 0) {
+          for (size_t sibling = sfirst; sibling <= slast && sibling <= maxcpu; sibling++)
+            covered[sibling] = 1;
+        }
+      }
 
-    if (!package_found[pkg]) {
-      package_for_core[i] = pkg;
-      core_from_package[pkg] = i;
-      package_found[pkg] = 1;
+      //keep packages sorted by id, so device numbers follow them
+      size_t i = npackages;
+      while (i && package_ids[i - 1] > pkg)
+        i--;
+      if (i && package_ids[i - 1] == pkg)
+        continue;
+      memmove(&package_ids[i + 1], &package_ids[i], (npackages - i) * sizeof(*package_ids));
+      memmove(&core_from_package[i + 1], &core_from_package[i],
+          (npackages - i) * sizeof(*core_from_package));
+      package_ids[i] = pkg;
+      core_from_package[i] = cpu;
       npackages++;
     }
   }
 
-  prev_energy = malloc(npackages * sizeof(*prev_energy));
-  if (!prev_energy) {
+  if (!npackages) {
+    err = EML_UNSUPPORTED;
+    snprintf(rapl_driver.failed_reason, sizeof(rapl_driver.failed_reason),
+        "%s: no CPU topology found", emlErrorMessage(err));
+    goto err_free;
+  }
+
+  msrfd = malloc(npackages * sizeof(*msrfd));
+  if (!msrfd) {
     err = EML_NO_MEMORY;
-    goto err_free_2;
+    goto err_free;
   }
-  for (size_t i = 0; i < npackages; i++)
-    prev_energy[i] = WRAP_VALUE;
 
+  free(covered);
+  free(package_ids);
   return EML_SUCCESS;
 
-err_free_2:
-  free(prev_energy);
-
 err_free:
-  free(msrfd);
-  free(package_for_core);
+  free(covered);
+  free(package_ids);
   free(core_from_package);
+  core_from_package = NULL;
 
   return err;
 }
 
-static enum emlError init(cfg_t* const config) {
-  assert(!rapl_driver.initialized);
-  assert(config);
-  rapl_driver.config = config;
+//highest of TDP and maximum power for a package, in Watts (0 if unknown)
+static double msr_package_power(size_t pkg) {
+  unsigned long long info;
+  if (read_msr(pkg, cfg->MSR_PKG_POWER_INFO, &info))
+    return 0;
+
+  const unsigned long long tdp =
+    (info & cfg->THERMAL_SPEC_POWER_MASK) >> cfg->THERMAL_SPEC_POWER_OFFSET;
+  const unsigned long long maximum =
+    (info & cfg->MAXIMUM_POWER_MASK) >> cfg->MAXIMUM_POWER_OFFSET;
+  return (double) (maximum > tdp ? maximum : tdp) / power_divisor;
+}
 
+//finds the domains to be measured as devices: every package, followed by
+//the other domains available on each package (enabled from configuration),
+//so that package device numbers do not depend on the hardware
+static enum emlError probe_domains(cfg_t* const config, const unsigned int energy_unit) {
+  const off_t plane_msrs[] = {
+    cfg->MSR_PP0_ENERGY_STATUS,
+    cfg->MSR_PP1_ENERGY_STATUS,
+    cfg->MSR_DRAM_ENERGY_STATUS,
+  };
+
+  domains = malloc(npackages * (1 + nplanes) * sizeof(*domains));
+  if (!domains)
+    return EML_NO_MEMORY;
+
+  //domain units are kept in shift until the driver unit is known
+  size_t ndomains = 0;
+  for (size_t pkg = 0; pkg < npackages; pkg++) {
+    struct rapl_domain domain = {
+      .suffix = NULL,
+      .package = pkg,
+      .msr = cfg->MSR_PKG_ENERGY_STATUS,
+      .fd = -1,
+      .shift = energy_unit,
+      .range = WRAP_VALUE,
+      .prev_energy = NO_ENERGY,
+      .max_power = msr_package_power(pkg),
+    };
+    domains[ndomains++] = domain;
+  }
+
+  for (size_t pkg = 0; pkg < npackages; pkg++) {
+    for (size_t p = 0; p < nplanes; p++) {
+      if (!cfg_getbool(config, plane_names[p]))
+        continue;
+
+      //domains not implemented fail to read or never count
+      unsigned long long energy;
+      if (read_msr(pkg, plane_msrs[p], &energy)
+          || !(energy & (WRAP_VALUE - 1)))
+        continue;
+
+      struct rapl_domain domain = {
+        .suffix = plane_names[p],
+        .package = pkg,
+        .msr = plane_msrs[p],
+        .fd = -1,
+        .shift = energy_unit,
+        .range = WRAP_VALUE,
+        .prev_energy = NO_ENERGY,
+        .max_power = 0,
+      };
+      if (plane_msrs[p] == cfg->MSR_DRAM_ENERGY_STATUS && has_server_dram_unit(cpu_model))
+        domain.shift = DRAM_SERVER_ENERGY_UNIT;
+      domains[ndomains++] = domain;
+    }
+  }
+
+  //energy is reported in the smallest unit of all domains, as units are
+  //powers of 2 and values in larger units can be converted exactly
+  unsigned int unit = 0;
+  for (size_t i = 0; i < ndomains; i++) {
+    if (domains[i].shift > unit)
+      unit = domains[i].shift;
+  }
+  for (size_t i = 0; i < ndomains; i++)
+    domains[i].shift = unit - domains[i].shift;
+  energy_divisor = 1 << unit;
+
+  rapl_driver.ndevices = ndomains;
+  return EML_SUCCESS;
+}
+
+static enum emlError init_msr(cfg_t* const config) {
   enum emlError err;
 
   err = find_supported_cpu();
   if (err != EML_SUCCESS)
-    goto error;
+    return err;
 
   err = get_cpu_topology();
   if (err != EML_SUCCESS)
-    goto error;
+    return err;
 
-  for (size_t i = 0; i < ncores; i++) {
-    err = open_msr(i);
+  //only the core representing each package is ever read
+  for (nmsrfds = 0; nmsrfds < npackages; nmsrfds++) {
+    err = open_msr(nmsrfds);
     if (err != EML_SUCCESS) {
       snprintf(rapl_driver.failed_reason, sizeof(rapl_driver.failed_reason),
-          "open_msr(%zu): %s", i, strerror(errno));
-      goto err_free;
+          "open_msr(%zu): %s", core_from_package[nmsrfds], strerror(errno));
+      goto err_close;
     }
   }
 
   unsigned long long units;
   int read_error = read_msr(0, cfg->MSR_RAPL_POWER_UNIT, &units);
   if (read_error) {
+    err = EML_UNKNOWN;
     snprintf(rapl_driver.failed_reason, sizeof(rapl_driver.failed_reason),
         "read_msr(0, MSR_RAPL_POWER_UNIT): %s", strerror(errno));
-    goto err_free;
+    goto err_close;
   }
 
   power_divisor = 1 << ((units & cfg->POWER_UNIT_MASK) >> cfg->POWER_UNIT_OFFSET);
-  energy_divisor = 1 << ((units & cfg->ENERGY_UNIT_MASK) >> cfg->ENERGY_UNIT_OFFSET);
   time_divisor = 1 << ((units & cfg->TIME_UNIT_MASK) >> cfg->TIME_UNIT_OFFSET);
 
+  err = probe_domains(config, (units & cfg->ENERGY_UNIT_MASK) >> cfg->ENERGY_UNIT_OFFSET);
+  if (err != EML_SUCCESS)
+    goto err_close;
+
   default_props.energy_factor = -energy_divisor;
+  return EML_SUCCESS;
+
+err_close:
+  for (size_t i = 0; i < nmsrfds; i++)
+    close(msrfd[i]);
+  free(domains);
+  domains = NULL;
+  free(msrfd);
+  msrfd = NULL;
+  free(core_from_package);
+  core_from_package = NULL;
+  nmsrfds = 0;
+
+  return err;
+}
 
-  rapl_driver.ndevices = npackages;
+static int open_attr(const char* root, const char* zone, const char* attr) {
+  char path[BUFSIZ];
+  snprintf(path, sizeof(path), "%s/%s/%s", root, zone, attr);
+  return open(path, O_RDONLY);
+}
+
+static int parse_ull(const char* from, unsigned long long* to) {
+  char* endptr;
+  errno = 0;
+  *to = strtoull(from, &endptr, 10);
+  if (errno == ERANGE || endptr == from)
+    return 1;
+  //we only accept a trailing \n, for convenience
+  if (*endptr != '\0' && *endptr != '\n')
+    return 1;
+  return 0;
+}
+
+//reads an energy counter from a file kept open
+static int read_energy_uj(int fd, unsigned long long* value) {
+  char buffer[32];
+  ssize_t len = pread(fd, buffer, sizeof(buffer) - 1, 0);
+  if (len <= 0)
+    return 1;
+  buffer[len] = '\0';
+  return parse_ull(buffer, value);
+}
+
+//opens a powercap zone as a domain
+static enum emlError open_zone(
+    const char* root,
+    const char* zone,
+    struct rapl_domain* domain)
+{
+  char buffer[BUFSIZ];
+  unsigned long long range;
+  if (read_attr(root, zone, "max_energy_range_uj", buffer, sizeof(buffer))
+      || parse_ull(buffer, &range) || !range)
+    return EML_UNSUPPORTED;
+
+  //energy_uj is only readable by root on recent kernels, unless permissions
+  //are changed by the administrator
+  int fd = open_attr(root, zone, "energy_uj");
+  if (fd < 0) {
+    const int err = errno;
+    snprintf(rapl_driver.failed_reason, sizeof(rapl_driver.failed_reason),
+        "%s/energy_uj: %s", zone, strerror(err));
+    return err == EACCES ? EML_NO_PERMISSION : EML_UNSUPPORTED;
+  }
+
+  //readings go from 0 to range, and the last step before wrapping around is
+  //lost (a single counter unit)
+  domain->msr = 0;
+  domain->fd = fd;
+  domain->shift = 0;
+  domain->range = range;
+  domain->prev_energy = NO_ENERGY;
+  domain->max_power = 0;
+  return EML_SUCCESS;
+}
+
+//highest power limit set on a powercap zone (long and short term), in Watts
+//(0 if unknown)
+static double powercap_zone_power(const char* root, const char* zone) {
+  static const char* const attrs[] = { "power_limit_uw", "max_power_uw" };
+
+  unsigned long long maximum = 0;
+  char attr[64];
+  char buffer[BUFSIZ];
+  for (int constraint = 0; constraint < 3; constraint++) {
+    for (size_t i = 0; i < sizeof(attrs) / sizeof(*attrs); i++) {
+      unsigned long long power;
+      snprintf(attr, sizeof(attr), "constraint_%d_%s", constraint, attrs[i]);
+      if (!read_attr(root, zone, attr, buffer, sizeof(buffer))
+          && !parse_ull(buffer, &power) && power > maximum)
+        maximum = power;
+    }
+  }
+  return maximum / 1e6;
+}
+
+//parses the name of a top-level powercap zone, package-P or package-P-die-D
+//for each die of multi-die packages
+static int parse_package_zone(char* name, size_t* package, size_t* die) {
+  if (strncmp(name, "package-", 8))
+    return 1;
+
+  *die = 0;
+  char* diename = strstr(name + 8, "-die-");
+  if (diename) {
+    *diename = '\0';
+    if (parse_size(diename + 5, die))
+      return 1;
+  }
+  return parse_size(name + 8, package);
+}
+
+//finds package zones (intel-rapl:N, named package-P or package-P-die-D) and
+//the zones below them (intel-rapl:N:M) under the powercap root, in the same
+//device order as MSR domains. Each die gets its own package slot, and slots
+//are numbered in package and die order, skipping missing package numbers.
+static enum emlError init_powercap(cfg_t* const config) {
+  const char* root = cfg_getstr(config, "powercap_root");
+  DIR* dir = opendir(root);
+  if (!dir) {
+    snprintf(rapl_driver.failed_reason, sizeof(rapl_driver.failed_reason),
+        "%s: %s", root, strerror(errno));
+    return EML_UNSUPPORTED;
+  }
+
+  //find the package and die for each top-level zone
+  enum { MAX_ZONES = 256 };
+  size_t zone_package[MAX_ZONES];
+  size_t zone_die[MAX_ZONES];
+  int zone_found[MAX_ZONES] = {0};
+  npackages = 0;
+
+  char buffer[BUFSIZ];
+  const struct dirent* entry;
+  while ((entry = readdir(dir))) {
+    unsigned int zone;
+    char extra;
+    if (sscanf(entry->d_name, "intel-rapl:%u%c", &zone, &extra) != 1 || zone >= MAX_ZONES)
+      continue;
+
+    size_t pkg, die;
+    if (read_attr(root, entry->d_name, "name", buffer, sizeof(buffer))
+        || parse_package_zone(buffer, &pkg, &die))
+      continue;
+
+    zone_package[zone] = pkg;
+    zone_die[zone] = die;
+    zone_found[zone] = 1;
+  }
+
+  //number package slots by package and die, ignoring duplicate zones
+  size_t zone_slot[MAX_ZONES];
+  for (size_t zone = 0; zone < MAX_ZONES; zone++) {
+    for (size_t other = 0; other < zone && zone_found[zone]; other++) {
+      if (zone_found[other] && zone_package[other] == zone_package[zone]
+          && zone_die[other] == zone_die[zone])
+        zone_found[zone] = 0;
+    }
+  }
+  for (size_t zone = 0; zone < MAX_ZONES; zone++) {
+    if (!zone_found[zone])
+      continue;
+
+    zone_slot[zone] = 0;
+    for (size_t other = 0; other < MAX_ZONES; other++) {
+      if (zone_found[other] && (zone_package[other] < zone_package[zone]
+            || (zone_package[other] == zone_package[zone] && zone_die[other] < zone_die[zone])))
+        zone_slot[zone]++;
+    }
+    npackages++;
+  }
+
+  if (!npackages) {
+    closedir(dir);
+    snprintf(rapl_driver.failed_reason, sizeof(rapl_driver.failed_reason),
+        "%s: no RAPL package zones", root);
+    return EML_UNSUPPORTED;
+  }
+
+  domains = malloc(npackages * (1 + nplanes) * sizeof(*domains));
+  if (!domains) {
+    closedir(dir);
+    return EML_NO_MEMORY;
+  }
+  for (size_t i = 0; i < npackages * (1 + nplanes); i++)
+    domains[i].fd = -1;
+
+  //collect zones in slots by package and plane, packages first
+  enum emlError err = EML_SUCCESS;
+  rewinddir(dir);
+  while (err == EML_SUCCESS && (entry = readdir(dir))) {
+    unsigned int zone, subzone;
+    char extra;
+    const int nmatched = sscanf(entry->d_name, "intel-rapl:%u:%u%c", &zone, &subzone, &extra);
+    if (nmatched < 1 || nmatched > 2 || zone >= MAX_ZONES || !zone_found[zone])
+      continue;
+
+    size_t slot = zone_slot[zone];
+    const char* suffix = NULL;
+    if (nmatched == 2) {
+      if (read_attr(root, entry->d_name, "name", buffer, sizeof(buffer)))
+        continue;
+
+      size_t p;
+      for (p = 0; p < nplanes && strcmp(buffer, plane_zones[p]); p++);
+      if (p == nplanes || !cfg_getbool(config, plane_names[p]))
+        continue;
+      slot = npackages + zone_slot[zone] * nplanes + p;
+      suffix = plane_names[p];
+    }
+    if (domains[slot].fd >= 0)
+      continue;
+
+    domains[slot].suffix = suffix;
+    domains[slot].package = zone_slot[zone];
+    err = open_zone(root, entry->d_name, &domains[slot]);
+    if (err == EML_SUCCESS && nmatched == 1)
+      domains[slot].max_power = powercap_zone_power(root, entry->d_name);
+    if (err != EML_SUCCESS && nmatched == 2) {
+      //zones below packages are optional
+      rapl_driver.failed_reason[0] = '\0';
+      err = EML_SUCCESS;
+    }
+  }
+  closedir(dir);
+
+  //drop empty slots
+  size_t ndomains = 0;
+  for (size_t i = 0; i < npackages * (1 + nplanes); i++) {
+    if (domains[i].fd >= 0)
+      domains[ndomains++] = domains[i];
+  }
+  if (err != EML_SUCCESS) {
+    for (size_t i = 0; i < ndomains; i++)
+      close(domains[i].fd);
+    free(domains);
+    domains = NULL;
+    return err;
+  }
+
+  //energy_uj values are in microjoules
+  default_props.energy_factor = EML_SI_MICRO;
+  rapl_driver.ndevices = ndomains;
+  return EML_SUCCESS;
+}
+
+//longest sampling interval at which no energy counter can wrap around more
+//than once between samples, in nanoseconds (0 if power limits are unknown)
+static long wrap_safe_interval() {
+  double period = 0;
+  for (size_t i = 0; i < rapl_driver.ndevices; i++) {
+    //package domains come first, and the domains below a package draw less
+    //than the package does (DRAM, which is not part of it, far less)
+    const double power = RAPL_AUTO_POWER_MARGIN * domains[domains[i].package].max_power;
+    if (power <= 0)
+      return 0;
+
+    const double wrap = emlDataApplyFactor(domains[i].range << domains[i].shift,
+        default_props.energy_factor) / power;
+    if (!i || wrap < period)
+      period = wrap;
+  }
+
+  //sample twice per wrap period, so that late samples are still safe
+  const double interval = period / 2 * 1e9;
+  return interval < LONG_MAX ? (long) interval : LONG_MAX;
+}
+
+static enum emlError init(cfg_t* const config) {
+  assert(!rapl_driver.initialized);
+  assert(config);
+  rapl_driver.config = config;
+  domains = NULL;
+  msrfd = NULL;
+  nmsrfds = 0;
+  core_from_package = NULL;
+  system_root = cfg_getstr(config, "system_root");
+
+  enum emlError err = EML_SUCCESS;
+
+  //msr, powercap, or auto (msr, falling back to powercap)
+  const char* backend = cfg_getstr(config, "backend");
+  if (strcmp(backend, "msr") && strcmp(backend, "powercap") && strcmp(backend, "auto")) {
+    dbglog_warn("%s: unknown backend '%s', using 'auto'", rapl_driver.name, backend);
+    backend = "auto";
+  }
+
+  use_powercap = !strcmp(backend, "powercap");
+  if (!use_powercap) {
+    err = init_msr(config);
+    if (err != EML_SUCCESS && !strcmp(backend, "auto")) {
+      dbglog_info("%s: MSRs unavailable (%s), using powercap", rapl_driver.name,
+          rapl_driver.failed_reason[0] ? rapl_driver.failed_reason : emlErrorMessage(err));
+      rapl_driver.failed_reason[0] = '\0';
+      use_powercap = 1;
+    }
+  }
+  if (use_powercap)
+    err = init_powercap(config);
+  if (err != EML_SUCCESS)
+    goto error;
+
+  //totals-only runs read counters at measurement boundaries, and once per
+  //period in between (see counter_snapshots)
+  const long period = wrap_safe_interval();
+  rapl_driver.counter_snapshots = period > 0;
+  rapl_driver.counter_period = period;
+
+  if (cfg_getint(config, "sampling_interval") == RAPL_AUTO_SAMPLING_INTERVAL) {
+    long interval = period;
+    if (interval) {
+      dbglog_info("%s: sampling every %.1fs", rapl_driver.name, interval / 1e9);
+    }
+    else {
+      dbglog_warn("%s: power limits unknown, using default sampling_interval",
+          rapl_driver.name);
+      interval = RAPL_DEFAULT_SAMPLING_INTERVAL;
+    }
+    cfg_setint(config, "sampling_interval", interval);
+
+    //periodic samples are too far apart to delimit measurements
+    cfg_setbool(config, "section_samples", cfg_true);
+  }
 
   rapl_driver.devices = malloc(rapl_driver.ndevices * sizeof(*rapl_driver.devices));
   for (size_t i = 0; i < rapl_driver.ndevices; i++) {
@@ -405,7 +950,12 @@ static enum emlError init(cfg_t* const config) {
       .driver = &rapl_driver,
       .index = i,
     };
-    snprintf(devinit.name, sizeof(devinit.name), "%s%zu", rapl_driver.name, i);
+    if (domains[i].suffix)
+      snprintf(devinit.name, sizeof(devinit.name), "%s%zu_%s", rapl_driver.name,
+          domains[i].package, domains[i].suffix);
+    else
+      snprintf(devinit.name, sizeof(devinit.name), "%s%zu", rapl_driver.name,
+          domains[i].package);
 
     struct emlDevice* const dev = &rapl_driver.devices[i];
     memcpy(dev, &devinit, sizeof(*dev));
@@ -415,12 +965,6 @@ static enum emlError init(cfg_t* const config) {
 
   return EML_SUCCESS;
 
-err_free:
-  free(prev_energy);
-  free(msrfd);
-  free(package_for_core);
-  free(core_from_package);
-
 error:
   if (rapl_driver.failed_reason[0] == '\0')
     strncpy(rapl_driver.failed_reason, emlErrorMessage(err), sizeof(rapl_driver.failed_reason) - 1);
@@ -432,13 +976,16 @@ static enum emlError shutdown() {
 
   rapl_driver.initialized = 0;
 
-  for (size_t i = 0; i < ncores; i++) {
+  for (size_t i = 0; i < nmsrfds; i++) {
     close(msrfd[i]);
   }
+  for (size_t i = 0; i < rapl_driver.ndevices; i++) {
+    if (domains[i].fd >= 0)
+      close(domains[i].fd);
+  }
 
-  free(prev_energy);
+  free(domains);
   free(msrfd);
-  free(package_for_core);
   free(core_from_package);
 
   free(rapl_driver.devices);
@@ -446,31 +993,59 @@ static enum emlError shutdown() {
   return EML_SUCCESS;
 }
 
-static enum emlError measure(size_t devno, unsigned long long* values) {
-  assert(rapl_driver.initialized);
-  assert(devno < rapl_driver.ndevices);
-
-  values[0] = nanotimestamp() / 1000000;
-
+//energy consumed by a domain since its previous reading
+static enum emlError read_domain_energy(size_t devno, unsigned long long* values) {
+  struct rapl_domain* const domain = &domains[devno];
   unsigned long long energy;
-  size_t core = core_from_package[devno];
-  int read_error = read_msr(core, cfg->MSR_PKG_ENERGY_STATUS, &energy);
-  if (read_error)
-    return EML_UNKNOWN;
+  if (use_powercap) {
+    if (read_energy_uj(domain->fd, &energy))
+      return EML_UNKNOWN;
+  }
+  else {
+    int read_error = read_msr(domain->package, domain->msr, &energy);
+    if (read_error)
+      return EML_UNKNOWN;
+    energy &= WRAP_VALUE - 1;
+  }
 
   //detect overflow
-  unsigned long long* energyvalue = &values[rapl_driver.default_props->inst_energy_field * DATABLOCK_SIZE];
-  if (prev_energy[devno] == WRAP_VALUE)
+  unsigned long long* energyvalue = &values[rapl_driver.default_props->inst_energy_field];
+  if (domain->prev_energy == NO_ENERGY)
     *energyvalue = 0;
-  else if (energy < prev_energy[devno])
-    *energyvalue = energy + (WRAP_VALUE - prev_energy[devno]);
+  else if (energy < domain->prev_energy)
+    *energyvalue = energy + (domain->range - domain->prev_energy);
   else
-    *energyvalue = energy - prev_energy[devno];
-  prev_energy[devno] = energy;
+    *energyvalue = energy - domain->prev_energy;
+  *energyvalue <<= domain->shift;
+  domain->prev_energy = energy;
 
   return EML_SUCCESS;
 }
 
+static enum emlError measure(size_t devno, unsigned long long* values) {
+  assert(rapl_driver.initialized);
+  assert(devno < rapl_driver.ndevices);
+
+  values[0] = nanotimestamp() / 1000000;
+  return read_domain_energy(devno, values);
+}
+
+static enum emlError measure_all(unsigned long long* values, size_t ndevices) {
+  assert(rapl_driver.initialized);
+  assert(ndevices <= rapl_driver.ndevices);
+
+  //all domains of all packages are read back to back, under the same timestamp
+  const unsigned long long now = nanotimestamp() / 1000000;
+  for (size_t i = 0; i < ndevices; i++) {
+    unsigned long long* devvalues = values + i * EML_DATAPOINT_MAX_FIELDS;
+    devvalues[0] = now;
+    enum emlError err = read_domain_energy(i, devvalues);
+    if (err != EML_SUCCESS)
+      return err;
+  }
+  return EML_SUCCESS;
+}
+
 // default measurement properties for this driver
 static struct emlDataProperties default_props = {
   //ENERGY_STATUS is updated every ~1ms
@@ -481,9 +1056,36 @@ static struct emlDataProperties default_props = {
   .inst_power_field = 0,
 };
 
+//parses sampling_interval, which may also be "auto"
+static int cfg_interval_parsecb(cfg_t* cfg, cfg_opt_t* opt, const char* value, void* result) {
+  if (!strcmp(value, "auto")) {
+    *(long*) result = RAPL_AUTO_SAMPLING_INTERVAL;
+    return 0;
+  }
+
+  char* endptr;
+  errno = 0;
+  const long interval = strtol(value, &endptr, 0);
+  if (errno || endptr == value || *endptr) {
+    cfg_error(cfg, "\"%s\" must be a number of nanoseconds or \"auto\"", opt->name);
+    return 1;
+  }
+
+  *(long*) result = interval;
+  return 0;
+}
+
 static cfg_opt_t cfgopts[] = {
   CFG_BOOL("disabled", cfg_false, CFGF_NONE),
-  CFG_INT("sampling_interval", RAPL_DEFAULT_SAMPLING_INTERVAL, CFGF_NONE),
+  CFG_INT_CB("sampling_interval", RAPL_DEFAULT_SAMPLING_INTERVAL, CFGF_NONE,
+      &cfg_interval_parsecb),
+  CFG_BOOL("pp0", cfg_true, CFGF_NONE),
+  CFG_BOOL("pp1", cfg_true, CFGF_NONE),
+  CFG_BOOL("dram", cfg_true, CFGF_NONE),
+  CFG_STR("backend", "auto", CFGF_NONE),
+  CFG_STR("powercap_root", RAPL_DEFAULT_POWERCAP_ROOT, CFGF_NONE),
+  CFG_STR("system_root", "", CFGF_NONE),
+  EML_MONITOR_CFGOPTS,
   CFG_END()
 };
 
@@ -499,4 +1101,5 @@ struct emlDriver rapl_driver = {
   .init = &init,
   .shutdown = &shutdown,
   .measure = &measure,
+  .measure_all = &measure_all,
 };
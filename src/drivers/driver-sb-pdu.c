@@ -700,64 +700,103 @@ static enum emlError shutdowndrv() {
   return EML_SUCCESS;
 }
 
-static enum emlError measure(size_t devno, unsigned long long* values) {
-  assert(sb_pdu_driver.initialized);
-  assert(devno < sb_pdu_driver.ndevices);
-
-
-  const size_t pduno = devstate[devno].pdu;
-  const size_t outlet = devstate[devno].outlet;
-
+//queries all outlet measurements from a pdu (msglock must be held)
+static enum emlError pduquery(struct pdustate* const st) {
   ssize_t sent;
   ssize_t read;
-  enum emlError err;
 
-  pthread_mutex_lock(&pdustate[pduno]->msglock);
-
-  //only actually query the pdu if there is no fresh block
-  unsigned long long now = nanotimestamp();
-  if (pdustate[pduno]->lastblk[0] == '\0' || (now - pdustate[pduno]->lastts) > MEASURE_TTL)
-  {
-    sent = pduwrite(pdustate[pduno], measurecmdbuf, measurecmdlen);
-    if (sent < 0) {
-      dbglog_error("pduwrite returned %zd", sent);
-      goto err_unlock_mutex;
-    }
+  sent = pduwrite(st, measurecmdbuf, measurecmdlen);
+  if (sent < 0) {
+    dbglog_error("pduwrite returned %zd", sent);
+    return EML_NETWORK_ERROR;
+  }
 
-    read = pduread(pdustate[pduno], pdustate[pduno]->lastblk, sizeof(pdustate[pduno]->lastblk));
-    if (read < 0) {
-      dbglog_error("pduread returned %zd", sent);
-      goto err_unlock_mutex;
-    }
+  read = pduread(st, st->lastblk, sizeof(st->lastblk));
+  if (read < 0) {
+    dbglog_error("pduread returned %zd", read);
+    return EML_NETWORK_ERROR;
+  }
 
-    err = pdureadvalidcmd(pdustate[pduno]->lastblk, read, SB_ACK_READ);
-    if (err != EML_SUCCESS) goto err_unlock_mutex;
+  enum emlError err = pdureadvalidcmd(st->lastblk, read, SB_ACK_READ);
+  if (err != EML_SUCCESS)
+    return EML_NETWORK_ERROR;
 
-    pdustate[pduno]->lastts = nanotimestamp();
-  }
+  st->lastts = nanotimestamp();
+  return EML_SUCCESS;
+}
 
-  values[0] = pdustate[pduno]->lastts;
+//queries a pdu unless its last response is still fresh (msglock must be held)
+static enum emlError pdurefresh(struct pdustate* const st) {
+  unsigned long long now = nanotimestamp();
+  if (st->lastblk[0] == '\0' || (now - st->lastts) > MEASURE_TTL)
+    return pduquery(st);
+  return EML_SUCCESS;
+}
 
+//apparent power for an outlet from the last pdu response (msglock must be held)
+static unsigned long long outletpower(const struct pdustate* const st, const size_t outlet) {
   //current RMS in centiampères, < 0.5% deviation
   const size_t currentpos = 10 + MEASURE_REG_LEN * outlet;
-  const uint16_t current = (pdustate[pduno]->lastblk[currentpos + 1] << 8) + pdustate[pduno]->lastblk[currentpos];
+  const uint16_t current = (st->lastblk[currentpos + 1] << 8) + st->lastblk[currentpos];
 
   //voltage RMS in centivolts, < 0.5% deviation
   const size_t voltagepos = currentpos + MEASURE_REG_LEN * NCHANNELS * 2;
-  const uint16_t voltage = (pdustate[pduno]->lastblk[voltagepos + 1] << 8) + pdustate[pduno]->lastblk[voltagepos];
-
-  pthread_mutex_unlock(&pdustate[pduno]->msglock);
+  const uint16_t voltage = (st->lastblk[voltagepos + 1] << 8) + st->lastblk[voltagepos];
 
   //apparent power in volt-ampères * 1e4
-  const unsigned long long power = (unsigned long long) voltage * current;
+  return (unsigned long long) voltage * current;
+}
 
-  values[sb_pdu_driver.default_props->inst_power_field * DATABLOCK_SIZE] = power;
+static enum emlError measure(size_t devno, unsigned long long* values) {
+  assert(sb_pdu_driver.initialized);
+  assert(devno < sb_pdu_driver.ndevices);
 
-  return EML_SUCCESS;
+  const size_t pduno = devstate[devno].pdu;
+  const size_t outlet = devstate[devno].outlet;
+
+  pthread_mutex_lock(&pdustate[pduno]->msglock);
+
+  //only actually query the pdu if there is no fresh block
+  enum emlError err = pdurefresh(pdustate[pduno]);
+  if (err != EML_SUCCESS) {
+    pthread_mutex_unlock(&pdustate[pduno]->msglock);
+    return err;
+  }
+
+  values[0] = pdustate[pduno]->lastts;
+  values[sb_pdu_driver.default_props->inst_power_field] = outletpower(pdustate[pduno], outlet);
 
-err_unlock_mutex:
   pthread_mutex_unlock(&pdustate[pduno]->msglock);
-  return EML_NETWORK_ERROR;
+
+  return EML_SUCCESS;
+}
+
+static enum emlError measure_all(unsigned long long* values, size_t ndevices) {
+  assert(sb_pdu_driver.initialized);
+  assert(ndevices <= sb_pdu_driver.ndevices);
+
+  //one query per pdu covers all of its outlets, which are numbered in order
+  //(pdus with a fresh block are not queried again, as in measure)
+  size_t devno = 0;
+  for (size_t pduno = 0; pduno < npdus && devno < ndevices; pduno++) {
+    struct pdustate* const st = pdustate[pduno];
+
+    pthread_mutex_lock(&st->msglock);
+    enum emlError err = pdurefresh(st);
+    if (err != EML_SUCCESS) {
+      pthread_mutex_unlock(&st->msglock);
+      return err;
+    }
+
+    for (; devno < ndevices && devstate[devno].pdu == pduno; devno++) {
+      unsigned long long* devvalues = values + devno * EML_DATAPOINT_MAX_FIELDS;
+      devvalues[0] = st->lastts;
+      devvalues[sb_pdu_driver.default_props->inst_power_field] = outletpower(st, devstate[devno].outlet);
+    }
+    pthread_mutex_unlock(&st->msglock);
+  }
+
+  return EML_SUCCESS;
 }
 
 // default measurement properties for this driver
@@ -827,6 +866,7 @@ static cfg_opt_t deviceopts[] = {
 static cfg_opt_t cfgopts[] = {
   CFG_BOOL("disabled", cfg_false, CFGF_NONE),
   CFG_INT("sampling_interval", SB_DEFAULT_SAMPLING_INTERVAL, CFGF_NONE),
+  EML_MONITOR_CFGOPTS,
   CFG_SEC("device", deviceopts, CFGF_MULTI | CFGF_TITLE | CFGF_NO_TITLE_DUPES),
 
   CFG_END()
@@ -843,4 +883,5 @@ struct emlDriver sb_pdu_driver = {
   .init = &init,
   .shutdown = &shutdowndrv,
   .measure = &measure,
+  .measure_all = &measure_all,
 };
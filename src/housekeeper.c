@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+//feature test macro for sem_wait(), etc
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+
+#include "debug.h"
+#include "device.h"
+#include "housekeeper.h"
+#include "monitor.h"
+
+/// Housekeeper state
+static struct {
+  /// Housekeeping thread
+  pthread_t thread;
+  /// Whether the thread was started
+  int running;
+  /// Whether the thread is shutting down
+  int stopping;
+  /// Devices looked after, in no particular order
+  const struct emlDevice** devices;
+  size_t ndevices;
+  size_t capacity;
+
+  /// Protects all housekeeper state, and is held while doing work
+  pthread_mutex_t lock;
+  /// Posted by samplers (or on shutdown) to wake the thread up
+  sem_t wake;
+} housekeeper = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void* housekeeper_thread(void* arg) {
+  (void) arg;
+
+  for (;;) {
+    while (sem_wait(&housekeeper.wake) == -1 && errno == EINTR);
+
+    pthread_mutex_lock(&housekeeper.lock);
+    if (housekeeper.stopping) {
+      pthread_mutex_unlock(&housekeeper.lock);
+      break;
+    }
+
+    //working under the lock lets emlHousekeeperRemove wait for it (devices
+    //with nothing to do return right away)
+    for (size_t i = 0; i < housekeeper.ndevices; i++)
+      emlDeviceMonitorHousekeep(housekeeper.devices[i]);
+    pthread_mutex_unlock(&housekeeper.lock);
+  }
+
+  return NULL;
+}
+
+//called with the lock held
+static enum emlError start_thread() {
+  if (sem_init(&housekeeper.wake, 0, 0) == -1)
+    return EML_UNKNOWN;
+
+  housekeeper.stopping = 0;
+  int err = pthread_create(&housekeeper.thread, NULL, &housekeeper_thread, NULL);
+  if (err) {
+    dbglog_error("pthread_create returned %d", err);
+    sem_destroy(&housekeeper.wake);
+    return EML_UNKNOWN;
+  }
+  housekeeper.running = 1;
+  return EML_SUCCESS;
+}
+
+enum emlError emlHousekeeperAdd(const struct emlDevice* const device) {
+  pthread_mutex_lock(&housekeeper.lock);
+
+  if (!housekeeper.running) {
+    enum emlError err = start_thread();
+    if (err != EML_SUCCESS) {
+      pthread_mutex_unlock(&housekeeper.lock);
+      return err;
+    }
+  }
+
+  if (housekeeper.ndevices == housekeeper.capacity) {
+    size_t newcap = housekeeper.capacity ? 2 * housekeeper.capacity : 4;
+    const struct emlDevice** newdevices =
+      realloc(housekeeper.devices, newcap * sizeof(*newdevices));
+    if (!newdevices) {
+      pthread_mutex_unlock(&housekeeper.lock);
+      return EML_NO_MEMORY;
+    }
+    housekeeper.devices = newdevices;
+    housekeeper.capacity = newcap;
+  }
+
+  housekeeper.devices[housekeeper.ndevices++] = device;
+
+  pthread_mutex_unlock(&housekeeper.lock);
+  return EML_SUCCESS;
+}
+
+void emlHousekeeperWake() {
+  sem_post(&housekeeper.wake);
+}
+
+enum emlError emlHousekeeperRemove(const struct emlDevice* const device) {
+  enum emlError ret = EML_NOT_STARTED;
+
+  pthread_mutex_lock(&housekeeper.lock);
+  for (size_t i = 0; i < housekeeper.ndevices; i++) {
+    if (housekeeper.devices[i] == device) {
+      housekeeper.devices[i] = housekeeper.devices[--housekeeper.ndevices];
+      ret = EML_SUCCESS;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&housekeeper.lock);
+
+  return ret;
+}
+
+enum emlError emlHousekeeperShutdown() {
+  pthread_mutex_lock(&housekeeper.lock);
+  if (!housekeeper.running) {
+    pthread_mutex_unlock(&housekeeper.lock);
+    return EML_SUCCESS;
+  }
+
+  assert(!housekeeper.ndevices);
+  housekeeper.stopping = 1;
+  sem_post(&housekeeper.wake);
+  pthread_mutex_unlock(&housekeeper.lock);
+
+  pthread_join(housekeeper.thread, NULL);
+
+  sem_destroy(&housekeeper.wake);
+  free(housekeeper.devices);
+  housekeeper.devices = NULL;
+  housekeeper.ndevices = 0;
+  housekeeper.capacity = 0;
+  housekeeper.running = 0;
+
+  return EML_SUCCESS;
+}
@@ -0,0 +1,548 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+//feature test macro for strdup()
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <eml/data.h>
+
+#include "data.h"
+#include "datafile.h"
+#include "device.h"
+#include "error.h"
+#include "load.h"
+
+enum emlError emlDataLoaderInit(
+    struct emlDataLoader* const loader,
+    const struct emlDataProperties* const props,
+    const char* const devname)
+{
+  struct emlData* data = malloc(sizeof(*data));
+  if (!data)
+    return EML_NO_MEMORY;
+  struct emlDataRun* run = malloc(sizeof(*run));
+  if (!run) {
+    free(data);
+    return EML_NO_MEMORY;
+  }
+  run->devname = strdup(devname);
+  if (!run->devname
+      || emlDataBlockPoolCreate(&run->pool, emlDataFieldCount(props)) != EML_SUCCESS) {
+    free(run->devname);
+    free(run);
+    free(data);
+    return EML_NO_MEMORY;
+  }
+
+  SLIST_INIT(&run->blocks);
+  run->refcount = 1;
+  run->device = NULL;
+  run->loaded_props = *props;
+  run->props = &run->loaded_props;
+  pthread_mutex_init(&run->lock, NULL);
+  run->nblocks = 0;
+  run->maxblocks = 0;
+  run->maxtime = 0;
+  run->streamed = SIZE_MAX;
+  run->compress = 0;
+  run->npacked = 0;
+  run->packing = NULL;
+  run->index = NULL;
+  run->nindexed = 0;
+  run->indexcap = 0;
+  run->totals_only = 0;
+
+  data->run = run;
+  data->firstblock = NULL;
+  data->firstpoint = 0;
+  data->npoints = 0;
+  data->elapsed_time = 0;
+  data->consumed_energy = 0;
+
+  loader->data = data;
+  loader->curblk = NULL;
+  loader->lastblock = NULL;
+  loader->energy = 0;
+  return EML_SUCCESS;
+}
+
+struct emlDataBlock* emlDataLoaderReserve(
+    struct emlDataLoader* const loader,
+    const size_t npoints)
+{
+  struct emlDataRun* run = loader->data->run;
+  const size_t end = loader->data->npoints + npoints;
+
+  //blocks are laid out back to back from the first datapoint, growing in
+  //size as for live runs
+  struct emlDataBlock* last = loader->lastblock;
+  size_t capacity = last ? last->first + last->size : 0;
+  while (capacity < end) {
+    const size_t size = last ? emlDataBlockNextSize(last->size) : DATABLOCK_MIN_SIZE;
+    if (emlDataBlockPoolFill(run->pool, size, 1) != EML_SUCCESS)
+      return NULL;
+    struct emlDataBlock* block = emlDataBlockPoolTake(run->pool, size);
+    block->first = capacity;
+    block->energy_base = 0;
+    block->refs = 0;
+    if (loader->lastblock)
+      SLIST_INSERT_AFTER(loader->lastblock, block, entries);
+    else
+      SLIST_INSERT_HEAD(&run->blocks, block, entries);
+    run->nblocks++;
+    loader->lastblock = last = block;
+    if (!loader->curblk)
+      loader->curblk = block;
+    capacity += size;
+  }
+
+  //the next datapoint may start a block appended after the current one
+  if (loader->curblk && loader->curblk->first + loader->curblk->size <= loader->data->npoints)
+    loader->curblk = SLIST_NEXT(loader->curblk, entries);
+  return loader->curblk;
+}
+
+void emlDataLoaderCommit(struct emlDataLoader* const loader, const size_t npoints) {
+  struct emlData* data = loader->data;
+  const struct emlDataProperties* props = data->run->props;
+  const size_t nfields = data->run->pool->nfields;
+
+  struct emlDataBlock* bp = loader->curblk;
+  for (size_t n = 0; n < npoints; n++) {
+    if (data->npoints - bp->first == bp->size)
+      bp = SLIST_NEXT(bp, entries);
+    const size_t i = data->npoints - bp->first;
+
+    unsigned long long point[EML_DATAPOINT_MAX_FIELDS] = {0};
+    for (size_t field = 0; field < nfields; field++)
+      point[field] = bp->fields[field * bp->size + i];
+
+    //prefix sums, as computed by the sampler on live runs
+    if (data->npoints)
+      loader->energy += emlDataPointEnergy(props, loader->lastpoint, point);
+    if (!i)
+      bp->energy_base = loader->energy;
+    bp->energy[i] = loader->energy - bp->energy_base;
+    memcpy(loader->lastpoint, point, sizeof(point));
+    data->npoints++;
+  }
+  loader->curblk = bp;
+}
+
+struct emlData* emlDataLoaderFinish(
+    struct emlDataLoader* const loader,
+    const int samples,
+    const int totals,
+    const unsigned long long elapsed,
+    const unsigned long long consumed)
+{
+  struct emlData* data = loader->data;
+  struct emlDataRun* run = data->run;
+
+  //drop blocks reserved for datapoints that never came
+  struct emlDataBlock* bp = SLIST_FIRST(&run->blocks);
+  struct emlDataBlock* prev = NULL;
+  while (bp && bp->first < data->npoints) {
+    prev = bp;
+    bp = SLIST_NEXT(bp, entries);
+  }
+  while (bp) {
+    struct emlDataBlock* next = SLIST_NEXT(bp, entries);
+    emlDataBlockPoolGive(run->pool, bp);
+    run->nblocks--;
+    bp = next;
+  }
+  if (prev)
+    SLIST_NEXT(prev, entries) = NULL;
+  else
+    SLIST_INIT(&run->blocks);
+
+  run->totals_only = !samples;
+  if (data->npoints) {
+    data->firstblock = SLIST_FIRST(&run->blocks);
+    data->firstblock->refs++;
+  }
+
+  pthread_mutex_lock(&run->lock);
+  emlDataRunIndex(run);
+  pthread_mutex_unlock(&run->lock);
+
+  if (totals) {
+    data->elapsed_time = elapsed;
+    data->consumed_energy = consumed;
+  }
+  else {
+    emlDataUpdateTotals(data);
+  }
+
+  loader->data = NULL;
+  return data;
+}
+
+void emlDataLoaderAbort(struct emlDataLoader* const loader) {
+  if (loader->data) {
+    emlDataRunRelease(loader->data->run);
+    free(loader->data);
+    loader->data = NULL;
+  }
+}
+
+/// Maximum nesting of skipped JSON values
+#define JSON_MAX_DEPTH 64
+
+/// JSON dataset being read
+struct emlJSONReader {
+  /// Source file
+  FILE* file;
+  /// Measurement properties and device name, needed before the datapoints
+  struct emlDataProperties props;
+  char device[EML_DEVNAME_MAXLEN];
+  /// Whether the header was found
+  int hasheader;
+  /// Factors found (1 for time, 2 for energy)
+  int factors;
+  /// Whether datapoints were kept
+  int samples;
+  /// Totals found (1 for elapsed, 2 for consumed)
+  int hastotals;
+  unsigned long long elapsed;
+  unsigned long long consumed;
+  /// Dataset being built, once the data key is found
+  struct emlDataLoader loader;
+  int loading;
+};
+
+//returns the next character past whitespace, without consuming it
+static int json_peek(struct emlJSONReader* const r) {
+  int c;
+  do {
+    c = getc(r->file);
+  } while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+  if (c != EOF)
+    ungetc(c, r->file);
+  return c;
+}
+
+static int json_expect(struct emlJSONReader* const r, const int expected) {
+  if (json_peek(r) != expected)
+    return 0;
+  getc(r->file);
+  return 1;
+}
+
+//reads a string, truncating it to size (escaped characters are taken as they
+//are, which is enough for keys and device names)
+static enum emlError json_string(struct emlJSONReader* const r, char* const dst, const size_t size) {
+  if (!json_expect(r, '"'))
+    return EML_PARSING_ERROR;
+
+  size_t len = 0;
+  for (;;) {
+    int c = getc(r->file);
+    if (c == EOF)
+      return EML_PARSING_ERROR;
+    if (c == '"')
+      break;
+    if (c == '\\') {
+      c = getc(r->file);
+      if (c == EOF)
+        return EML_PARSING_ERROR;
+    }
+    if (len + 1 < size)
+      dst[len++] = c;
+  }
+  if (size)
+    dst[len] = '\0';
+  return EML_SUCCESS;
+}
+
+static enum emlError json_ull(struct emlJSONReader* const r, unsigned long long* const value) {
+  int c = json_peek(r);
+  if (!isdigit(c))
+    return EML_PARSING_ERROR;
+
+  unsigned long long v = 0;
+  while (isdigit(c = getc(r->file))) {
+    const unsigned digit = c - '0';
+    if (v > (ULLONG_MAX - digit) / 10)
+      return EML_PARSING_ERROR;
+    v = v * 10 + digit;
+  }
+  if (c != EOF)
+    ungetc(c, r->file);
+  if (c == '.' || c == 'e' || c == 'E')
+    return EML_PARSING_ERROR;
+
+  *value = v;
+  return EML_SUCCESS;
+}
+
+static enum emlError json_skip(struct emlJSONReader* const r, const unsigned depth) {
+  if (depth > JSON_MAX_DEPTH)
+    return EML_PARSING_ERROR;
+
+  const int c = json_peek(r);
+  if (c == '"')
+    return json_string(r, NULL, 0);
+
+  if (c == '[' || c == '{') {
+    const int close = c == '[' ? ']' : '}';
+    getc(r->file);
+    if (json_expect(r, close))
+      return EML_SUCCESS;
+    do {
+      if (c == '{') {
+        enum emlError ret = json_string(r, NULL, 0);
+        if (ret != EML_SUCCESS)
+          return ret;
+        if (!json_expect(r, ':'))
+          return EML_PARSING_ERROR;
+      }
+      enum emlError ret = json_skip(r, depth + 1);
+      if (ret != EML_SUCCESS)
+        return ret;
+    } while (json_expect(r, ','));
+    return json_expect(r, close) ? EML_SUCCESS : EML_PARSING_ERROR;
+  }
+
+  //numbers and literals
+  size_t len = 0;
+  int d;
+  while ((d = getc(r->file)) != EOF && (isalnum(d) || d == '-' || d == '+' || d == '.'))
+    len++;
+  if (d != EOF)
+    ungetc(d, r->file);
+  return len ? EML_SUCCESS : EML_PARSING_ERROR;
+}
+
+static enum emlError json_bool(struct emlJSONReader* const r, int* const value) {
+  char word[6];
+  size_t len = 0;
+  int c;
+  json_peek(r);
+  while ((c = getc(r->file)) != EOF && isalpha(c)) {
+    if (len + 1 >= sizeof(word))
+      return EML_PARSING_ERROR;
+    word[len++] = c;
+  }
+  if (c != EOF)
+    ungetc(c, r->file);
+  word[len] = '\0';
+
+  if (!strcmp(word, "true"))
+    *value = 1;
+  else if (!strcmp(word, "false"))
+    *value = 0;
+  else
+    return EML_PARSING_ERROR;
+  return EML_SUCCESS;
+}
+
+//reads a {"mult": m, "div": d} object into a factor (see emlDataProperties)
+static enum emlError json_factor(struct emlJSONReader* const r, int* const factor) {
+  unsigned long long mult = 1, div = 1;
+  if (!json_expect(r, '{'))
+    return EML_PARSING_ERROR;
+  if (!json_expect(r, '}')) {
+    do {
+      char key[8];
+      enum emlError ret = json_string(r, key, sizeof(key));
+      if (ret == EML_SUCCESS && !json_expect(r, ':'))
+        ret = EML_PARSING_ERROR;
+      if (ret == EML_SUCCESS) {
+        if (!strcmp(key, "mult"))
+          ret = json_ull(r, &mult);
+        else if (!strcmp(key, "div"))
+          ret = json_ull(r, &div);
+        else
+          ret = json_skip(r, 1);
+      }
+      if (ret != EML_SUCCESS)
+        return ret;
+    } while (json_expect(r, ','));
+    if (!json_expect(r, '}'))
+      return EML_PARSING_ERROR;
+  }
+
+  if (mult > INT_MAX || div > INT_MAX || !div || (div > 1 && mult != 1))
+    return EML_UNSUPPORTED;
+  *factor = div > 1 ? -(int) div : (int) mult;
+  return EML_SUCCESS;
+}
+
+//field positions are taken from the header array
+static enum emlError json_header(struct emlJSONReader* const r) {
+  struct emlDataProperties* props = &r->props;
+  props->inst_energy_field = 0;
+  props->inst_power_field = 0;
+
+  if (!json_expect(r, '['))
+    return EML_PARSING_ERROR;
+  size_t nfields = 0;
+  if (!json_expect(r, ']')) {
+    do {
+      char name[16];
+      enum emlError ret = json_string(r, name, sizeof(name));
+      if (ret != EML_SUCCESS)
+        return ret;
+      if (nfields >= EML_DATAPOINT_MAX_FIELDS)
+        return EML_UNSUPPORTED;
+
+      if (!strcmp(name, "timestamp") && nfields == timestamp_field)
+        ;
+      else if (!strcmp(name, "inst_energy") && nfields && !props->inst_energy_field)
+        props->inst_energy_field = nfields;
+      else if (!strcmp(name, "inst_power") && nfields && !props->inst_power_field)
+        props->inst_power_field = nfields;
+      else
+        return EML_UNSUPPORTED;
+      nfields++;
+    } while (json_expect(r, ','));
+    if (!json_expect(r, ']'))
+      return EML_PARSING_ERROR;
+  }
+  if (!nfields)
+    return EML_PARSING_ERROR;
+
+  r->hasheader = 1;
+  return EML_SUCCESS;
+}
+
+//datapoints go straight into the blocks of a new run
+static enum emlError json_data(struct emlJSONReader* const r) {
+  if (!r->hasheader || (r->factors & 3) != 3 || !r->props.time_factor || !r->props.energy_factor
+      || r->loading)
+    return EML_PARSING_ERROR;
+
+  enum emlError ret = emlDataLoaderInit(&r->loader, &r->props, r->device);
+  if (ret != EML_SUCCESS)
+    return ret;
+  r->loading = 1;
+
+  const size_t nfields = emlDataFieldCount(&r->props);
+  if (!json_expect(r, '['))
+    return EML_PARSING_ERROR;
+  if (json_expect(r, ']'))
+    return EML_SUCCESS;
+  do {
+    struct emlDataBlock* bp = emlDataLoaderReserve(&r->loader, 1);
+    if (!bp)
+      return EML_NO_MEMORY;
+    const size_t i = r->loader.data->npoints - bp->first;
+
+    if (!json_expect(r, '['))
+      return EML_PARSING_ERROR;
+    for (size_t field = 0; field < nfields; field++) {
+      if (field && !json_expect(r, ','))
+        return EML_PARSING_ERROR;
+      ret = json_ull(r, &bp->fields[field * bp->size + i]);
+      if (ret != EML_SUCCESS)
+        return ret;
+    }
+    if (!json_expect(r, ']'))
+      return EML_PARSING_ERROR;
+
+    emlDataLoaderCommit(&r->loader, 1);
+  } while (json_expect(r, ','));
+
+  return json_expect(r, ']') ? EML_SUCCESS : EML_PARSING_ERROR;
+}
+
+static enum emlError json_member(struct emlJSONReader* const r) {
+  char key[16];
+  enum emlError ret = json_string(r, key, sizeof(key));
+  if (ret != EML_SUCCESS)
+    return ret;
+  if (!json_expect(r, ':'))
+    return EML_PARSING_ERROR;
+
+  if (!strcmp(key, "device"))
+    return json_string(r, r->device, sizeof(r->device));
+  if (!strcmp(key, "elapsed")) {
+    r->hastotals |= 1;
+    return json_ull(r, &r->elapsed);
+  }
+  if (!strcmp(key, "consumed")) {
+    r->hastotals |= 2;
+    return json_ull(r, &r->consumed);
+  }
+  if (!strcmp(key, "time_factor")) {
+    r->factors |= 1;
+    return json_factor(r, &r->props.time_factor);
+  }
+  if (!strcmp(key, "energy_factor")) {
+    r->factors |= 2;
+    return json_factor(r, &r->props.energy_factor);
+  }
+  if (!strcmp(key, "power_factor"))
+    return json_factor(r, &r->props.power_factor);
+  if (!strcmp(key, "header"))
+    return json_header(r);
+  if (!strcmp(key, "samples"))
+    return json_bool(r, &r->samples);
+  if (!strcmp(key, "data"))
+    return json_data(r);
+  return json_skip(r, 1);
+}
+
+//reads an emlData object (see doc/emlData.schema.json)
+static enum emlError load_json(FILE* const file, struct emlData** const data) {
+  struct emlJSONReader r = {
+    .file = file,
+    .props = { .time_factor = 0, .energy_factor = 0, .power_factor = 1 },
+    .samples = 1,
+  };
+  snprintf(r.device, sizeof(r.device), "unknown");
+
+  enum emlError ret = json_expect(&r, '{') ? EML_SUCCESS : EML_PARSING_ERROR;
+  if (ret == EML_SUCCESS && !json_expect(&r, '}')) {
+    do {
+      ret = json_member(&r);
+    } while (ret == EML_SUCCESS && json_expect(&r, ','));
+    if (ret == EML_SUCCESS && !json_expect(&r, '}'))
+      ret = EML_PARSING_ERROR;
+  }
+  if (ret == EML_SUCCESS && !r.loading)
+    ret = EML_PARSING_ERROR;
+  if (ret == EML_SUCCESS && !r.samples && r.loader.data->npoints)
+    ret = EML_PARSING_ERROR;
+
+  if (ret != EML_SUCCESS) {
+    if (r.loading)
+      emlDataLoaderAbort(&r.loader);
+    return ret;
+  }
+
+  *data = emlDataLoaderFinish(&r.loader, r.samples, r.hastotals == 3, r.elapsed, r.consumed);
+  return EML_SUCCESS;
+}
+
+enum emlError emlDataLoad(FILE* const file, struct emlData** const data) {
+  if (!file || !data)
+    return EML_INVALID_PARAMETER;
+
+  //binary files start with the magic string, JSON objects with a brace
+  int c;
+  do {
+    c = getc(file);
+  } while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+  if (c == EOF)
+    return EML_PARSING_ERROR;
+  ungetc(c, file);
+
+  if (c == EML_DATAFILE_MAGIC[0])
+    return emlDataFileLoad(file, data);
+  return load_json(file, data);
+}
@@ -7,106 +7,579 @@
  * any later version.
  */
 
-//feature test macro for clock_nanosleep(), etc
-#define _POSIX_C_SOURCE 200112L
+//feature test macro for pthread_condattr_setclock(), strdup(), etc
+#define _POSIX_C_SOURCE 200809L
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/queue.h>
 
 #include <confuse.h>
 
+#include "batch.h"
 #include "data.h"
 #include "debug.h"
 #include "device.h"
 #include "driver.h"
+#include "housekeeper.h"
 #include "monitor.h"
+#include "pack.h"
+#include "scheduler.h"
+#include "stream.h"
+#include "subscriber.h"
+#include "timer.h"
+#include "watchdog.h"
 
 #ifndef MEASUREMENT_STACK_SIZE
 /// Maximum level of measurement nesting
 #define MEASUREMENT_STACK_SIZE 10
 #endif
 
+static const unsigned long long NS_PER_SEC = 1000000000ULL;
+
+/// Sampling policies, selected through the sampling_policy option
+enum emlSamplingPolicy {
+  /// Wait for the sampling interval after each sample (legacy behavior)
+  EML_SAMPLING_DELAY,
+  /// Sample on a fixed grid of deadlines, skipping missed ticks
+  EML_SAMPLING_SKIP,
+  /// Sample on a fixed grid of deadlines, taking missed ticks back-to-back
+  EML_SAMPLING_CATCHUP,
+};
+
+/// Sampling progress for a measurement run
+struct emlProgress {
+  /// Total gathered data points
+  size_t npoints;
+  /// Current data block (NULL in totals-only mode)
+  struct emlDataBlock* curblk;
+  /// Energy consumed since the first data point
+  unsigned long long energy;
+  /// Timestamp of the first data point
+  unsigned long long firsttime;
+  /// Timestamp of the last data point
+  unsigned long long lasttime;
+  /// Timestamp of the data point before the last one
+  unsigned long long prevtime;
+  /// Energy consumed between the last two data points
+  unsigned long long laststep;
+  /// Power reading for the last data point (if available)
+  unsigned long long lastpower;
+};
+
+/// Start of the innermost measurement section, for live totals
+struct emlSection {
+  /// Measurement nesting level (0 if not measuring)
+  size_t level;
+  /// First data point of the section
+  size_t firstpoint;
+  /// Running totals at the start of the section
+  unsigned long long firstenergy;
+  unsigned long long firsttime;
+};
+
 /// Contains monitoring state for a single device
 struct emlMonitor {
-  /// Thread that measures data periodically
+  /// Thread that measures data periodically (unless the scheduler is enabled,
+  /// or the device is sampled through a batch)
   pthread_t measuring_thread;
+  /// Wakes the measuring thread when the last measurement is stopped, so that
+  /// stopping does not wait for the rest of the sampling interval
+  pthread_mutex_t wakelock;
+  pthread_cond_t wakecond;
   /// Gathered measurement run data
   struct emlDataRun* run;
-  /// Measurement nesting level we are currently at
+  /// Free blocks for new measurement runs
+  struct emlDataBlockPool* pool;
+  /// Whether the housekeeper should refill the pool and compress full blocks
+  /// (set by the sampler)
+  int housekeep;
+  /// Whether block eviction and indexing should be retried after the next sample
+  int evict;
+  /// Number of samples dropped for lack of free blocks
+  unsigned long long dropped;
+  /// Energy reported by dropped samples, added to the next stored one
+  unsigned long long carried;
+  /// Measurement nesting level we are currently at (read by the sampler)
   size_t level;
   /// Stack containing start point/block for nested measurements
   struct emlDataBlock* firstblock[MEASUREMENT_STACK_SIZE];
   size_t firstpoint[MEASUREMENT_STACK_SIZE];
-
-  /// Total gathered data points
-  size_t npoints;
-  /// Current data block
-  struct emlDataBlock* curblk;
-  /// Mutex for current point/block between monitor and main threads
-  pthread_mutex_t pointlock;
+  /// Stack containing running totals at the start of nested measurements
+  /// (used for totals-only results and live totals)
+  unsigned long long firstenergy[MEASUREMENT_STACK_SIZE];
+  unsigned long long firsttime[MEASUREMENT_STACK_SIZE];
+
+  /// Sequence counter for sampling progress and the innermost section (odd
+  /// while being updated).
+  ///
+  /// The sampler is the only writer of progress, and the main thread of the
+  /// section. Both are published as a seqlock so that readers never block,
+  /// and writers only wait for each other for a few stores.
+  unsigned int seq;
+  /// Sampling progress
+  struct emlProgress progress;
+  /// Start of the innermost section
+  struct emlSection section;
+  /// Field values for the last data point (read by the sampler only)
+  unsigned long long lastpoint[EML_DATAPOINT_MAX_FIELDS];
+  /// Whether only running totals are kept, instead of every data point
+  int totals_only;
+  /// Whether totals are taken from counter snapshots, without periodic
+  /// samples (see emlDriver::counter_snapshots)
+  int snapshots;
+  /// Receives every new data point (NULL if none)
+  struct emlSubscriber* subscriber;
+  /// Samples all devices of the driver together (NULL if the driver measures
+  /// devices one by one)
+  struct emlBatch* batch;
+  /// Writes full blocks to a file while the run goes on (NULL if not streaming)
+  struct emlStream* stream;
+  /// File descriptor set through emlDeviceSetStream (-1 if none)
+  int stream_fd;
+  /// Directory in which a stream file is created for every run (NULL if none)
+  char* stream_dir;
+  /// Number of runs streamed to stream_dir so far
+  unsigned long long stream_runs;
+
+  /// Sampling interval in nanoseconds
+  unsigned long long interval;
+  /// How deadlines are computed for consecutive samples
+  enum emlSamplingPolicy policy;
+  /// Number of sampling deadlines missed so far
+  unsigned long long overruns;
+
+  /// Maximum number of blocks kept for a run (0 for no limit)
+  size_t retention_blocks;
+  /// Maximum age of blocks kept for a run in nanoseconds (0 for no limit)
+  unsigned long long retention_time;
+  /// Whether full blocks are compressed
+  int compress_blocks;
+  /// Whether a data point is taken whenever a measurement is started or
+  /// stopped, besides periodic samples
+  int section_samples;
+  /// Serializes samples when section samples are taken from the main thread
+  pthread_mutex_t samplelock;
 };
 
-static void* monitor_thread(void* arg) {
-  const struct emlDevice* dev = arg;
-  const long delay_ns = cfg_getint(dev->driver->config, "sampling_interval");
+//progress is written by the sampler only, and the section by the main thread
+//only (either may be NULL)
+static void publish_progress(
+    struct emlMonitor* const mon,
+    const struct emlProgress* const progress,
+    const struct emlSection* const section)
+{
+  //make seq odd, unless the other writer is in the middle of an update
+  unsigned int seq = __atomic_load_n(&mon->seq, __ATOMIC_RELAXED);
+  while ((seq & 1) || !__atomic_compare_exchange_n(&mon->seq, &seq, seq + 1, 1,
+        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    seq = __atomic_load_n(&mon->seq, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  if (section) {
+    __atomic_store_n(&mon->section.level, section->level, __ATOMIC_RELAXED);
+    __atomic_store_n(&mon->section.firstpoint, section->firstpoint, __ATOMIC_RELAXED);
+    __atomic_store_n(&mon->section.firstenergy, section->firstenergy, __ATOMIC_RELAXED);
+    __atomic_store_n(&mon->section.firsttime, section->firsttime, __ATOMIC_RELAXED);
+  }
+  if (!progress) {
+    __atomic_store_n(&mon->seq, seq + 2, __ATOMIC_RELEASE);
+    return;
+  }
+
+  __atomic_store_n(&mon->progress.npoints, progress->npoints, __ATOMIC_RELAXED);
+  __atomic_store_n(&mon->progress.curblk, progress->curblk, __ATOMIC_RELAXED);
+  __atomic_store_n(&mon->progress.energy, progress->energy, __ATOMIC_RELAXED);
+  __atomic_store_n(&mon->progress.firsttime, progress->firsttime, __ATOMIC_RELAXED);
+  __atomic_store_n(&mon->progress.lasttime, progress->lasttime, __ATOMIC_RELAXED);
+  __atomic_store_n(&mon->progress.prevtime, progress->prevtime, __ATOMIC_RELAXED);
+  __atomic_store_n(&mon->progress.laststep, progress->laststep, __ATOMIC_RELAXED);
+  __atomic_store_n(&mon->progress.lastpower, progress->lastpower, __ATOMIC_RELAXED);
+
+  //releases the new datapoint along with the counters
+  __atomic_store_n(&mon->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+//never blocks: retries only if a writer was publishing at the same time
+//(section may be NULL)
+static void read_progress(
+    const struct emlMonitor* const mon,
+    struct emlProgress* const progress,
+    struct emlSection* const section)
+{
+  unsigned int seq;
+  do {
+    seq = __atomic_load_n(&mon->seq, __ATOMIC_ACQUIRE);
+    if (section) {
+      section->level = __atomic_load_n(&mon->section.level, __ATOMIC_RELAXED);
+      section->firstpoint = __atomic_load_n(&mon->section.firstpoint, __ATOMIC_RELAXED);
+      section->firstenergy = __atomic_load_n(&mon->section.firstenergy, __ATOMIC_RELAXED);
+      section->firsttime = __atomic_load_n(&mon->section.firsttime, __ATOMIC_RELAXED);
+    }
+    progress->npoints = __atomic_load_n(&mon->progress.npoints, __ATOMIC_RELAXED);
+    progress->curblk = __atomic_load_n(&mon->progress.curblk, __ATOMIC_RELAXED);
+    progress->energy = __atomic_load_n(&mon->progress.energy, __ATOMIC_RELAXED);
+    progress->firsttime = __atomic_load_n(&mon->progress.firsttime, __ATOMIC_RELAXED);
+    progress->lasttime = __atomic_load_n(&mon->progress.lasttime, __ATOMIC_RELAXED);
+    progress->prevtime = __atomic_load_n(&mon->progress.prevtime, __ATOMIC_RELAXED);
+    progress->laststep = __atomic_load_n(&mon->progress.laststep, __ATOMIC_RELAXED);
+    progress->lastpower = __atomic_load_n(&mon->progress.lastpower, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || seq != __atomic_load_n(&mon->seq, __ATOMIC_RELAXED));
+}
 
-  static const long NS_PER_SEC = 1000000000L;
-  const struct timespec delay = {
-    .tv_sec = delay_ns / NS_PER_SEC,
-    .tv_nsec = delay_ns % NS_PER_SEC,
+//sets the nesting level, publishing the start of the innermost section for
+//live totals (called from the main thread only)
+static void set_level(struct emlMonitor* const mon, const size_t level) {
+  struct emlSection section = {
+    .level = level,
   };
+  if (level) {
+    section.firstpoint = mon->firstpoint[level - 1];
+    section.firstenergy = mon->firstenergy[level - 1];
+    section.firsttime = mon->firsttime[level - 1];
+  }
+  publish_progress(mon, NULL, &section);
+  __atomic_store_n(&mon->level, level, __ATOMIC_RELAXED);
+}
+
+//never blocks, so that the sampler never waits for memory allocation
+static void request_housekeeping(struct emlMonitor* const mon) {
+  if (!__atomic_exchange_n(&mon->housekeep, 1, __ATOMIC_RELEASE))
+    emlHousekeeperWake();
+}
+
+enum emlError emlDeviceMonitorStore(
+    const struct emlDevice* const dev,
+    unsigned long long* const point,
+    int* const stored)
+{
   struct emlMonitor* mon = dev->monitor;
+  const struct emlDataProperties* props = mon->run->props;
+
+  //the sampler is the only writer, so its own progress can be read directly
+  struct emlProgress progress = mon->progress;
+
+  //take a preallocated block and insert it if current is full
+  struct emlDataBlock* thisblk = progress.curblk;
+  size_t i = thisblk ? progress.npoints - thisblk->first : 0;
+  const int needblock = thisblk && i == thisblk->size;
+  if (needblock) {
+    const size_t size = emlDataBlockNextSize(thisblk->size);
+    thisblk = emlDataBlockPoolTake(mon->pool, size);
+    if (!thisblk) {
+      //drop this sample rather than stopping, more blocks may be freed later
+      if (!mon->dropped)
+        dbglog_error("%s: out of free blocks, dropping samples", dev->name);
+      __atomic_fetch_add(&mon->dropped, 1, __ATOMIC_RELAXED);
+      if (props->inst_energy_field)
+        mon->carried += point[props->inst_energy_field];
+      request_housekeeping(mon);
+      *stored = 0;
+      return EML_SUCCESS;
+    }
+    thisblk->first = progress.npoints;
+    i = 0;
+    thisblk->refs = 0;
+    SLIST_INSERT_AFTER(progress.curblk, thisblk, entries);
+    mon->run->nblocks++;
+    progress.curblk = thisblk;
+
+    //the previous blocks are full and will not change anymore
+    if (mon->stream)
+      emlStreamNotify(mon->stream, thisblk->first);
+  }
 
-  size_t nfields = 1;
-  if (mon->run->props->inst_energy_field) nfields++;
-  if (mon->run->props->inst_power_field) nfields++;
+  //store the datapoint in the current block, if any
+  if (props->inst_energy_field) {
+    point[props->inst_energy_field] += mon->carried;
+    mon->carried = 0;
+  }
+  if (thisblk) {
+    for (size_t field = 0; field < mon->pool->nfields; field++)
+      thisblk->fields[field * thisblk->size + i] = point[field];
+  }
 
-  //as long as there is at least one ongoing measurement on this device:
-  while (mon->level) {
-    //allocate and insert a new block if current is full
-    struct emlDataBlock* thisblk = mon->curblk;
-    const size_t i = mon->npoints % DATABLOCK_SIZE;
-    const int needblock = !i && mon->npoints;
-    if (needblock) {
-      thisblk = malloc(sizeof(*thisblk));
-      if (!thisblk) goto mem_err;
-      thisblk->fields = calloc(nfields * DATABLOCK_SIZE, sizeof(*thisblk->fields));
-      if (!thisblk->fields) goto mem_err;
-      SLIST_INSERT_AFTER(mon->curblk, thisblk, entries);
+  //update running totals, recording the prefix sum for new blocks
+  if (progress.npoints) {
+    progress.laststep = emlDataPointEnergy(props, mon->lastpoint, point);
+    progress.energy += progress.laststep;
+  }
+  else {
+    progress.firsttime = point[timestamp_field];
+  }
+  progress.prevtime = progress.lasttime;
+  progress.lasttime = point[timestamp_field];
+  if (props->inst_power_field)
+    progress.lastpower = point[props->inst_power_field];
+  memcpy(mon->lastpoint, point, sizeof(mon->lastpoint));
+  progress.npoints++;
+  if (thisblk && !i)
+    thisblk->energy_base = progress.energy;
+  if (thisblk)
+    thisblk->energy[i] = progress.energy - thisblk->energy_base;
+
+  publish_progress(mon, &progress, NULL);
+
+  //push the new datapoint to the subscriber, in SI units
+  if (mon->subscriber) {
+    struct emlSample sample = {
+      .index = progress.npoints - 1,
+      .timestamp = emlDataApplyFactor(progress.lasttime, props->time_factor),
+      .energy = emlDataApplyFactor(progress.npoints > 1 ? progress.laststep : 0, props->energy_factor),
+      .power = 0,
+    };
+    if (props->inst_power_field)
+      sample.power = emlDataApplyFactor(progress.lastpower, props->power_factor);
+    else if (progress.npoints > 1 && progress.lasttime > progress.prevtime)
+      sample.power = sample.energy
+        / emlDataApplyFactor(progress.lasttime - progress.prevtime, props->time_factor);
+    emlSubscriberPush(mon->subscriber, &sample);
+  }
+
+  //have blocks for the next size prepared, now that the sample is out of the way
+  if (needblock)
+    request_housekeeping(mon);
+
+  //recycle old blocks and index new ones, unless the main thread (or the
+  //housekeeper) is busy with them right now
+  if (needblock || mon->evict) {
+    mon->evict = pthread_mutex_trylock(&mon->run->lock) != 0;
+    if (!mon->evict) {
+      const size_t level = __atomic_load_n(&mon->level, __ATOMIC_RELAXED);
+      if (mon->run->maxblocks || mon->run->maxtime)
+        emlDataRunEvict(mon->run, mon->firstpoint, level, progress.lasttime);
+      emlDataRunIndex(mon->run);
+      pthread_mutex_unlock(&mon->run->lock);
     }
+  }
+
+  *stored = 1;
+  return EML_SUCCESS;
+}
 
-    //get a new datapoint and wait
-    dev->driver->measure(dev->index, &thisblk->fields[i]);
+//stored is cleared if the sample had to be dropped
+static enum emlError sample(const struct emlDevice* const dev, int* const stored) {
+  unsigned long long point[EML_DATAPOINT_MAX_FIELDS] = {0};
+  dev->driver->measure(dev->index, point);
+  return emlDeviceMonitorStore(dev, point, stored);
+}
+
+enum emlError emlDeviceMonitorSample(const struct emlDevice* const dev) {
+  struct emlMonitor* mon = dev->monitor;
+  int stored;
+  if (!mon->section_samples)
+    return sample(dev, &stored);
+
+  //the main thread may be taking a section sample at the same time
+  pthread_mutex_lock(&mon->samplelock);
+  enum emlError err = sample(dev, &stored);
+  pthread_mutex_unlock(&mon->samplelock);
+  return err;
+}
 
-    pthread_mutex_lock(&mon->pointlock);
-    mon->npoints++;
-    mon->curblk = thisblk;
-    pthread_mutex_unlock(&mon->pointlock);
+//takes a fresh data point at a measurement boundary from the main thread,
+//if enabled, returning whether it was stored
+static int section_sample(const struct emlDevice* const device) {
+  struct emlMonitor* mon = device->monitor;
+  if (!mon->section_samples)
+    return 0;
+
+  //batched devices are sampled in order with the rest of the batch
+  int stored = 0;
+  enum emlError err;
+  if (mon->batch) {
+    err = emlBatchSampleDevice(mon->batch, device, &stored);
+  }
+  else {
+    pthread_mutex_lock(&mon->samplelock);
+    err = sample(device, &stored);
+    pthread_mutex_unlock(&mon->samplelock);
+  }
+  if (err != EML_SUCCESS) {
+    dbglog_warn("%s: section sample failed: %s", device->name, emlErrorMessage(err));
+    return 0;
+  }
+  return stored;
+}
 
-    struct timespec left = delay;
-    int err;
-    while ((err = clock_nanosleep(CLOCK_MONOTONIC, 0, &left, &left)) == EINTR);
+void emlDeviceMonitorHousekeep(const struct emlDevice* const device) {
+  struct emlMonitor* mon = device->monitor;
+  if (!__atomic_exchange_n(&mon->housekeep, 0, __ATOMIC_ACQUIRE))
+    return;
+
+  //the sampler takes blocks of the next size once the current one is full,
+  //and asks again after every sample it drops for lack of them (the current
+  //block is never evicted while the run lock is held)
+  struct emlProgress progress;
+  pthread_mutex_lock(&mon->run->lock);
+  read_progress(mon, &progress, NULL);
+  const size_t size = emlDataBlockNextSize(progress.curblk->size);
+  pthread_mutex_unlock(&mon->run->lock);
+  if (emlDataBlockPoolFill(mon->pool, size, EML_DATABLOCK_POOL_SIZE) != EML_SUCCESS)
+    dbglog_warn("%s: could not refill the block pool", device->name);
+
+  //blocks are only compressed once full, and written to the stream if any
+  if (mon->run->compress)
+    emlDataRunPack(mon->run, progress.npoints);
+}
 
-    assert(err != EINVAL);
-    assert(err != EFAULT);
-    assert(err != ENOTSUP);
+unsigned long long emlDeviceMonitorNextDeadline(
+    const struct emlDevice* const dev,
+    const unsigned long long deadline)
+{
+  struct emlMonitor* mon = dev->monitor;
+  const unsigned long long now = monotonictimestamp();
+  unsigned long long next = deadline + mon->interval;
+
+  switch (mon->policy) {
+    case EML_SAMPLING_SKIP:
+      //move on to the first tick that is not over yet
+      if (next <= now) {
+        const unsigned long long missed = (now - next) / mon->interval + 1;
+        __atomic_fetch_add(&mon->overruns, missed, __ATOMIC_RELAXED);
+        next += missed * mon->interval;
+      }
+      return next;
+
+    case EML_SAMPLING_CATCHUP:
+      //late ticks are due immediately
+      if (next <= now)
+        __atomic_fetch_add(&mon->overruns, 1, __ATOMIC_RELAXED);
+      return next;
+
+    case EML_SAMPLING_DELAY:
+    default:
+      return now + mon->interval;
   }
+}
 
-  return NULL;
+static void* monitor_thread(void* arg) {
+  const struct emlDevice* dev = arg;
+  struct emlMonitor* mon = dev->monitor;
+
+  unsigned long long deadline = monotonictimestamp();
+
+  //as long as there is at least one ongoing measurement on this device:
+  while (__atomic_load_n(&mon->level, __ATOMIC_RELAXED)) {
+    //get a new datapoint and wait until the next one is due
+    if (emlDeviceMonitorSample(dev) != EML_SUCCESS)
+      return NULL;
+
+    deadline = emlDeviceMonitorNextDeadline(dev, deadline);
+    const struct timespec wakeup = {
+      .tv_sec = deadline / NS_PER_SEC,
+      .tv_nsec = deadline % NS_PER_SEC,
+    };
+    int err = 0;
+    pthread_mutex_lock(&mon->wakelock);
+    while (__atomic_load_n(&mon->level, __ATOMIC_RELAXED) && err != ETIMEDOUT) {
+      err = pthread_cond_timedwait(&mon->wakecond, &mon->wakelock, &wakeup);
+      assert(err != EINVAL);
+    }
+    pthread_mutex_unlock(&mon->wakelock);
+  }
 
-mem_err:
-  dbglog_error("out of memory");
   return NULL;
 }
 
 enum emlError emlDeviceMonitorInit(struct emlDevice* const device) {
   device->monitor = malloc(sizeof(*device->monitor));
-  device->monitor->level = 0;
-  pthread_mutex_init(&device->monitor->pointlock, NULL);
+  if (!device->monitor)
+    return EML_NO_MEMORY;
+  struct emlMonitor* mon = device->monitor;
+
+  mon->level = 0;
+  mon->seq = 0;
+  memset(&mon->section, 0, sizeof(mon->section));
+  mon->overruns = 0;
+  mon->housekeep = 0;
+  mon->evict = 0;
+  mon->dropped = 0;
+  mon->carried = 0;
+  mon->subscriber = NULL;
+  mon->stream = NULL;
+  mon->stream_fd = -1;
+  mon->stream_dir = NULL;
+  mon->stream_runs = 0;
+
+  enum emlError ret = emlDataBlockPoolCreate(&mon->pool,
+      emlDataFieldCount(device->driver->default_props));
+  if (ret != EML_SUCCESS) {
+    free(device->monitor);
+    device->monitor = NULL;
+    return ret;
+  }
+
+  cfg_t* config = device->driver->config;
+  const long interval = cfg_getint(config, "sampling_interval");
+  mon->interval = interval > 0 ? interval : 1;
+
+  const char* policy = cfg_getstr(config, "sampling_policy");
+  if (!strcmp(policy, "skip"))
+    mon->policy = EML_SAMPLING_SKIP;
+  else if (!strcmp(policy, "catchup"))
+    mon->policy = EML_SAMPLING_CATCHUP;
+  else {
+    if (strcmp(policy, "delay"))
+      dbglog_warn("%s: unknown sampling_policy '%s', using 'delay'", device->name, policy);
+    mon->policy = EML_SAMPLING_DELAY;
+  }
+
+  const char* mode = cfg_getstr(config, "data_mode");
+  mon->totals_only = mode && !strcmp(mode, "totals");
+  if (mode && !mon->totals_only && strcmp(mode, "samples"))
+    dbglog_warn("%s: unknown data_mode '%s', using 'samples'", device->name, mode);
+
+  const long retention_blocks = cfg_getint(config, "retention_blocks");
+  const long retention_time = cfg_getint(config, "retention_time");
+  mon->retention_blocks = retention_blocks > 0 ? retention_blocks : 0;
+  mon->retention_time = retention_time > 0 ? retention_time : 0;
+  mon->compress_blocks = cfg_getbool(config, "compress_blocks");
+  mon->snapshots = mon->totals_only && device->driver->counter_snapshots;
+  mon->section_samples = mon->snapshots || cfg_getbool(config, "section_samples");
+  pthread_mutex_init(&mon->samplelock, NULL);
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&mon->wakecond, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_mutex_init(&mon->wakelock, NULL);
+
+  const char* stream_dir = cfg_getstr(config, "stream_dir");
+  if (stream_dir && *stream_dir) {
+    if (mon->totals_only)
+      dbglog_warn("%s: stream_dir ignored in 'totals' data_mode", device->name);
+    else
+      mon->stream_dir = strdup(stream_dir);
+  }
+
+  //devices are initialized in order, so the first one with a monitor creates
+  //the batch (snapshots are taken device by device, as measurements are started)
+  mon->batch = NULL;
+  if (device->driver->measure_all && !mon->snapshots) {
+    for (size_t i = 0; i < device->index && !mon->batch; i++) {
+      const struct emlMonitor* other = device->driver->devices[i].monitor;
+      if (other && other->batch) {
+        mon->batch = other->batch;
+        emlBatchRetain(mon->batch);
+      }
+    }
+    if (!mon->batch && emlBatchCreate(&mon->batch, device->driver) != EML_SUCCESS) {
+      dbglog_warn("%s: batched sampling disabled", device->name);
+      mon->batch = NULL;
+    }
+  }
+
   return EML_SUCCESS;
 }
 
@@ -115,78 +588,212 @@ enum emlError emlDeviceMonitorShutdown(struct emlDevice* const device) {
 
   if (mon->level) {
     //skip to last measurement level (forces the thread to be stopped)
-    device->monitor->level = 1;
-    struct emlData* discarded;
-    emlDeviceMonitorStop(device, &discarded);
-    emlDataFree(discarded);
+    __atomic_store_n(&mon->level, 1, __ATOMIC_RELAXED);
+    struct emlData* discarded = malloc(sizeof(*discarded));
+    if (discarded && emlDeviceMonitorStop(device, &discarded) == EML_SUCCESS)
+      emlDataFree(discarded);
+    else
+      free(discarded);
   }
 
-  pthread_mutex_destroy(&device->monitor->pointlock);
+  if (mon->subscriber)
+    emlSubscriberDestroy(mon->subscriber);
+  if (mon->batch)
+    emlBatchRelease(mon->batch);
+  free(mon->stream_dir);
+  emlDataBlockPoolRelease(mon->pool);
+  pthread_mutex_destroy(&mon->samplelock);
+  pthread_cond_destroy(&mon->wakecond);
+  pthread_mutex_destroy(&mon->wakelock);
   free(device->monitor);
   return EML_SUCCESS;
 }
 
+//writes the rest of the run, once the sampler is done with it
+static void close_stream(struct emlMonitor* const mon) {
+  if (!mon->stream)
+    return;
+
+  const struct emlProgress* progress = &mon->progress;
+  emlStreamClose(mon->stream, progress->npoints,
+      progress->npoints ? progress->lasttime - progress->firsttime : 0, progress->energy);
+  mon->stream = NULL;
+}
+
+//streams a new run to the configured file descriptor or directory, if any
+static enum emlError open_stream(const struct emlDevice* const device) {
+  struct emlMonitor* mon = device->monitor;
+
+  int fd = mon->stream_fd;
+  int closefd = 0;
+  if (fd < 0 && mon->stream_dir) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s-%ld-%llu.eml",
+        mon->stream_dir, device->name, (long) getpid(), mon->stream_runs++);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      dbglog_error("%s: could not create '%s': %s", device->name, path, strerror(errno));
+      return EML_UNKNOWN;
+    }
+    closefd = 1;
+  }
+  if (fd < 0)
+    return EML_SUCCESS;
+
+  enum emlError ret = emlStreamOpen(&mon->stream, fd, closefd, mon->run, device->name);
+  if (ret != EML_SUCCESS) {
+    if (closefd)
+      close(fd);
+    return ret;
+  }
+
+  //streamed blocks need not stay in memory, unless retention says otherwise
+  if (!mon->run->maxblocks && !mon->run->maxtime)
+    mon->run->maxblocks = EML_DATABLOCK_POOL_SIZE;
+  return EML_SUCCESS;
+}
+
 enum emlError emlDeviceMonitorStart(const struct emlDevice* const device) {
   struct emlMonitor* mon = device->monitor;
 
   //increase measurement nesting level unless the stack is full
-  if (mon->level == MEASUREMENT_STACK_SIZE)
+  const size_t level = mon->level + 1;
+  if (level > MEASUREMENT_STACK_SIZE)
     return EML_MEASUREMENT_STACK_FULL;
-  mon->level++;
 
   //if we weren't measuring before, start now
-  if (mon->level == 1) {
+  if (level == 1) {
+    //fill the pool so that the sampler never needs to allocate (runs start
+    //on a small block, so that short sections take little memory)
+    enum emlError ret = EML_SUCCESS;
+    if (!mon->totals_only)
+      ret = emlDataBlockPoolFill(mon->pool, DATABLOCK_MIN_SIZE, EML_DATABLOCK_POOL_SIZE + 1);
+    if (ret == EML_SUCCESS && !mon->totals_only)
+      ret = emlDataBlockPoolFill(mon->pool, emlDataBlockNextSize(DATABLOCK_MIN_SIZE),
+          EML_DATABLOCK_POOL_SIZE);
+    if (ret != EML_SUCCESS)
+      return ret;
+
     //init measurement run data
     mon->run = malloc(sizeof(*mon->run));
     if (!mon->run)
       return EML_NO_MEMORY;
-    mon->run->refcount = 0;
+    mon->run->refcount = 1;
     mon->run->device = device;
+    mon->run->devname = NULL;
     mon->run->props = device->driver->default_props;
-
-    size_t nfields = 1;
-    if (mon->run->props->inst_energy_field) nfields++;
-    if (mon->run->props->inst_power_field) nfields++;
-
-    //init blocklist and allocate first block
+    mon->run->pool = mon->pool;
+    __atomic_fetch_add(&mon->pool->refcount, 1, __ATOMIC_RELAXED);
+    mon->run->totals_only = mon->totals_only;
+    mon->run->streamed = SIZE_MAX;
+    mon->run->compress = mon->compress_blocks;
+    mon->run->npacked = 0;
+    mon->run->packing = NULL;
+    mon->run->index = NULL;
+    mon->run->nindexed = 0;
+    mon->run->indexcap = 0;
+    pthread_mutex_init(&mon->run->lock, NULL);
+
+    //convert retention age to device timestamp units
+    const int time_factor = mon->run->props->time_factor;
+    mon->run->maxblocks = mon->retention_blocks;
+    if (time_factor >= 0)
+      mon->run->maxtime = mon->retention_time / NS_PER_SEC / time_factor;
+    else
+      mon->run->maxtime = (double) mon->retention_time * (-time_factor) / NS_PER_SEC;
+    if (mon->retention_time && !mon->run->maxtime)
+      mon->run->maxtime = 1;
+
+    //init blocklist with the first block (the sampler is not running yet)
     SLIST_INIT(&mon->run->blocks);
-    mon->curblk = malloc(sizeof(*mon->curblk));
-    if (!mon->curblk) {
-      free(mon->run);
-      return EML_NO_MEMORY;
+    struct emlDataBlock* firstblk = NULL;
+    if (!mon->totals_only) {
+      firstblk = emlDataBlockPoolTake(mon->pool, DATABLOCK_MIN_SIZE);
+      assert(firstblk);
+      firstblk->first = 0;
+      firstblk->refs = 0;
+      SLIST_INSERT_HEAD(&mon->run->blocks, firstblk, entries);
     }
-    mon->curblk->fields = calloc(nfields * DATABLOCK_SIZE, sizeof(*mon->curblk->fields));
-    if (!mon->curblk->fields) {
-      free(mon->run);
-      free(mon->curblk);
-      return EML_NO_MEMORY;
-    }
-    SLIST_INSERT_HEAD(&mon->run->blocks, mon->curblk, entries);
-
-    mon->npoints = 0;
-    mon->firstblock[0] = mon->curblk;
+    mon->run->nblocks = firstblk ? 1 : 0;
+
+    //the sampler is not running, but live totals may be read at any time
+    struct emlProgress progress = {
+      .curblk = firstblk,
+    };
+    publish_progress(mon, &progress, NULL);
+    mon->housekeep = 0;
+    mon->evict = 0;
+    mon->carried = 0;
+    mon->firstblock[0] = firstblk;
     mon->firstpoint[0] = 0;
+    mon->firstenergy[0] = 0;
+    mon->firsttime[0] = 0;
+
+    //the housekeeper refills the pool while the run goes on, and the stream
+    //must be open before the first block is filled
+    mon->stream = NULL;
+    if (!mon->totals_only) {
+      ret = emlHousekeeperAdd(device);
+      if (ret == EML_SUCCESS && (ret = open_stream(device)) != EML_SUCCESS)
+        emlHousekeeperRemove(device);
+    }
+    if (ret != EML_SUCCESS) {
+      emlDataRunRelease(mon->run);
+      return ret;
+    }
+    set_level(mon, level);
+
+    //take the first snapshot and leave the rest to the watchdog, or have the
+    //device sampled with the rest of its driver, or hand the device over to
+    //the shared scheduler, or launch measuring thread
+    if (mon->snapshots) {
+      ret = EML_UNKNOWN;
+      if (section_sample(device))
+        ret = emlWatchdogAdd(device, device->driver->counter_period);
+    }
+    else if (mon->batch) {
+      ret = emlBatchJoin(mon->batch, device);
+    }
+    else if (emlSchedulerEnabled()) {
+      ret = emlSchedulerAdd(device);
+    }
+    else {
+      int err = pthread_create(&mon->measuring_thread,
+          NULL,
+          &monitor_thread,
+          (void*) device);
+
+      if (err) {
+        dbglog_error("pthread_create returned %d", err);
+        ret = EML_UNKNOWN;
+      }
+    }
 
-    //launch measuring thread
-    int err = pthread_create(&mon->measuring_thread,
-        NULL,
-        &monitor_thread,
-        (void*) device);
-
-    if (err) {
-      dbglog_error("pthread_create returned %d", err);
-      return EML_UNKNOWN;
+    if (ret != EML_SUCCESS) {
+      set_level(mon, 0);
+      if (!mon->totals_only)
+        emlHousekeeperRemove(device);
+      close_stream(mon);
+      emlDataRunRelease(mon->run);
+      return ret;
     }
+    return EML_SUCCESS;
   }
-  //if we were measuring, record start block
-  else {
-    pthread_mutex_lock(&mon->pointlock);
-    mon->firstblock[mon->level - 1] = mon->curblk;
-    mon->firstpoint[mon->level - 1] = mon->npoints;
-    pthread_mutex_unlock(&mon->pointlock);
-  }
-
-  mon->run->refcount++;
+  //if we were measuring, record start block (which must not be evicted)
+  const int sampled = section_sample(device);
+  struct emlProgress progress;
+  pthread_mutex_lock(&mon->run->lock);
+  read_progress(mon, &progress, NULL);
+  mon->firstblock[level - 1] = progress.curblk;
+  //a section sample starts the section (totals-only results start from the
+  //last data point before the section anyway)
+  mon->firstpoint[level - 1] = progress.npoints - (sampled && !mon->totals_only);
+  mon->firstenergy[level - 1] = progress.energy;
+  mon->firsttime[level - 1] = progress.lasttime;
+  set_level(mon, level);
+  pthread_mutex_unlock(&mon->run->lock);
+
+  __atomic_fetch_add(&mon->run->refcount, 1, __ATOMIC_RELAXED);
 
   return EML_SUCCESS;
 }
@@ -200,26 +807,202 @@ enum emlError emlDeviceMonitorStop(
   if (!mon->level)
     return EML_NOT_STARTED;
 
-  pthread_mutex_lock(&mon->pointlock);
-  const size_t endnpoints = mon->npoints;
-  pthread_mutex_unlock(&mon->pointlock);
+  section_sample(device);
+  struct emlProgress progress;
+  pthread_mutex_lock(&mon->run->lock);
+  read_progress(mon, &progress, NULL);
+
+  //return interval data
+  const size_t level = mon->level - 1;
+  struct emlData* d = *result;
+  d->run = mon->run;
+  d->firstblock = mon->firstblock[level];
+  d->firstpoint = mon->firstpoint[level];
+  d->npoints = progress.npoints - d->firstpoint;
+
+  if (mon->totals_only) {
+    //totals run from the last datapoint before the section was started
+    unsigned long long firsttime = progress.firsttime;
+    if (d->firstpoint) {
+      d->firstpoint--;
+      d->npoints++;
+      firsttime = mon->firsttime[level];
+    }
+    d->elapsed_time = d->npoints ? progress.lasttime - firsttime : 0;
+    d->consumed_energy = progress.energy - mon->firstenergy[level];
+  }
+  else {
+    //a section started right after a block was filled begins on the next one
+    if (d->firstpoint == d->firstblock->first + d->firstblock->size && d->npoints)
+      d->firstblock = SLIST_NEXT(d->firstblock, entries);
+
+    //blocks for the interval are kept as long as the dataset lives
+    d->firstblock->refs++;
+
+    //totals are the difference between the running totals and the prefix
+    //sum at the first datapoint, so only the first block is read
+    d->elapsed_time = 0;
+    d->consumed_energy = 0;
+    if (d->npoints) {
+      const size_t first = d->firstpoint - d->firstblock->first;
+      d->elapsed_time = progress.lasttime
+        - emlDataBlockValue(d->firstblock, timestamp_field, first);
+      d->consumed_energy = progress.energy
+        - emlDataEnergyAt(d->firstblock, first);
+    }
+  }
 
   //decrease level and stop measuring if 0
-  mon->level--;
-  if (!mon->level) {
-    int err = pthread_join(mon->measuring_thread, NULL);
+  set_level(mon, level);
+  pthread_mutex_unlock(&mon->run->lock);
+  if (!level) {
+    int err = 0;
+    if (mon->snapshots) {
+      emlWatchdogRemove(device);
+    }
+    else if (mon->batch) {
+      err = emlBatchLeave(mon->batch, device) != EML_SUCCESS;
+    }
+    else if (emlSchedulerEnabled()) {
+      emlSchedulerRemove(device);
+    }
+    else {
+      pthread_mutex_lock(&mon->wakelock);
+      pthread_cond_signal(&mon->wakecond);
+      pthread_mutex_unlock(&mon->wakelock);
+      err = pthread_join(mon->measuring_thread, NULL);
+    }
     if (err) {
+      //neither the housekeeper nor the stream writer may touch the run once
+      //it is released
+      if (!mon->totals_only)
+        emlHousekeeperRemove(device);
+      close_stream(mon);
+      if (d->firstblock)
+        d->firstblock->refs--;
       emlDataRunRelease(mon->run);
       return EML_UNKNOWN;
     }
+    close_stream(mon);
+
+    //the sampler may have left the last blocks out of the index
+    if (!mon->totals_only) {
+      emlHousekeeperRemove(device);
+      pthread_mutex_lock(&mon->run->lock);
+      emlDataRunIndex(mon->run);
+      pthread_mutex_unlock(&mon->run->lock);
+    }
   }
 
-  //return interval data
-  struct emlData* d = *result;
-  d->run = mon->run;
-  d->firstblock = mon->firstblock[mon->level];
-  d->firstpoint = mon->firstpoint[mon->level];
-  d->npoints = endnpoints - d->firstpoint;
+  return EML_SUCCESS;
+}
 
+enum emlError emlDeviceMonitorGetOverruns(
+    const struct emlDevice* const device,
+    unsigned long long* const overruns)
+{
+  *overruns = __atomic_load_n(&device->monitor->overruns, __ATOMIC_RELAXED);
+  return EML_SUCCESS;
+}
+
+enum emlError emlDeviceMonitorGetLiveTotals(
+    const struct emlDevice* const device,
+    double* const consumed,
+    double* const elapsed,
+    double* const power)
+{
+  const struct emlMonitor* mon = device->monitor;
+
+  //the run is not touched, as it may be released at any time
+  struct emlProgress progress;
+  struct emlSection section;
+  read_progress(mon, &progress, &section);
+  if (!section.level)
+    return EML_NOT_STARTED;
+
+  //count from the last datapoint before the innermost section was started
+  const unsigned long long firsttime = section.firstpoint ?
+    section.firsttime : progress.firsttime;
+
+  const struct emlDataProperties* props = device->driver->default_props;
+  *consumed = emlDataApplyFactor(progress.energy - section.firstenergy, props->energy_factor);
+  *elapsed = progress.npoints ?
+    emlDataApplyFactor(progress.lasttime - firsttime, props->time_factor) : 0;
+
+  //use the last power reading, or the power over the last sampling interval
+  if (props->inst_power_field)
+    *power = emlDataApplyFactor(progress.lastpower, props->power_factor);
+  else if (progress.npoints > 1 && progress.lasttime > progress.prevtime)
+    *power = emlDataApplyFactor(progress.laststep, props->energy_factor)
+      / emlDataApplyFactor(progress.lasttime - progress.prevtime, props->time_factor);
+  else
+    *power = 0;
+
+  return EML_SUCCESS;
+}
+
+enum emlError emlDeviceMonitorSubscribe(
+    const struct emlDevice* const device,
+    const emlSampleCallback_t callback,
+    void* const ctx,
+    const size_t decimation,
+    const enum emlDelivery delivery)
+{
+  struct emlMonitor* mon = device->monitor;
+
+  //the sampler reads the subscriber without synchronization
+  if (mon->level)
+    return EML_ALREADY_STARTED;
+
+  struct emlSubscriber* sub = NULL;
+  if (callback) {
+    enum emlError ret = emlSubscriberCreate(&sub, device, callback, ctx, decimation, delivery);
+    if (ret != EML_SUCCESS)
+      return ret;
+  }
+  else if (!mon->subscriber) {
+    return EML_NOT_STARTED;
+  }
+
+  if (mon->subscriber)
+    emlSubscriberDestroy(mon->subscriber);
+  mon->subscriber = sub;
+
+  return EML_SUCCESS;
+}
+
+enum emlError emlDeviceMonitorSetStream(
+    const struct emlDevice* const device,
+    const int fd)
+{
+  struct emlMonitor* mon = device->monitor;
+
+  //the stream for a run is opened when it starts
+  if (mon->level)
+    return EML_ALREADY_STARTED;
+  if (fd >= 0 && mon->totals_only)
+    return EML_UNSUPPORTED;
+
+  mon->stream_fd = fd;
+  return EML_SUCCESS;
+}
+
+enum emlError emlDeviceMonitorGetSubscriberDrops(
+    const struct emlDevice* const device,
+    unsigned long long* const drops)
+{
+  const struct emlMonitor* mon = device->monitor;
+  if (!mon->subscriber)
+    return EML_NOT_STARTED;
+
+  *drops = emlSubscriberDrops(mon->subscriber);
+  return EML_SUCCESS;
+}
+
+enum emlError emlDeviceMonitorGetDropped(
+    const struct emlDevice* const device,
+    unsigned long long* const dropped)
+{
+  *dropped = __atomic_load_n(&device->monitor->dropped, __ATOMIC_RELAXED);
   return EML_SUCCESS;
 }
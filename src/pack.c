@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include <stdlib.h>
+
+#include "data.h"
+#include "error.h"
+#include "pack.h"
+
+static unsigned long long zigzag(const unsigned long long diff) {
+  return (diff << 1) ^ (0 - (diff >> 63));
+}
+
+static unsigned long long unzigzag(const unsigned long long value) {
+  return (value >> 1) ^ (0 - (value & 1));
+}
+
+//writes a value if dst is not NULL, returning its encoded length
+static size_t put_varint(unsigned char* const dst, unsigned long long value) {
+  size_t len = 0;
+  while (value >= 0x80) {
+    if (dst)
+      dst[len] = (value & 0x7f) | 0x80;
+    value >>= 7;
+    len++;
+  }
+  if (dst)
+    dst[len] = value;
+  return len + 1;
+}
+
+static unsigned long long get_varint(const unsigned char** const src) {
+  const unsigned char* p = *src;
+  unsigned long long value = 0;
+  unsigned shift = 0;
+  while (*p & 0x80) {
+    value |= (unsigned long long) (*p++ & 0x7f) << shift;
+    shift += 7;
+  }
+  value |= (unsigned long long) *p++ << shift;
+  *src = p;
+  return value;
+}
+
+//encodes a column (or just measures it, if dst is NULL)
+static size_t encode_column(
+    unsigned char* const dst,
+    const unsigned long long* const values,
+    const size_t nvalues,
+    const size_t field)
+{
+  size_t len = put_varint(dst, values[0]);
+  unsigned long long delta = 0;
+  for (size_t i = 1; i < nvalues; i++) {
+    const unsigned long long diff = values[i] - values[i - 1];
+    unsigned char* const p = dst ? dst + len : NULL;
+    if (field == timestamp_field) {
+      len += put_varint(p, zigzag(diff - delta));
+      delta = diff;
+    }
+    else {
+      len += put_varint(p, zigzag(diff));
+    }
+  }
+  return len;
+}
+
+enum emlError emlDataBlockPack(
+    const struct emlDataBlock* const block,
+    const size_t nfields,
+    unsigned char** const packed,
+    size_t* const packedoff)
+{
+  const size_t n = block->size;
+  size_t size = 0;
+  for (size_t field = 0; field < nfields; field++)
+    size += encode_column(NULL, block->fields + field * n, n, field);
+  if (size >= nfields * n * sizeof(*block->fields))
+    return EML_UNSUPPORTED;
+
+  unsigned char* p = malloc(size);
+  if (!p)
+    return EML_NO_MEMORY;
+
+  size_t offset = 0;
+  for (size_t field = 0; field < nfields; field++) {
+    packedoff[field] = offset;
+    offset += encode_column(p + offset, block->fields + field * n, n, field);
+  }
+
+  *packed = p;
+  return EML_SUCCESS;
+}
+
+void emlDataBlockSetPacked(
+    struct emlDataBlock* const block,
+    const size_t nfields,
+    unsigned char* const packed,
+    const size_t* const packedoff)
+{
+  for (size_t field = 0; field < nfields; field++)
+    block->packedoff[field] = packedoff[field];
+
+  free(block->fields);
+  block->fields = NULL;
+  block->packed = packed;
+}
+
+void emlPackedColumnInit(
+    struct emlPackedColumn* const column,
+    const struct emlDataBlock* const block,
+    const size_t field)
+{
+  column->p = block->packed + block->packedoff[field];
+  column->value = 0;
+  column->delta = 0;
+}
+
+unsigned long long emlPackedColumnNext(
+    struct emlPackedColumn* const column,
+    const size_t field,
+    const int first)
+{
+  const unsigned long long encoded = get_varint(&column->p);
+  if (first)
+    column->value = encoded;
+  else if (field == timestamp_field) {
+    column->delta += unzigzag(encoded);
+    column->value += column->delta;
+  }
+  else
+    column->value += unzigzag(encoded);
+  return column->value;
+}
+
+void emlDataBlockReaderInit(
+    struct emlDataBlockReader* const reader,
+    const struct emlDataBlock* const block,
+    const size_t nfields,
+    const size_t i)
+{
+  reader->fields = block->fields;
+  reader->size = block->size;
+  reader->nfields = nfields;
+  reader->i = 0;
+  if (block->fields) {
+    reader->i = i;
+    return;
+  }
+
+  for (size_t field = 0; field < nfields; field++)
+    emlPackedColumnInit(&reader->columns[field], block, field);
+  unsigned long long point[EML_DATAPOINT_MAX_FIELDS];
+  while (reader->i < i)
+    emlDataBlockReaderNext(reader, point);
+}
+
+void emlDataBlockReaderNext(
+    struct emlDataBlockReader* const reader,
+    unsigned long long* const point)
+{
+  const size_t i = reader->i++;
+  if (reader->fields) {
+    for (size_t field = 0; field < reader->nfields; field++)
+      point[field] = reader->fields[field * reader->size + i];
+    return;
+  }
+
+  for (size_t field = 0; field < reader->nfields; field++)
+    point[field] = emlPackedColumnNext(&reader->columns[field], field, !i);
+}
+
+unsigned long long emlDataBlockValue(
+    const struct emlDataBlock* const block,
+    const size_t field,
+    const size_t i)
+{
+  if (block->fields)
+    return block->fields[field * block->size + i];
+
+  struct emlPackedColumn column;
+  emlPackedColumnInit(&column, block, field);
+  unsigned long long value = 0;
+  for (size_t j = 0; j <= i; j++)
+    value = emlPackedColumnNext(&column, field, !j);
+  return value;
+}
@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+//feature test macro for pthread_condattr_setclock(), etc
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "batch.h"
+#include "debug.h"
+#include "device.h"
+#include "monitor.h"
+#include "scheduler.h"
+#include "timer.h"
+
+static const unsigned long long NS_PER_SEC = 1000000000ULL;
+
+/// A device (or batch of devices) waiting for its next sample
+struct emlSchedEntry {
+  /// Device to be sampled (NULL for batches)
+  const struct emlDevice* device;
+  /// Batch to be sampled (NULL for single devices)
+  struct emlBatch* batch;
+  /// Time of the next sample (in monotonictimestamp() units)
+  unsigned long long deadline;
+};
+
+/// Sample in progress on a pool thread
+struct emlSchedSlot {
+  /// Thread taking the samples
+  pthread_t thread;
+  /// Entry being sampled
+  struct emlSchedEntry entry;
+  /// Whether a sample is in progress
+  int busy;
+  /// Whether the entry was removed while being sampled
+  int cancelled;
+};
+
+/// Shared scheduler state
+static struct {
+  /// Sampling threads
+  struct emlSchedSlot* slots;
+  size_t nthreads;
+  /// Min-heap of scheduled entries, ordered by deadline
+  struct emlSchedEntry* queue;
+  size_t queuelen;
+  size_t queuecap;
+
+  /// Protects all scheduler state
+  pthread_mutex_t lock;
+  /// Wakes the thread waiting for the earliest deadline
+  pthread_cond_t leadercond;
+  /// Wakes idle threads when a new leader is needed
+  pthread_cond_t followercond;
+  /// Signaled when an in-progress sample is complete
+  pthread_cond_t donecond;
+  /// Whether a thread is already waiting for the earliest deadline
+  int leader;
+  /// Whether the pool is shutting down
+  int stopping;
+} sched;
+
+static struct timespec to_timespec(unsigned long long ns) {
+  struct timespec ts = {
+    .tv_sec = ns / NS_PER_SEC,
+    .tv_nsec = ns % NS_PER_SEC,
+  };
+  return ts;
+}
+
+static void queue_swap(size_t i, size_t j) {
+  struct emlSchedEntry tmp = sched.queue[i];
+  sched.queue[i] = sched.queue[j];
+  sched.queue[j] = tmp;
+}
+
+static void queue_siftup(size_t i) {
+  while (i) {
+    size_t parent = (i - 1) / 2;
+    if (sched.queue[parent].deadline <= sched.queue[i].deadline)
+      break;
+    queue_swap(i, parent);
+    i = parent;
+  }
+}
+
+static void queue_siftdown(size_t i) {
+  for (;;) {
+    size_t min = i;
+    size_t left = 2 * i + 1;
+    size_t right = left + 1;
+    if (left < sched.queuelen && sched.queue[left].deadline < sched.queue[min].deadline)
+      min = left;
+    if (right < sched.queuelen && sched.queue[right].deadline < sched.queue[min].deadline)
+      min = right;
+    if (min == i)
+      break;
+    queue_swap(i, min);
+    i = min;
+  }
+}
+
+//space must have been reserved by the caller
+static void queue_push(const struct emlSchedEntry* entry) {
+  assert(sched.queuelen < sched.queuecap);
+  sched.queue[sched.queuelen] = *entry;
+  queue_siftup(sched.queuelen++);
+}
+
+static void queue_remove(size_t i, struct emlSchedEntry* entry) {
+  *entry = sched.queue[i];
+  sched.queuelen--;
+  if (i < sched.queuelen) {
+    sched.queue[i] = sched.queue[sched.queuelen];
+    queue_siftup(i);
+    queue_siftdown(i);
+  }
+}
+
+static int same_target(const struct emlSchedEntry* a, const struct emlSchedEntry* b) {
+  return a->device == b->device && a->batch == b->batch;
+}
+
+static enum emlError sample_entry(const struct emlSchedEntry* entry) {
+  if (entry->batch)
+    return emlBatchSample(entry->batch);
+  return emlDeviceMonitorSample(entry->device);
+}
+
+static unsigned long long next_deadline(const struct emlSchedEntry* entry) {
+  if (entry->batch)
+    return emlBatchNextDeadline(entry->batch, entry->deadline);
+  return emlDeviceMonitorNextDeadline(entry->device, entry->deadline);
+}
+
+static void* scheduler_thread(void* arg) {
+  struct emlSchedSlot* slot = arg;
+
+  pthread_mutex_lock(&sched.lock);
+  while (!sched.stopping) {
+    //only one thread (the leader) waits for the earliest deadline
+    if (!sched.queuelen || sched.leader) {
+      pthread_cond_wait(&sched.followercond, &sched.lock);
+      continue;
+    }
+
+    const unsigned long long deadline = sched.queue[0].deadline;
+    if (deadline > monotonictimestamp()) {
+      struct timespec abstime = to_timespec(deadline);
+      sched.leader = 1;
+      int err = pthread_cond_timedwait(&sched.leadercond, &sched.lock, &abstime);
+      sched.leader = 0;
+      assert(err != EINVAL);
+      (void) err;
+      //the queue may have changed while waiting
+      continue;
+    }
+
+    //take the due entry and let another thread wait for the next one
+    queue_remove(0, &slot->entry);
+    slot->busy = 1;
+    slot->cancelled = 0;
+    if (sched.queuelen)
+      pthread_cond_signal(&sched.followercond);
+    pthread_mutex_unlock(&sched.lock);
+
+    enum emlError err = sample_entry(&slot->entry);
+
+    pthread_mutex_lock(&sched.lock);
+    slot->busy = 0;
+    if (slot->cancelled) {
+      pthread_cond_broadcast(&sched.donecond);
+    }
+    else if (err != EML_SUCCESS) {
+      dbglog_error("%s: sampling stopped: %s",
+          slot->entry.batch ? emlBatchName(slot->entry.batch) : slot->entry.device->name,
+          emlErrorMessage(err));
+    }
+    else {
+      slot->entry.deadline = next_deadline(&slot->entry);
+      queue_push(&slot->entry);
+
+      //if there is no leader, this thread will take over on the next loop
+      if (sched.leader && same_target(&sched.queue[0], &slot->entry))
+        pthread_cond_signal(&sched.leadercond);
+    }
+  }
+  pthread_mutex_unlock(&sched.lock);
+
+  return NULL;
+}
+
+enum emlError emlSchedulerInit(size_t nthreads) {
+  assert(!sched.nthreads);
+
+  if (!nthreads)
+    return EML_SUCCESS;
+
+  sched.slots = calloc(nthreads, sizeof(*sched.slots));
+  if (!sched.slots)
+    return EML_NO_MEMORY;
+
+  sched.queue = NULL;
+  sched.queuelen = 0;
+  sched.queuecap = 0;
+  sched.leader = 0;
+  sched.stopping = 0;
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&sched.leadercond, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_cond_init(&sched.followercond, NULL);
+  pthread_cond_init(&sched.donecond, NULL);
+  pthread_mutex_init(&sched.lock, NULL);
+
+  for (sched.nthreads = 0; sched.nthreads < nthreads; sched.nthreads++) {
+    struct emlSchedSlot* slot = &sched.slots[sched.nthreads];
+    int err = pthread_create(&slot->thread, NULL, &scheduler_thread, slot);
+    if (err) {
+      dbglog_error("pthread_create returned %d", err);
+      emlSchedulerShutdown();
+      return EML_UNKNOWN;
+    }
+  }
+
+  return EML_SUCCESS;
+}
+
+enum emlError emlSchedulerShutdown() {
+  if (!sched.slots)
+    return EML_SUCCESS;
+
+  pthread_mutex_lock(&sched.lock);
+  assert(!sched.queuelen);
+  sched.stopping = 1;
+  pthread_cond_broadcast(&sched.leadercond);
+  pthread_cond_broadcast(&sched.followercond);
+  pthread_mutex_unlock(&sched.lock);
+
+  for (size_t i = 0; i < sched.nthreads; i++)
+    pthread_join(sched.slots[i].thread, NULL);
+
+  pthread_cond_destroy(&sched.leadercond);
+  pthread_cond_destroy(&sched.followercond);
+  pthread_cond_destroy(&sched.donecond);
+  pthread_mutex_destroy(&sched.lock);
+
+  free(sched.queue);
+  free(sched.slots);
+  sched.queue = NULL;
+  sched.slots = NULL;
+  sched.nthreads = 0;
+
+  return EML_SUCCESS;
+}
+
+int emlSchedulerEnabled() {
+  return sched.nthreads > 0;
+}
+
+static enum emlError add_entry(struct emlSchedEntry* const entry) {
+  assert(emlSchedulerEnabled());
+
+  entry->deadline = monotonictimestamp();
+
+  pthread_mutex_lock(&sched.lock);
+
+  //reserve space for every scheduled entry, including those being sampled
+  if (sched.queuelen + sched.nthreads >= sched.queuecap) {
+    size_t newcap = sched.queuecap ? 2 * sched.queuecap : 2 * sched.nthreads;
+    struct emlSchedEntry* newqueue = realloc(sched.queue, newcap * sizeof(*newqueue));
+    if (!newqueue) {
+      pthread_mutex_unlock(&sched.lock);
+      return EML_NO_MEMORY;
+    }
+    sched.queue = newqueue;
+    sched.queuecap = newcap;
+  }
+
+  queue_push(entry);
+
+  //the new entry is due now, so it is always the earliest deadline
+  if (sched.leader)
+    pthread_cond_signal(&sched.leadercond);
+  else
+    pthread_cond_signal(&sched.followercond);
+
+  pthread_mutex_unlock(&sched.lock);
+  return EML_SUCCESS;
+}
+
+static enum emlError remove_entry(const struct emlSchedEntry* const entry) {
+  enum emlError ret = EML_NOT_STARTED;
+
+  pthread_mutex_lock(&sched.lock);
+
+  for (size_t i = 0; i < sched.queuelen; i++) {
+    if (same_target(&sched.queue[i], entry)) {
+      struct emlSchedEntry discarded;
+      queue_remove(i, &discarded);
+      ret = EML_SUCCESS;
+      break;
+    }
+  }
+
+  //wait for the sample in progress, if any
+  for (size_t i = 0; i < sched.nthreads && ret != EML_SUCCESS; i++) {
+    struct emlSchedSlot* slot = &sched.slots[i];
+    if (slot->busy && same_target(&slot->entry, entry)) {
+      slot->cancelled = 1;
+      while (slot->busy)
+        pthread_cond_wait(&sched.donecond, &sched.lock);
+      ret = EML_SUCCESS;
+    }
+  }
+
+  pthread_mutex_unlock(&sched.lock);
+  return ret;
+}
+
+enum emlError emlSchedulerAdd(const struct emlDevice* const device) {
+  struct emlSchedEntry entry = {
+    .device = device,
+    .batch = NULL,
+  };
+  return add_entry(&entry);
+}
+
+enum emlError emlSchedulerAddBatch(struct emlBatch* const batch) {
+  struct emlSchedEntry entry = {
+    .device = NULL,
+    .batch = batch,
+  };
+  return add_entry(&entry);
+}
+
+enum emlError emlSchedulerRemove(const struct emlDevice* const device) {
+  const struct emlSchedEntry entry = {
+    .device = device,
+    .batch = NULL,
+  };
+  return remove_entry(&entry);
+}
+
+enum emlError emlSchedulerRemoveBatch(struct emlBatch* const batch) {
+  const struct emlSchedEntry entry = {
+    .device = NULL,
+    .batch = batch,
+  };
+  return remove_entry(&entry);
+}
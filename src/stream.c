@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+//feature test macro for pwrite(), etc
+#define _XOPEN_SOURCE 600
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "data.h"
+#include "datafile.h"
+#include "debug.h"
+#include "stream.h"
+
+/// Stream state for a single measurement run
+struct emlStream {
+  /// Destination file
+  int fd;
+  /// Whether fd is closed along with the stream
+  int closefd;
+  /// File offset of the header (-1 if the file is not seekable)
+  off_t headeroff;
+  /// Device name and run being written
+  char devname[EML_DEVNAME_MAXLEN];
+  struct emlDataRun* run;
+  /// Number of chunks written
+  unsigned long long nchunks;
+  /// Whether writing failed
+  int failed;
+
+  /// Writer thread
+  pthread_t thread;
+  /// Protects ready and closing
+  pthread_mutex_t lock;
+  /// Wakes the writer thread
+  pthread_cond_t cond;
+  /// Number of datapoints ready to be written
+  size_t ready;
+  /// Whether no more datapoints will become ready
+  int closing;
+};
+
+//retries short writes
+static int writev_all(const int fd, struct iovec* iov, int iovcnt) {
+  while (iovcnt) {
+    ssize_t written = writev(fd, iov, iovcnt);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    for (; iovcnt && (size_t) written >= iov->iov_len; iov++, iovcnt--)
+      written -= iov->iov_len;
+    if (iovcnt) {
+      iov->iov_base = (char*) iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return 0;
+}
+
+//appends datapoints up to upto, one chunk per block
+static void write_points(struct emlStream* const stream, const size_t upto) {
+  struct emlDataRun* run = stream->run;
+  const size_t nfields = emlDataFieldCount(run->props);
+  size_t streamed = run->streamed;
+
+  while (streamed < upto) {
+    //blocks from streamed on are never evicted, but the list head may change
+    pthread_mutex_lock(&run->lock);
+    const struct emlDataBlock* bp = SLIST_FIRST(&run->blocks);
+    while (bp && bp->first + bp->size <= streamed)
+      bp = SLIST_NEXT(bp, entries);
+    pthread_mutex_unlock(&run->lock);
+    if (!bp || bp->first > streamed) {
+      //datapoints missing from the run cannot be written
+      streamed = upto;
+      __atomic_store_n(&run->streamed, streamed, __ATOMIC_RELEASE);
+      break;
+    }
+
+    const size_t start = streamed - bp->first;
+    const size_t end = upto - bp->first < bp->size ? upto - bp->first : bp->size;
+
+    //columns go out as they are, after the chunk header
+    unsigned char chunkheader[EML_DATAFILE_CHUNK_HEADER_SIZE];
+    emlDataFileFormatChunkHeader(chunkheader, end - start);
+    struct iovec iov[1 + EML_DATAPOINT_MAX_FIELDS];
+    iov[0].iov_base = chunkheader;
+    iov[0].iov_len = sizeof(chunkheader);
+    for (size_t field = 0; field < nfields; field++) {
+      iov[1 + field].iov_base = bp->fields + field * bp->size + start;
+      iov[1 + field].iov_len = (end - start) * sizeof(*bp->fields);
+    }
+
+    if (!stream->failed && writev_all(stream->fd, iov, 1 + nfields) < 0) {
+      dbglog_error("%s: stream write failed: %s", stream->devname, strerror(errno));
+      stream->failed = 1;
+    }
+    stream->nchunks++;
+
+    //let the block be evicted even if writing failed
+    streamed = bp->first + end;
+    __atomic_store_n(&run->streamed, streamed, __ATOMIC_RELEASE);
+  }
+}
+
+static void* writer_thread(void* arg) {
+  struct emlStream* stream = arg;
+
+  pthread_mutex_lock(&stream->lock);
+  for (;;) {
+    const size_t streamed = stream->run->streamed;
+    if (streamed == stream->ready) {
+      if (stream->closing)
+        break;
+      pthread_cond_wait(&stream->cond, &stream->lock);
+      continue;
+    }
+
+    const size_t ready = stream->ready;
+    pthread_mutex_unlock(&stream->lock);
+    write_points(stream, ready);
+    pthread_mutex_lock(&stream->lock);
+  }
+  pthread_mutex_unlock(&stream->lock);
+
+  return NULL;
+}
+
+enum emlError emlStreamOpen(
+    struct emlStream** const stream,
+    const int fd,
+    const int closefd,
+    struct emlDataRun* const run,
+    const char* const devname)
+{
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+  //columns are written as they are in memory
+  return EML_UNSUPPORTED;
+#endif
+
+  struct emlStream* s = malloc(sizeof(*s));
+  if (!s)
+    return EML_NO_MEMORY;
+
+  s->fd = fd;
+  s->closefd = closefd;
+  s->headeroff = lseek(fd, 0, SEEK_CUR);
+  snprintf(s->devname, sizeof(s->devname), "%s", devname);
+  s->run = run;
+  s->nchunks = 0;
+  s->failed = 0;
+  s->ready = 0;
+  s->closing = 0;
+  run->streamed = 0;
+
+  unsigned char header[EML_DATAFILE_HEADER_MAX];
+  const size_t header_size = emlDataFileFormatHeader(header, run->props, devname,
+      EML_DATAFILE_SAMPLES | EML_DATAFILE_STREAM, 0, 0, 0, 0);
+  struct iovec iov = { .iov_base = header, .iov_len = header_size };
+  if (writev_all(fd, &iov, 1) < 0) {
+    dbglog_error("%s: stream write failed: %s", devname, strerror(errno));
+    free(s);
+    return EML_UNKNOWN;
+  }
+
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->cond, NULL);
+  int err = pthread_create(&s->thread, NULL, &writer_thread, s);
+  if (err) {
+    dbglog_error("pthread_create returned %d", err);
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+    return EML_UNKNOWN;
+  }
+
+  *stream = s;
+  return EML_SUCCESS;
+}
+
+void emlStreamNotify(struct emlStream* const stream, const size_t npoints) {
+  pthread_mutex_lock(&stream->lock);
+  stream->ready = npoints;
+  pthread_cond_signal(&stream->cond);
+  pthread_mutex_unlock(&stream->lock);
+}
+
+enum emlError emlStreamClose(
+    struct emlStream* const stream,
+    const size_t npoints,
+    const unsigned long long elapsed,
+    const unsigned long long consumed)
+{
+  pthread_mutex_lock(&stream->lock);
+  stream->ready = npoints;
+  stream->closing = 1;
+  pthread_cond_signal(&stream->cond);
+  pthread_mutex_unlock(&stream->lock);
+
+  pthread_join(stream->thread, NULL);
+  pthread_cond_destroy(&stream->cond);
+  pthread_mutex_destroy(&stream->lock);
+
+  //the stream is complete, so record counts and totals if possible
+  if (!stream->failed && stream->headeroff >= 0) {
+    unsigned char header[EML_DATAFILE_HEADER_MAX];
+    const size_t header_size = emlDataFileFormatHeader(header, stream->run->props,
+        stream->devname, EML_DATAFILE_SAMPLES, npoints, elapsed, consumed, stream->nchunks);
+    if (pwrite(stream->fd, header, header_size, stream->headeroff) != (ssize_t) header_size)
+      dbglog_warn("%s: stream header could not be updated: %s", stream->devname, strerror(errno));
+  }
+
+  //all datapoints are on file now
+  __atomic_store_n(&stream->run->streamed, SIZE_MAX, __ATOMIC_RELEASE);
+
+  const enum emlError ret = stream->failed ? EML_UNKNOWN : EML_SUCCESS;
+  if (stream->closefd)
+    close(stream->fd);
+  free(stream);
+  return ret;
+}
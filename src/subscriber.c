@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+//feature test macro for sem_wait(), etc
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "device.h"
+#include "subscriber.h"
+
+/// Subscriber state for a single device
+struct emlSubscriber {
+  /// Device the samples come from
+  const struct emlDevice* device;
+  /// Callback and its context
+  emlSampleCallback_t callback;
+  void* ctx;
+  /// Deliver one sample out of this many
+  size_t decimation;
+  /// Samples skipped since the last one delivered
+  size_t skipped;
+  /// Energy consumed by skipped samples (J)
+  double skipped_energy;
+  /// Delivery mode
+  enum emlDelivery delivery;
+
+  /// Delivery thread (queued mode only)
+  pthread_t thread;
+  /// Counts samples waiting in the queue, wakes the delivery thread
+  sem_t pending;
+  /// Whether the delivery thread should exit once the queue is empty
+  int stopping;
+  /// Ring of queued samples. The sampler is the only writer of head, and
+  /// the delivery thread is the only writer of tail.
+  struct emlSample queue[EML_SUBSCRIBER_QUEUE_SIZE];
+  size_t head;
+  size_t tail;
+  /// Samples dropped because the queue was full
+  unsigned long long drops;
+};
+
+static void* delivery_thread(void* arg) {
+  struct emlSubscriber* sub = arg;
+
+  for (;;) {
+    while (sem_wait(&sub->pending) == -1 && errno == EINTR);
+
+    const size_t head = __atomic_load_n(&sub->head, __ATOMIC_ACQUIRE);
+    size_t tail = sub->tail;
+    if (tail == head) {
+      //only woken up without samples when stopping
+      if (__atomic_load_n(&sub->stopping, __ATOMIC_ACQUIRE))
+        break;
+      continue;
+    }
+
+    sub->callback(sub->device, &sub->queue[tail % EML_SUBSCRIBER_QUEUE_SIZE], sub->ctx);
+    __atomic_store_n(&sub->tail, tail + 1, __ATOMIC_RELEASE);
+  }
+
+  return NULL;
+}
+
+enum emlError emlSubscriberCreate(
+    struct emlSubscriber** const sub,
+    const struct emlDevice* const device,
+    const emlSampleCallback_t callback,
+    void* const ctx,
+    const size_t decimation,
+    const enum emlDelivery delivery)
+{
+  struct emlSubscriber* s = malloc(sizeof(*s));
+  if (!s)
+    return EML_NO_MEMORY;
+
+  s->device = device;
+  s->callback = callback;
+  s->ctx = ctx;
+  s->decimation = decimation ? decimation : 1;
+  s->skipped = 0;
+  s->skipped_energy = 0;
+  s->delivery = delivery;
+  s->stopping = 0;
+  s->head = 0;
+  s->tail = 0;
+  s->drops = 0;
+
+  if (delivery == EML_DELIVERY_QUEUED) {
+    if (sem_init(&s->pending, 0, 0)) {
+      dbglog_error("sem_init failed: %s", strerror(errno));
+      free(s);
+      return EML_UNKNOWN;
+    }
+    int err = pthread_create(&s->thread, NULL, &delivery_thread, s);
+    if (err) {
+      dbglog_error("pthread_create returned %d", err);
+      sem_destroy(&s->pending);
+      free(s);
+      return EML_UNKNOWN;
+    }
+  }
+
+  *sub = s;
+  return EML_SUCCESS;
+}
+
+enum emlError emlSubscriberDestroy(struct emlSubscriber* const sub) {
+  if (sub->delivery == EML_DELIVERY_QUEUED) {
+    __atomic_store_n(&sub->stopping, 1, __ATOMIC_RELEASE);
+    sem_post(&sub->pending);
+    pthread_join(sub->thread, NULL);
+    sem_destroy(&sub->pending);
+  }
+
+  free(sub);
+  return EML_SUCCESS;
+}
+
+void emlSubscriberPush(
+    struct emlSubscriber* const sub,
+    const struct emlSample* const sample)
+{
+  //keep the energy for skipped samples, so it adds up on the next one
+  if (++sub->skipped < sub->decimation) {
+    sub->skipped_energy += sample->energy;
+    return;
+  }
+  struct emlSample s = *sample;
+  s.energy += sub->skipped_energy;
+  sub->skipped = 0;
+  sub->skipped_energy = 0;
+
+  if (sub->delivery == EML_DELIVERY_INLINE) {
+    sub->callback(sub->device, &s, sub->ctx);
+    return;
+  }
+
+  //drop the sample rather than waiting for a slow subscriber
+  const size_t head = sub->head;
+  if (head - __atomic_load_n(&sub->tail, __ATOMIC_ACQUIRE) >= EML_SUBSCRIBER_QUEUE_SIZE) {
+    __atomic_fetch_add(&sub->drops, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  sub->queue[head % EML_SUBSCRIBER_QUEUE_SIZE] = s;
+  __atomic_store_n(&sub->head, head + 1, __ATOMIC_RELEASE);
+  sem_post(&sub->pending);
+}
+
+unsigned long long emlSubscriberDrops(const struct emlSubscriber* const sub) {
+  return __atomic_load_n(&sub->drops, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <eml/table.h>
+
+#include "data.h"
+#include "error.h"
+#include "pack.h"
+
+/// Power values on a regular time grid
+struct emlTable {
+  /// Number of grid points
+  size_t nrows;
+  /// Number of columns (datasets)
+  size_t ncolumns;
+  /// Time of the first grid point, in seconds
+  double start;
+  /// Grid period, in seconds
+  double period;
+  /// Values for each column, one column after another
+  double* values;
+};
+
+/// Interpolation state for a single column
+struct emlResampler {
+  /// Power values of the dataset
+  struct emlDataPowerCursor cursor;
+  /// Last value at or before the current grid point
+  int hasprev;
+  double prevtime;
+  double prevvalue;
+  /// First value after the current grid point
+  int hasnext;
+  double nexttime;
+  double nextvalue;
+};
+
+static void resampler_init(struct emlResampler* const r, const struct emlData* const data) {
+  emlDataPowerCursorInit(&r->cursor, data);
+  r->hasprev = 0;
+  r->hasnext = emlDataPowerNext(&r->cursor, &r->nexttime, &r->nextvalue);
+}
+
+static double resampler_get(
+    struct emlResampler* const r,
+    const double time,
+    const enum emlResampleMethod method)
+{
+  while (r->hasnext && r->nexttime <= time) {
+    r->hasprev = 1;
+    r->prevtime = r->nexttime;
+    r->prevvalue = r->nextvalue;
+    r->hasnext = emlDataPowerNext(&r->cursor, &r->nexttime, &r->nextvalue);
+  }
+
+  if (!r->hasprev)
+    return r->hasnext ? r->nextvalue : 0;
+  if (method == EML_RESAMPLE_LINEAR && r->hasnext && r->nexttime > r->prevtime)
+    return r->prevvalue + (r->nextvalue - r->prevvalue)
+      * (time - r->prevtime) / (r->nexttime - r->prevtime);
+  return r->prevvalue;
+}
+
+//finds the times of the first and last power values of a dataset
+static int power_range(const struct emlData* const data, double* const first, double* const last) {
+  struct emlDataPowerCursor cursor;
+  emlDataPowerCursorInit(&cursor, data);
+  double power;
+  if (!emlDataPowerNext(&cursor, first, &power))
+    return 0;
+
+  //the last value is at the last datapoint, found without reading the others
+  const struct emlDataBlock* lastblock = data->firstblock;
+  for (const struct emlDataBlock* bp = data->firstblock; bp != NULL; bp = emlDataNextBlock(data, bp))
+    lastblock = bp;
+  const size_t i = data->firstpoint + data->npoints - 1 - lastblock->first;
+  *last = emlDataApplyFactor(emlDataBlockValue(lastblock, timestamp_field, i),
+      data->run->props->time_factor);
+  return 1;
+}
+
+enum emlError emlDataAlign(
+    const struct emlData* const* const datas,
+    const size_t ndatas,
+    const double period,
+    const enum emlResampleMethod method,
+    struct emlTable** const table)
+{
+  if (!datas || !ndatas || !table || !(period > 0) || !isfinite(period))
+    return EML_INVALID_PARAMETER;
+  if (method != EML_RESAMPLE_HOLD && method != EML_RESAMPLE_LINEAR)
+    return EML_INVALID_PARAMETER;
+  for (size_t i = 0; i < ndatas; i++) {
+    if (!datas[i])
+      return EML_INVALID_PARAMETER;
+    if (datas[i]->run->totals_only)
+      return EML_UNSUPPORTED;
+  }
+
+  //the grid covers the time span shared by all datasets
+  double start = 0, end = 0;
+  int empty = 0;
+  for (size_t i = 0; i < ndatas; i++) {
+    double first, last;
+    empty = !power_range(datas[i], &first, &last);
+    if (empty)
+      break;
+    if (!i || first > start)
+      start = first;
+    if (!i || last < end)
+      end = last;
+  }
+  size_t nrows = 0;
+  if (!empty && end >= start) {
+    const double rows = floor((end - start) / period) + 1;
+    if (rows > SIZE_MAX / ndatas / sizeof(double))
+      return EML_NO_MEMORY;
+    nrows = rows;
+  }
+
+  struct emlTable* t = malloc(sizeof(*t));
+  if (!t)
+    return EML_NO_MEMORY;
+  t->nrows = nrows;
+  t->ncolumns = ndatas;
+  t->start = start;
+  t->period = period;
+  t->values = malloc((nrows ? nrows : 1) * ndatas * sizeof(*t->values));
+  if (!t->values) {
+    free(t);
+    return EML_NO_MEMORY;
+  }
+
+  //fill one column at a time, walking each dataset once
+  for (size_t column = 0; column < ndatas; column++) {
+    struct emlResampler r;
+    resampler_init(&r, datas[column]);
+    double* values = t->values + column * nrows;
+    for (size_t row = 0; row < nrows; row++)
+      values[row] = resampler_get(&r, start + row * period, method);
+  }
+
+  *table = t;
+  return EML_SUCCESS;
+}
+
+enum emlError emlDataResample(
+    const struct emlData* const data,
+    const double period,
+    const enum emlResampleMethod method,
+    struct emlTable** const table)
+{
+  if (!data)
+    return EML_INVALID_PARAMETER;
+  return emlDataAlign(&data, 1, period, method, table);
+}
+
+enum emlError emlTableFree(struct emlTable* const table) {
+  if (table) {
+    free(table->values);
+    free(table);
+  }
+  return EML_SUCCESS;
+}
+
+enum emlError emlTableGetSize(
+    const struct emlTable* const table,
+    size_t* const nrows,
+    size_t* const ncolumns)
+{
+  if (!table || !nrows || !ncolumns)
+    return EML_INVALID_PARAMETER;
+
+  *nrows = table->nrows;
+  *ncolumns = table->ncolumns;
+  return EML_SUCCESS;
+}
+
+enum emlError emlTableGetGrid(
+    const struct emlTable* const table,
+    double* const start,
+    double* const period)
+{
+  if (!table || !start || !period)
+    return EML_INVALID_PARAMETER;
+
+  *start = table->start;
+  *period = table->period;
+  return EML_SUCCESS;
+}
+
+enum emlError emlTableGetColumn(
+    const struct emlTable* const table,
+    const size_t column,
+    const double** const values)
+{
+  if (!table || column >= table->ncolumns || !values)
+    return EML_INVALID_PARAMETER;
+
+  *values = table->values + column * table->nrows;
+  return EML_SUCCESS;
+}
@@ -65,3 +65,15 @@ unsigned long long millitimestamp() {
 
   return tms.tv_sec * 1000U + round(tms.tv_nsec / 1.0e6);
 }
+
+unsigned long long monotonictimestamp() {
+  struct timespec tms;
+
+  int ret = clock_gettime(CLOCK_MONOTONIC, &tms);
+  if (ret) {
+    dbglog_error("clock_gettime: %s", strerror(errno));
+    return 0;
+  }
+
+  return tms.tv_sec * 1000000000ULL + tms.tv_nsec;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+//feature test macro for pthread_condattr_setclock(), etc
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "debug.h"
+#include "device.h"
+#include "monitor.h"
+#include "timer.h"
+#include "watchdog.h"
+
+static const unsigned long long NS_PER_SEC = 1000000000ULL;
+
+/// A watched device
+struct emlWatchEntry {
+  /// Device to be sampled
+  const struct emlDevice* device;
+  /// Interval between samples, in nanoseconds
+  unsigned long long period;
+  /// Time of the next sample (in monotonictimestamp() units)
+  unsigned long long deadline;
+};
+
+/// Watchdog state
+static struct {
+  /// Watchdog thread
+  pthread_t thread;
+  /// Whether the thread was started
+  int running;
+  /// Whether the thread is shutting down
+  int stopping;
+  /// Watched devices, in no particular order (there are few, sampled rarely)
+  struct emlWatchEntry* entries;
+  size_t nentries;
+  size_t capacity;
+
+  /// Protects all watchdog state, and is held while sampling
+  pthread_mutex_t lock;
+  /// Wakes the thread when devices are added, or on shutdown
+  pthread_cond_t cond;
+} watchdog = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void* watchdog_thread(void* arg) {
+  (void) arg;
+
+  pthread_mutex_lock(&watchdog.lock);
+  while (!watchdog.stopping) {
+    if (!watchdog.nentries) {
+      pthread_cond_wait(&watchdog.cond, &watchdog.lock);
+      continue;
+    }
+
+    size_t next = 0;
+    for (size_t i = 1; i < watchdog.nentries; i++) {
+      if (watchdog.entries[i].deadline < watchdog.entries[next].deadline)
+        next = i;
+    }
+
+    struct emlWatchEntry* entry = &watchdog.entries[next];
+    if (entry->deadline > monotonictimestamp()) {
+      const struct timespec abstime = {
+        .tv_sec = entry->deadline / NS_PER_SEC,
+        .tv_nsec = entry->deadline % NS_PER_SEC,
+      };
+      int err = pthread_cond_timedwait(&watchdog.cond, &watchdog.lock, &abstime);
+      assert(err != EINVAL);
+      (void) err;
+      //devices may have changed while waiting
+      continue;
+    }
+
+    //sampling under the lock lets emlWatchdogRemove wait for it
+    enum emlError err = emlDeviceMonitorSample(entry->device);
+    if (err != EML_SUCCESS) {
+      dbglog_error("%s: watchdog stopped: %s", entry->device->name, emlErrorMessage(err));
+      *entry = watchdog.entries[--watchdog.nentries];
+      continue;
+    }
+    entry->deadline = monotonictimestamp() + entry->period;
+  }
+  pthread_mutex_unlock(&watchdog.lock);
+
+  return NULL;
+}
+
+//called with the lock held
+static enum emlError start_thread() {
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&watchdog.cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  watchdog.stopping = 0;
+  int err = pthread_create(&watchdog.thread, NULL, &watchdog_thread, NULL);
+  if (err) {
+    dbglog_error("pthread_create returned %d", err);
+    pthread_cond_destroy(&watchdog.cond);
+    return EML_UNKNOWN;
+  }
+  watchdog.running = 1;
+  return EML_SUCCESS;
+}
+
+enum emlError emlWatchdogAdd(
+    const struct emlDevice* const device,
+    const unsigned long long period)
+{
+  struct emlWatchEntry entry = {
+    .device = device,
+    .period = period,
+    .deadline = monotonictimestamp() + period,
+  };
+
+  pthread_mutex_lock(&watchdog.lock);
+
+  if (!watchdog.running) {
+    enum emlError err = start_thread();
+    if (err != EML_SUCCESS) {
+      pthread_mutex_unlock(&watchdog.lock);
+      return err;
+    }
+  }
+
+  if (watchdog.nentries == watchdog.capacity) {
+    size_t newcap = watchdog.capacity ? 2 * watchdog.capacity : 4;
+    struct emlWatchEntry* newentries = realloc(watchdog.entries, newcap * sizeof(*newentries));
+    if (!newentries) {
+      pthread_mutex_unlock(&watchdog.lock);
+      return EML_NO_MEMORY;
+    }
+    watchdog.entries = newentries;
+    watchdog.capacity = newcap;
+  }
+
+  watchdog.entries[watchdog.nentries++] = entry;
+  pthread_cond_signal(&watchdog.cond);
+
+  pthread_mutex_unlock(&watchdog.lock);
+  return EML_SUCCESS;
+}
+
+enum emlError emlWatchdogRemove(const struct emlDevice* const device) {
+  enum emlError ret = EML_NOT_STARTED;
+
+  pthread_mutex_lock(&watchdog.lock);
+  for (size_t i = 0; i < watchdog.nentries; i++) {
+    if (watchdog.entries[i].device == device) {
+      watchdog.entries[i] = watchdog.entries[--watchdog.nentries];
+      ret = EML_SUCCESS;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&watchdog.lock);
+
+  return ret;
+}
+
+enum emlError emlWatchdogShutdown() {
+  pthread_mutex_lock(&watchdog.lock);
+  if (!watchdog.running) {
+    pthread_mutex_unlock(&watchdog.lock);
+    return EML_SUCCESS;
+  }
+
+  assert(!watchdog.nentries);
+  watchdog.stopping = 1;
+  pthread_cond_signal(&watchdog.cond);
+  pthread_mutex_unlock(&watchdog.lock);
+
+  pthread_join(watchdog.thread, NULL);
+
+  pthread_cond_destroy(&watchdog.cond);
+  free(watchdog.entries);
+  watchdog.entries = NULL;
+  watchdog.nentries = 0;
+  watchdog.capacity = 0;
+  watchdog.running = 0;
+
+  return EML_SUCCESS;
+}
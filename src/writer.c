@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "writer.h"
+
+/// Decimal representation of every number from 00 to 99
+static const char digit_pairs[201] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+size_t emlFormatULL(char* const dst, unsigned long long value) {
+  //fill a scratch buffer backwards, two digits at a time
+  char tmp[EML_WRITER_ULL_DIGITS];
+  char* p = tmp + sizeof(tmp);
+  while (value >= 100) {
+    const unsigned idx = (value % 100) * 2;
+    value /= 100;
+    *--p = digit_pairs[idx + 1];
+    *--p = digit_pairs[idx];
+  }
+  if (value >= 10) {
+    const unsigned idx = value * 2;
+    *--p = digit_pairs[idx + 1];
+    *--p = digit_pairs[idx];
+  }
+  else {
+    *--p = '0' + value;
+  }
+
+  const size_t len = tmp + sizeof(tmp) - p;
+  memcpy(dst, p, len);
+  return len;
+}
+
+enum emlError emlWriterInit(struct emlWriter* const writer, FILE* const file) {
+  writer->file = file;
+  writer->len = 0;
+  writer->buf = malloc(EML_WRITER_BUFSIZE);
+  if (!writer->buf)
+    return EML_NO_MEMORY;
+  return EML_SUCCESS;
+}
+
+void emlWriterFlush(struct emlWriter* const writer) {
+  if (writer->len)
+    fwrite(writer->buf, 1, writer->len, writer->file);
+  writer->len = 0;
+}
+
+enum emlError emlWriterClose(struct emlWriter* const writer) {
+  emlWriterFlush(writer);
+  free(writer->buf);
+  writer->buf = NULL;
+  return ferror(writer->file) ? EML_UNKNOWN : EML_SUCCESS;
+}
+
+void emlWriterPutString(struct emlWriter* const writer, const char* const str, const size_t len) {
+  if (writer->len + len > EML_WRITER_BUFSIZE) {
+    emlWriterFlush(writer);
+    //strings larger than the buffer are written directly
+    if (len > EML_WRITER_BUFSIZE) {
+      fwrite(str, 1, len, writer->file);
+      return;
+    }
+  }
+  memcpy(writer->buf + writer->len, str, len);
+  writer->len += len;
+}
+
+void emlWriterPutChar(struct emlWriter* const writer, const char c) {
+  if (writer->len == EML_WRITER_BUFSIZE)
+    emlWriterFlush(writer);
+  writer->buf[writer->len++] = c;
+}
+
+void emlWriterPutULL(struct emlWriter* const writer, const unsigned long long value) {
+  if (writer->len + EML_WRITER_ULL_DIGITS > EML_WRITER_BUFSIZE)
+    emlWriterFlush(writer);
+  writer->len += emlFormatULL(writer->buf + writer->len, value);
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * Dump throughput benchmark.
+ *
+ * Measures on the first device (meant for the dummy driver with a short
+ * sampling_interval) until TEST_SAMPLES datapoints are gathered, then
+ * compares dumping them through per-value fprintf calls (the former JSON
+ * writer) against emlDataDumpJSON, emlDataDumpCSV and emlDataDumpBinary.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <eml.h>
+
+#ifndef TEST_SAMPLES
+#define TEST_SAMPLES 1000000
+#endif
+
+#ifndef TEST_ITERATIONS
+#define TEST_ITERATIONS 3
+#endif
+
+void check_error(emlError_t ret) {
+  if (ret != EML_SUCCESS) {
+    fprintf(stderr, "error: %s\n", emlErrorMessage(ret));
+    exit(1);
+  }
+}
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//datapoints of the dataset being dumped, read back from a binary dump
+emlDataFile_t* columns;
+
+//formats datapoints the way emlDataDumpJSON used to, one fprintf per value
+emlError_t dump_fprintf(const emlData_t* data, FILE* dumpfile) {
+  (void) data;
+
+  size_t nchunks;
+  check_error(emlDataFileGetChunkCount(columns, &nchunks));
+  char delim = ' ';
+  for (size_t c = 0; c < nchunks; c++) {
+    size_t npoints;
+    const unsigned long long *ts, *energy, *power;
+    check_error(emlDataFileGetChunk(columns, c, &npoints, &ts, &energy, &power));
+    for (size_t i = 0; i < npoints; i++) {
+      fprintf(dumpfile, "   %c[%llu", delim, ts[i]);
+      if (energy)
+        fprintf(dumpfile, ",%llu", energy[i]);
+      if (power)
+        fprintf(dumpfile, ",%llu", power[i]);
+      fprintf(dumpfile, "]\n");
+      delim = ',';
+    }
+  }
+  return EML_SUCCESS;
+}
+
+void bench(const char* name, emlError_t (*dump)(const emlData_t*, FILE*), const emlData_t* data) {
+  double best = 0;
+  long size = 0;
+  for (int i = 0; i < TEST_ITERATIONS; i++) {
+    FILE* out = tmpfile();
+    double start = now();
+    check_error(dump(data, out));
+    fflush(out);
+    double elapsed = now() - start;
+    size = ftell(out);
+    fclose(out);
+
+    double rate = size / elapsed / 1e6;
+    if (rate > best)
+      best = rate;
+  }
+  printf("%-8s %10ld bytes %8.1f MB/s\n", name, size, best);
+}
+
+//counts samples as they are taken
+void count_sample(const emlDevice_t* dev, const emlSample_t* sample, void* ctx) {
+  (void) dev;
+  __atomic_store_n((size_t*) ctx, sample->index + 1, __ATOMIC_RELAXED);
+}
+
+int main() {
+  check_error(emlInit());
+
+  emlDevice_t* dev;
+  check_error(emlDeviceByIndex(0, &dev));
+
+  //sample until enough datapoints have been gathered
+  size_t nsamples = 0;
+  check_error(emlDeviceSubscribe(dev, &count_sample, &nsamples, 1, EML_DELIVERY_INLINE));
+  check_error(emlDeviceStart(dev));
+  const struct timespec poll = { .tv_sec = 0, .tv_nsec = 100000000 };
+  while (__atomic_load_n(&nsamples, __ATOMIC_RELAXED) < TEST_SAMPLES)
+    nanosleep(&poll, NULL);
+
+  emlData_t* data;
+  check_error(emlDeviceStop(dev, &data));
+  check_error(emlDeviceUnsubscribe(dev));
+  printf("%zu samples\n", nsamples);
+
+  //keep the raw columns around for the fprintf baseline
+  char path[] = "/tmp/dump_benchXXXXXX";
+  int fd = mkstemp(path);
+  FILE* binfile = fdopen(fd, "wb");
+  check_error(emlDataDumpBinary(data, binfile));
+  fclose(binfile);
+  check_error(emlDataFileOpen(path, &columns));
+  unlink(path);
+
+  bench("fprintf", &dump_fprintf, data);
+  bench("json", &emlDataDumpJSON, data);
+  bench("csv", &emlDataDumpCSV, data);
+  bench("binary", &emlDataDumpBinary, data);
+
+  check_error(emlDataFileClose(columns));
+  check_error(emlDataFree(data));
+  check_error(emlShutdown());
+  return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2014 Universidad de La Laguna <cap@pcg.ull.es>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * RAPL startup benchmark.
+ *
+ * Builds a fake system tree (cpuinfo, CPU topology and MSR device files) for
+ * TEST_CPUS present CPUs over TEST_PACKAGES packages, with a gap in CPU
+ * numbers and every eighth CPU offline, then times emlInit and emlShutdown
+ * with the rapl driver reading it through the msr backend (see the
+ * system_root option).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <eml.h>
+
+#ifndef TEST_CPUS
+#define TEST_CPUS 512
+#endif
+
+#ifndef TEST_PACKAGES
+#define TEST_PACKAGES 4
+#endif
+
+#ifndef TEST_ITERATIONS
+#define TEST_ITERATIONS 20
+#endif
+
+//CPU numbers from here on are shifted, leaving a gap in the present list
+#define TEST_GAP_START (TEST_CPUS / 2)
+#define TEST_GAP 64
+
+void check_error(emlError_t ret) {
+  if (ret != EML_SUCCESS) {
+    fprintf(stderr, "error: %s\n", emlErrorMessage(ret));
+    exit(1);
+  }
+}
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+char root[] = "/tmp/rapl_startupXXXXXX";
+
+//creates a file under the fake root (and its parent directories)
+FILE* create(const char* relpath) {
+  char path[BUFSIZ];
+  snprintf(path, sizeof(path), "%s/%s", root, relpath);
+  for (char* p = path + strlen(root) + 1; (p = strchr(p, '/')); p++) {
+    *p = '\0';
+    mkdir(path, 0755);
+    *p = '/';
+  }
+  FILE* file = fopen(path, "w");
+  if (!file) {
+    perror(path);
+    exit(1);
+  }
+  return file;
+}
+
+void write_msr(FILE* file, long offset, unsigned long long value) {
+  fseek(file, offset, SEEK_SET);
+  fwrite(&value, sizeof(value), 1, file);
+}
+
+size_t cpu_number(size_t i) {
+  return i < TEST_GAP_START ? i : i + TEST_GAP;
+}
+
+void build_tree() {
+  const size_t percpu = TEST_CPUS / TEST_PACKAGES;
+  FILE* file;
+
+  file = create("proc/cpuinfo");
+  for (size_t i = 0; i < TEST_CPUS; i++) {
+    fprintf(file, "processor\t: %zu\nvendor_id\t: GenuineIntel\n"
+        "cpu family\t: 6\nmodel\t\t: 63\n\n", cpu_number(i));
+  }
+  fclose(file);
+
+  file = create("sys/devices/system/cpu/present");
+  fprintf(file, "0-%d,%d-%d\n", TEST_GAP_START - 1, TEST_GAP_START + TEST_GAP,
+      TEST_CPUS + TEST_GAP - 1);
+  fclose(file);
+
+  char relpath[BUFSIZ];
+  for (size_t i = 0; i < TEST_CPUS; i++) {
+    const size_t cpu = cpu_number(i);
+    const size_t pkg = i / percpu;
+    if (i % 8 == 0)
+      continue;
+
+    snprintf(relpath, sizeof(relpath),
+        "sys/devices/system/cpu/cpu%zu/topology/physical_package_id", cpu);
+    file = create(relpath);
+    fprintf(file, "%zu\n", pkg);
+    fclose(file);
+
+    snprintf(relpath, sizeof(relpath),
+        "sys/devices/system/cpu/cpu%zu/topology/package_cpus_list", cpu);
+    file = create(relpath);
+    const size_t first = cpu_number(pkg * percpu);
+    const size_t last = cpu_number((pkg + 1) * percpu - 1);
+    if (first < TEST_GAP_START && last >= TEST_GAP_START)
+      fprintf(file, "%zu-%d,%d-%zu\n", first, TEST_GAP_START - 1,
+          TEST_GAP_START + TEST_GAP, last);
+    else
+      fprintf(file, "%zu-%zu\n", first, last);
+    fclose(file);
+
+    //MSR devices as sparse files, read at register offsets
+    snprintf(relpath, sizeof(relpath), "dev/cpu/%zu/msr", cpu);
+    file = create(relpath);
+    write_msr(file, 0x606, 0xa0e03);
+    write_msr(file, 0x611, 1000);
+    write_msr(file, 0x619, 1000);
+    write_msr(file, 0x639, 1000);
+    fclose(file);
+  }
+}
+
+void remove_tree() {
+  char command[BUFSIZ];
+  snprintf(command, sizeof(command), "rm -rf '%s'", root);
+  if (system(command))
+    fprintf(stderr, "failed to remove %s\n", root);
+}
+
+int main() {
+  if (!mkdtemp(root)) {
+    perror(root);
+    return 1;
+  }
+  build_tree();
+
+  char relpath[BUFSIZ];
+  snprintf(relpath, sizeof(relpath), "eml/config");
+  FILE* file = create(relpath);
+  fprintf(file, "dummy {\n  disabled = true\n}\n"
+      "rapl {\n  backend = \"msr\"\n  system_root = \"%s\"\n}\n", root);
+  fclose(file);
+  setenv("XDG_CONFIG_HOME", root, 1);
+
+  double best = 0;
+  size_t ndevices = 0;
+  for (int i = 0; i < TEST_ITERATIONS; i++) {
+    double start = now();
+    check_error(emlInit());
+    check_error(emlDeviceGetCount(&ndevices));
+    check_error(emlShutdown());
+    double elapsed = now() - start;
+    if (!i || elapsed < best)
+      best = elapsed;
+  }
+  printf("%d cpus %d packages: %zu devices, init+shutdown %.3f ms\n",
+      TEST_CPUS, TEST_PACKAGES, ndevices, best * 1e3);
+
+  remove_tree();
+  return 0;
+}